@@ -0,0 +1,35 @@
+// Wire Bus Scan
+// by MX682X
+
+// Demonstrates use of the Wire library
+// Lists the addresses of all I2C/TWI slave devices on the bus
+
+// Tested with Curiosity Nano - AVR128DA48
+
+// Wire.scan() sends only the address of every device from 0x08 to 0x77 and
+// returns a bitmap of the ones that acknowledged. It stops early if the bus
+// is stuck, e.g. because the pull-ups are missing, and returns the error.
+// The result is printed on the serial monitor every 5 seconds.
+#include <Wire.h>
+
+void setup() {
+  Wire.begin();                                 // initialize master
+  Serial1.begin(9600);
+}
+
+void loop() {
+  uint8_t map[16];
+  uint8_t error = Wire.scan(map);
+  if (error != 0) {
+    Serial1.print("Scan aborted, error ");
+    Serial1.println(error);
+  }
+  for (uint8_t address = 0; address < 0x80; address++) {
+    if (map[address >> 3] & (1 << (address & 0x07))) {
+      Serial1.print("Device at 0x");
+      Serial1.println(address, HEX);
+    }
+  }
+  Serial1.println();
+  delay(5000);
+}
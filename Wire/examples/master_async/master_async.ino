@@ -0,0 +1,48 @@
+// Wire Master Async
+// by MX682X
+
+// Demonstrates use of the interrupt driven host engine of the New Wire library
+// Reads 4 bytes from an I2C/TWI slave device without blocking the loop
+// Refer to the "Wire Slave Write" example for use with this
+
+// The interrupt driven host engine is optional to save flash on the smaller parts.
+// To use it, TWI_MASTER_ASYNC has to be defined, e.g. by uncommenting it in twi.h
+
+#include <Wire.h>
+
+volatile bool rxDone = false;
+uint32_t loopCount = 0;
+
+void setup() {
+  Wire.begin();                         // initialize master
+  Wire.onMasterComplete(masterDone);    // called from the interrupt when the transaction has finished
+  Serial1.begin(9600);
+  Wire.requestFromAsync(0x54, 4);       // returns immediately
+}
+
+void loop() {
+  loopCount++;                          // the CPU is free to do something else while the bus is busy
+  if (rxDone) {
+    rxDone = false;
+    if (Wire.masterStatus() == 0 && Wire.available() == 4) {
+      uint32_t ms;
+      ms  = (uint32_t)Wire.read();      // read out 32-bit wide data
+      ms |= (uint32_t)Wire.read() <<  8;
+      ms |= (uint32_t)Wire.read() << 16;
+      ms |= (uint32_t)Wire.read() << 24;
+      Serial1.print(ms);                // print the milliseconds from Slave
+      Serial1.print(" - loops while waiting: ");
+      Serial1.println(loopCount);
+    } else {
+      Serial1.println("Wire.requestFromAsync() failed!");
+    }
+    delay(500);
+    loopCount = 0;
+    Wire.requestFromAsync(0x54, 4);     // start the next read
+  }
+}
+
+void masterDone(uint8_t status) {
+  (void) status;                        // Wire.masterStatus() returns the same value
+  rxDone = true;
+}
@@ -0,0 +1,62 @@
+// Wire Master Queue
+// by MX682X
+
+// Demonstrates the transaction queue of the New Wire library
+// Reads the registers of three sensors back-to-back from the interrupt,
+// while the loop is free to do something else
+
+// The queue is part of the interrupt driven host engine, which is optional to save flash
+// on the smaller parts. To use it, TWI_MASTER_ASYNC has to be defined, e.g. by uncommenting it in twi.h
+
+#include <Wire.h>
+
+const uint8_t regTemp  = 0x00;      // register addresses of the sensors
+const uint8_t regAccel = 0x28;
+const uint8_t regPres  = 0xF7;
+
+uint8_t temp[2];
+uint8_t accel[6];
+uint8_t pres[3];
+
+volatile bool sweepDone = false;
+
+void lastDone(struct twiTransaction *xfer) {
+  (void) xfer;
+  sweepDone = true;                 // called from the interrupt
+}
+
+// write the register address, REP START, read the data, STOP
+WireTransaction readTemp (0x48, &regTemp,  1, temp,  sizeof(temp));
+WireTransaction readAccel(0x19, &regAccel, 1, accel, sizeof(accel));
+WireTransaction readPres (0x76, &regPres,  1, pres,  sizeof(pres), true, lastDone);
+
+void setup() {
+  Wire.begin();                     // initialize master
+  Wire.setClock(400000);
+  Serial1.begin(115200);
+}
+
+void loop() {
+  Wire.enqueue(&readTemp);          // post the whole sweep at once, every call returns immediately
+  Wire.enqueue(&readAccel);
+  Wire.enqueue(&readPres);
+
+  while (!sweepDone) {
+    // do something useful here
+  }
+  sweepDone = false;
+
+  if (readTemp.status == 0) {
+    Serial1.print("Temperature raw: ");
+    Serial1.println((temp[0] << 8) | temp[1]);
+  }
+  if (readAccel.status == 0) {
+    Serial1.print("Acceleration X raw: ");
+    Serial1.println((int16_t)((accel[1] << 8) | accel[0]));
+  }
+  if (readPres.status == 0) {
+    Serial1.print("Pressure raw: ");
+    Serial1.println(((uint32_t)pres[0] << 12) | ((uint16_t)pres[1] << 4) | (pres[2] >> 4));
+  }
+  delay(100);
+}
@@ -0,0 +1,30 @@
+// Wire Slave Deferred
+// by MX682X
+
+// Demonstrates use of the Wire library
+// Receives data as an I2C/TWI slave device, without onReceive
+// Refer to the "Wire Master Write" example for use with this
+// Needs TWI_SLAVE_DEFERRED defined in twi.h
+
+// Tested with Curiosity Nano - AVR128DA48
+
+// This example prints every message that is received on the I2C bus
+// on the serial monitor. The library keeps the messages until loop()
+// reads them, so printing can take as long as it wants to, the next
+// message is received in the meantime.
+#include <Wire.h>
+
+uint8_t message[BUFFER_LENGTH];
+
+void setup() {
+  Wire.begin(0x54);                 // join i2c bus with address 0x54
+  Serial1.begin(9600);
+}
+
+void loop() {
+  if (Wire.slaveMessageAvailable() > 0) {                   // a complete message has arrived
+    uint8_t len = Wire.readSlaveMessage(message, sizeof(message));
+    Serial1.write(message, len);
+    Serial1.println();
+  }
+}
@@ -0,0 +1,33 @@
+// Wire Slave Registers
+// by MX682X
+
+// Demonstrates use of the Wire library
+// Acts like a register based I2C/TWI slave device, e.g. a sensor
+// Needs TWI_SLAVE_REGISTERS defined in twi.h
+
+// Tested with Curiosity Nano - AVR128DA48
+
+// The master writes the number of a register first, then the new values
+// of it and the following registers. When the master reads, it gets the
+// registers starting with the one it wrote last. Register 0 holds the
+// millis() counter and can't be changed by the master, register 1 is
+// printed on the serial monitor when it changes.
+#include <Wire.h>
+
+uint8_t registers[8];
+const uint8_t writeProtect[8] = {0xFF, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00};
+uint8_t lastValue;
+
+void setup() {
+  Wire.begin(0x54);                                     // join i2c bus with address 0x54
+  Wire.setSlaveRegisters(registers, 8, writeProtect);   // the library answers from the registers
+  Serial1.begin(9600);
+}
+
+void loop() {
+  registers[0] = (uint8_t)millis();   // a single byte, so the master never sees half of an update
+  if (registers[1] != lastValue) {
+    lastValue = registers[1];
+    Serial1.println(lastValue);
+  }
+}
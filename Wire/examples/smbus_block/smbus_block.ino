@@ -0,0 +1,43 @@
+// Wire SMBus Block
+// by MX682X
+
+// Demonstrates use of the SMBus block transfers of the New Wire library
+// Polls the manufacturer ID (MFR_ID, 0x99) of a PMBus regulator at address 0x40
+// and writes a user block (USER_DATA_00, 0xB0) once at the start
+
+// The block transfers are optional to save flash on the smaller parts.
+// To use them, TWI_SMBUS_BLOCK has to be defined, e.g. by uncommenting it in twi.h
+
+// blockRead() reads the length the client sends first and then exactly that many bytes,
+// one transaction of the minimum length. blockWrite() sends the command and the length
+// before the data, blockProcessCall() does both with a REP START in between.
+
+#include <Wire.h>
+
+#define REGULATOR_ADDRESS   0x40
+#define MFR_ID              0x99
+#define USER_DATA_00        0xB0
+
+const uint8_t userData[] = {'b', 'o', 'a', 'r', 'd', '1'};
+
+void setup() {
+  Wire.begin();                         // initialize master
+  Serial1.begin(9600);
+  if (Wire.blockWrite(REGULATOR_ADDRESS, USER_DATA_00, userData, sizeof(userData)) != sizeof(userData)) {
+    Serial1.println("Regulator did not take the user data");
+  }
+}
+
+void loop() {
+  uint8_t length = Wire.blockRead(REGULATOR_ADDRESS, MFR_ID);
+  if (length != 0) {
+    Serial1.print("Manufacturer: ");
+    while (Wire.available()) {
+      Serial1.write((char)Wire.read());
+    }
+    Serial1.println();
+  } else {
+    Serial1.println("No answer");
+  }
+  delay(1000);
+}
@@ -0,0 +1,50 @@
+// Wire SMBus PEC
+// by MX682X
+
+// Demonstrates use of the SMBus Packet Error Checking of the New Wire library
+// Reads the voltage of a smart battery (address 0x0B, command 0x09) with a read word
+// and writes its battery mode (command 0x03) with a write word
+
+// The PEC is optional to save flash on the smaller parts.
+// To use it, TWI_SMBUS_PEC has to be defined, e.g. by uncommenting it in twi.h
+
+// The CRC is calculated while the bytes are on the bus. endTransmission() appends it,
+// requestFrom() reads it after the data and returns 0 if it does not match.
+// endTransmission(false) followed by requestFrom() is checked as one transaction.
+
+#include <Wire.h>
+
+#define BATTERY_ADDRESS   0x0B
+#define BATTERY_MODE      0x03
+#define BATTERY_VOLTAGE   0x09
+
+void setup() {
+  Wire.begin();                         // initialize master
+  Wire.setClock(100000);                // SMBus is limited to 100kHz
+  Wire.setPEC(TWI_PEC_HOST);
+  Serial1.begin(9600);
+
+  Wire.beginTransmission(BATTERY_ADDRESS);
+  Wire.write(BATTERY_MODE);
+  Wire.write(0x00);                     // low byte first
+  Wire.write(0x80);                     // report capacity in 10mWh
+  if (Wire.endTransmission() != 3) {    // the PEC is not counted
+    Serial1.println("Battery did not accept the mode");
+  }
+}
+
+void loop() {
+  Wire.beginTransmission(BATTERY_ADDRESS);
+  Wire.write(BATTERY_VOLTAGE);
+  Wire.endTransmission(false);          // REP START, no PEC yet
+  if (Wire.requestFrom(BATTERY_ADDRESS, 2) == 2) {
+    uint16_t voltage = Wire.read();
+    voltage |= Wire.read() << 8;
+    Serial1.print("Battery voltage: ");
+    Serial1.print(voltage);
+    Serial1.println(" mV");
+  } else {
+    Serial1.println("No answer or wrong PEC");
+  }
+  delay(1000);
+}
@@ -0,0 +1,58 @@
+// Wire 10-bit Address
+// by MX682X
+
+// Demonstrates use of the 10-bit addresses of the New Wire library
+// Writes a register pointer to a client at the 10-bit address 0x2A5 and reads two bytes from there.
+// The second TWI module (Wire1) acts as such a client at the same time, so this works on
+// a single board with both TWI modules connected to the same bus.
+
+// The 10-bit addresses are optional to save flash on the smaller parts.
+// To use them, TWI_10BIT_ADDRESS has to be defined, e.g. by uncommenting it in twi.h
+
+// beginTransmission10() and requestFrom10() send the address as two bytes, 11110 with the
+// two high bits first, then the low byte. A read after endTransmission(false) only needs the
+// first byte again. begin10() makes the client answer only when both bytes match.
+
+#include <Wire.h>
+
+#define CLIENT_ADDRESS    0x2A5
+
+uint8_t registers[4] = {0x10, 0x20, 0x30, 0x40};
+uint8_t pointer = 0;
+
+void setup() {
+  Wire.begin();                         // initialize master
+  Wire1.begin10(CLIENT_ADDRESS);        // initialize client
+  Wire1.onReceive(receiveHandler);
+  Wire1.onRequest(requestHandler);
+  Serial1.begin(9600);
+}
+
+void loop() {
+  Wire.beginTransmission10(CLIENT_ADDRESS);
+  Wire.write(2);                        // register pointer
+  Wire.endTransmission(false);          // REP START follows
+  if (Wire.requestFrom10(CLIENT_ADDRESS, 2) == 2) {
+    Serial1.print("Registers: ");
+    Serial1.print(Wire.read(), HEX);
+    Serial1.print(' ');
+    Serial1.println(Wire.read(), HEX);
+  } else {
+    Serial1.println("No answer");
+  }
+  delay(1000);
+}
+
+void receiveHandler(int numBytes) {
+  if (numBytes > 0) {
+    pointer = Wire1.read() & 0x03;
+  }
+  while (Wire1.available()) {
+    Wire1.read();
+  }
+}
+
+void requestHandler() {
+  Wire1.write(registers[pointer]);
+  Wire1.write(registers[(pointer + 1) & 0x03]);
+}
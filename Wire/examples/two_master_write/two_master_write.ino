@@ -24,6 +24,8 @@ int8_t len = 0;
 void setup() {
   Wire.begin();           // initialize master
   Wire1.begin();
+  Wire.setRetry(3, 50);   // both masters share the bus, when one loses the arbitration, it tries again
+  Wire1.setRetry(3, 50);  // after 50us and 100us. Needs TWI_RETRY_ENABLE in twi.h
   Serial1.begin(9600);
 }
 
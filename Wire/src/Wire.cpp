@@ -43,16 +43,74 @@ extern "C" {    // compiler was complaining when I put twi.h into the upper C in
 
 
 // Initialize Class Variables // /// /// /// /// /// /// /// /// /// /// /// /// /// /// /// ///
+#if defined(TWI_INSTANCE_BUFFERS)     // Wire and Wire1 have buffers of different lengths, see twi.h
+  #if defined(TWI_MERGE_BUFFERS)
+    static uint8_t wire0TrBuffer[TWI_TX_BUFFER_LENGTH];
+    static uint8_t wire1TrBuffer[TWI1_TX_BUFFER_LENGTH];
+  #else
+    static uint8_t wire0TxBuffer[TWI_TX_BUFFER_LENGTH];
+    static uint8_t wire0RxBuffer[TWI_RX_BUFFER_LENGTH];
+    static uint8_t wire1TxBuffer[TWI1_TX_BUFFER_LENGTH];
+    static uint8_t wire1RxBuffer[TWI1_RX_BUFFER_LENGTH];
+  #endif
+  #if defined(TWI_MANDS)
+    #if defined(TWI_MERGE_BUFFERS)
+      static uint8_t wire0TrBufferS[TWI_TX_BUFFER_LENGTH_S];
+      static uint8_t wire1TrBufferS[TWI1_TX_BUFFER_LENGTH_S];
+    #else
+      static uint8_t wire0TxBufferS[TWI_TX_BUFFER_LENGTH_S];
+      static uint8_t wire0RxBufferS[TWI_RX_BUFFER_LENGTH_S];
+      static uint8_t wire1TxBufferS[TWI1_TX_BUFFER_LENGTH_S];
+      static uint8_t wire1RxBufferS[TWI1_RX_BUFFER_LENGTH_S];
+    #endif
+  #endif
+#endif
+
 // Constructors   // /// /// /// /// /// /// /// /// /// /// /// /// /// /// /// /// /// /// ///
 /**
  *@brief      TwoWire creates a Wire object
  *
+ *            With TWI_INSTANCE_BUFFERS, the object on TWI1 gets the buffers of Wire1, every
+ *            other one the buffers of Wire.
+ *
  *@param      TWI_t *module - the pointer to the TWI module that the Wire object is supposed to use
  *
  *@return     constructor can't return anything
  */
 TwoWire::TwoWire(TWI_t *twi_module) {
   vars._module = twi_module;
+  #if defined(TWI_INSTANCE_BUFFERS)             // The object on TWI1 is Wire1, it gets the TWI1_ lengths
+    bool wire1 = (&TWI1 == twi_module);
+    #if defined(TWI_MERGE_BUFFERS)
+      vars._trBuffer  = wire1 ? wire1TrBuffer  : wire0TrBuffer;
+    #else
+      vars._txBuffer  = wire1 ? wire1TxBuffer  : wire0TxBuffer;
+      vars._rxBuffer  = wire1 ? wire1RxBuffer  : wire0RxBuffer;
+    #endif
+    #if defined(TWI_MANDS)
+      #if defined(TWI_MERGE_BUFFERS)
+        vars._trBufferS = wire1 ? wire1TrBufferS : wire0TrBufferS;
+      #else
+        vars._txBufferS = wire1 ? wire1TxBufferS : wire0TxBufferS;
+        vars._rxBufferS = wire1 ? wire1RxBufferS : wire0RxBufferS;
+      #endif
+    #endif
+    #if (TWI1_TX_BUFFER_LENGTH != TWI_TX_BUFFER_LENGTH)
+      vars._txLength  = wire1 ? TWI1_TX_BUFFER_LENGTH   : TWI_TX_BUFFER_LENGTH;
+    #endif
+    #if (TWI1_RX_BUFFER_LENGTH != TWI_RX_BUFFER_LENGTH)
+      vars._rxLength  = wire1 ? TWI1_RX_BUFFER_LENGTH   : TWI_RX_BUFFER_LENGTH;
+    #endif
+    #if defined(TWI_MANDS) && (TWI1_TX_BUFFER_LENGTH_S != TWI_TX_BUFFER_LENGTH_S)
+      vars._txLengthS = wire1 ? TWI1_TX_BUFFER_LENGTH_S : TWI_TX_BUFFER_LENGTH_S;
+    #endif
+    #if defined(TWI_MANDS) && (TWI1_RX_BUFFER_LENGTH_S != TWI_RX_BUFFER_LENGTH_S)
+      vars._rxLengthS = wire1 ? TWI1_RX_BUFFER_LENGTH_S : TWI_RX_BUFFER_LENGTH_S;
+    #endif
+  #endif
+  #if defined(TWI_TIMEOUT_SETTINGS)
+    vars._timeout = TWI_TIMEOUT_DEFAULT;
+  #endif
   // vars.user_onRequest = NULL;  // Make sure to initialize this pointers
   // vars.user_onReceive = NULL;  // This avoids weird jumps should something unexpected happen
 }
@@ -189,22 +247,175 @@ void TwoWire::begin(uint8_t address, bool receive_broadcast, uint8_t second_addr
     badArg("Supplied address seems to be 8 bit. Only 7 bit addresses are supported");
     return;
   }
+  #if defined(TWI_10BIT_ADDRESS)
+    vars._slaveTenBit = TWI_TENBIT_OFF;
+  #endif
   TWI_SlaveInit(&vars, address, receive_broadcast, second_address);
 }
 
 
+#if defined(TWI_10BIT_ADDRESS)
+/**
+ *@brief      begin10 initializes the client with a 10-bit address
+ *
+ *            Works only if the TWI is disabled. The hardware matches the first address byte,
+ *            11110 followed by the two high bits, the second byte with the low bits is checked in the
+ *            interrupt. A host read is only acknowledged after a write with the full address selected
+ *            this client, as the standard asks for.
+ *            The onReceive and onRequest handlers work as with 7-bit addresses.
+ *
+ *@param      uint16_t address - the 10-bit address of the client, 0x000 - 0x3FF
+ *
+ *@return     void
+ */
+void TwoWire::begin10(uint16_t address) {
+  vars._slaveAddressLow = (uint8_t)address;
+  vars._slaveTenBit     = TWI_TENBIT_IDLE;
+  TWI_SlaveInit(&vars, 0x78 | ((address >> 8) & 0x03), 0, 0);
+}
+#endif
+
+
+#if defined(TWI_GET_CLOCK)
+/**
+ *@brief      getClock returns the SCL frequency the host actually runs at
+ *
+ *            setClock() rounds to the next slower frequency the baud register can do, this
+ *            is it, including the rise time that was passed to setClock().
+ *
+ *@param      void
+ *
+ *@return     uint32_t
+ *@retval     the frequency in Hertz, 0 if the host is not enabled
+ */
+uint32_t TwoWire::getClock(void) {
+  return TWI_MasterGetClock(&vars);
+}
+#endif
+
+
+#if defined(TWI_TIMEOUT_SETTINGS)
+/**
+ *@brief      setWireTimeout sets the time a host transaction may go without progress on the bus
+ *
+ *            The timeout is restarted with every transferred byte. When it runs out, the
+ *            transaction is abandoned and the timeout flag is set. Can be used before or after
+ *            begin(). Needs TWI_TIMEOUT_SETTINGS, otherwise the timeout is TWI_TIMEOUT_DEFAULT.
+ *
+ *@param      uint32_t timeout - in microseconds, 0 disables the timeout
+ *            bool reset_with_timeout - if true, the host is reset after a timeout, which
+ *              releases the bus
+ *
+ *@return     void
+ */
+void TwoWire::setWireTimeout(uint32_t timeout, bool reset_with_timeout) {
+  TWI_MasterSetTimeout(&vars, timeout, reset_with_timeout);
+}
+#endif
+
+
+/**
+ *@brief      getWireTimeoutFlag returns if a host transaction timed out since the flag was cleared
+ *
+ *@param      void
+ *
+ *@return     bool
+ *@retval     true if a timeout occurred
+ */
+bool TwoWire::getWireTimeoutFlag(void) {
+  return vars._bools._timeoutFlag;
+}
+
+
+/**
+ *@brief      clearWireTimeoutFlag clears the flag that is returned by getWireTimeoutFlag
+ *
+ *@param      void
+ *
+ *@return     void
+ */
+void TwoWire::clearWireTimeoutFlag(void) {
+  vars._bools._timeoutFlag = 0;
+}
+
+
+/**
+ *@brief      recoverBus frees a bus that is held low by a client, e.g. after a brownout
+ *
+ *            SCL is clocked on the host pins until the client releases SDA, at most 9 times,
+ *            then a STOP is generated and the host is initialized again, keeping its settings.
+ *            Only works when the host is enabled.
+ *
+ *@param      void
+ *
+ *@return     bool
+ *@retval     true if the bus is free afterwards
+ */
+bool TwoWire::recoverBus(void) {
+  return TWI_MasterRecoverBus(&vars);
+}
+
+
+#if defined(TWI_TIMEOUT_SETTINGS)
 /**
- *@brief      setClock sets the baud register to get the desired frequency
+ *@brief      setBusRecovery enables the automatic recovery of the bus
  *
- *            Has only an effect when used after begin(void)
+ *            After the given number of host transactions in a row timed out, recoverBus() is
+ *            called. A transferred byte starts the count over. Needs the timeout, see
+ *            setWireTimeout(). Needs TWI_TIMEOUT_SETTINGS.
  *
- *@param      uint32_t clock - the desired clock in Hertz
+ *@param      uint8_t timeouts - consecutive timeouts until the recovery, 0 disables it
  *
  *@return     void
  */
-void TwoWire::setClock(uint32_t clock) {
-  TWI_MasterSetBaud(&vars, clock);
+void TwoWire::setBusRecovery(uint8_t timeouts) {
+  vars._recoverAfter = timeouts;
+  vars._failures     = 0;
 }
+#endif
+
+
+#if defined(TWI_RETRY_ENABLE)
+/**
+ *@brief      setRetry makes endTransmission() and requestFrom() try again on the selected errors
+ *
+ *            The bytes of the transmit buffer are sent again as they are, there is no need to
+ *            call beginTransmission() and write() again. Only available with TWI_RETRY_ENABLE
+ *            defined in twi.h.
+ *
+ *@param      uint8_t attempts - maximum number of attempts, 0 or 1 disables retries
+ *            uint16_t backoff - wait in microseconds before the first retry, doubled for every
+ *              further one. The bus is released while waiting.
+ *            uint8_t errors - TWI_RETRY_ARBLOST (arbitration lost or bus error), TWI_RETRY_NACK
+ *              (address not acknowledged) and/or TWI_RETRY_TIMEOUT, OR-ed together
+ *
+ *@return     void
+ */
+void TwoWire::setRetry(uint8_t attempts, uint16_t backoff, uint8_t errors) {
+  TWI_MasterSetRetry(&vars, attempts, backoff, errors);
+}
+#endif
+
+
+#if defined(TWI_SMBUS_PEC)
+/**
+ *@brief      setPEC enables the SMBus Packet Error Checking (CRC-8) for the host and/or the client
+ *
+ *            Host: endTransmission() appends the PEC if it sends a STOP, requestFrom() reads it
+ *            after the requested bytes and returns 0 if it does not match. endTransmission(false)
+ *            followed by requestFrom() is checked as one transaction, like an SMBus read word.
+ *            Client: onReceive is only called if the last byte of the host write was the correct
+ *            PEC, that byte is not in the buffer. After the bytes written in onRequest, the PEC is sent.
+ *            Only available with TWI_SMBUS_PEC defined in twi.h.
+ *
+ *@param      uint8_t modes - TWI_PEC_HOST and/or TWI_PEC_CLIENT, 0 disables it
+ *
+ *@return     void
+ */
+void TwoWire::setPEC(uint8_t modes) {
+  TWI_SetPEC(&vars, modes);
+}
+#endif
 
 
 /**
@@ -251,8 +462,8 @@ void TwoWire::endSlave(void) {
 /**
  *@brief      requestFrom sends a host READ with the specified client address
  *
- *            When a greater quantity then the BUFFER_LENGTH is passed, the quantity gets
- *            limited to the BUFFER_LENGTH.
+ *            When a greater quantity then the TWI_RX_BUFFER_LENGTH is passed, the quantity gets
+ *            limited to the TWI_RX_BUFFER_LENGTH.
  *            Received Bytes must be read with read().
  *
  *@param      int/uint8_t address - the address of the client
@@ -278,14 +489,54 @@ uint8_t TwoWire::requestFrom(int16_t  address,  int16_t  quantity)
          return requestFrom((uint8_t) address, (uint8_t) quantity, (uint8_t) 1);
 }
 uint8_t TwoWire::requestFrom(uint8_t  address,  uint8_t  quantity,  uint8_t sendStop) {
-  if (quantity > BUFFER_LENGTH) {
-    quantity = BUFFER_LENGTH;
-  }
+  #if (TWI_RX_BUFFER_LENGTH < 255) || (defined(TWI_INSTANCE_BUFFERS) && (TWI1_RX_BUFFER_LENGTH < 255))
+    if (quantity > TWI_RX_LENGTH(&vars)) {      // with 255, a uint8_t can't be more
+      quantity = TWI_RX_LENGTH(&vars);
+    }
+  #endif
+  #if defined(TWI_MASTER_ASYNC)
+    if (TWI_MasterAsyncWait(&vars) != TWI_NO_ERR) {  // Wait for the host engine to finish
+      return 0;
+    }
+  #endif
   vars._clientAddress = address << 1;
   return TWI_MasterRead(&vars, quantity, sendStop);
 }
 
 
+#if defined(TWI_10BIT_ADDRESS)
+/**
+ *@brief      requestFrom10 sends a host READ to a client with a 10-bit address
+ *
+ *            Both address bytes are written first, then the read follows with a REP START and
+ *            the first byte alone. Directly after endTransmission(false) to the same client,
+ *            only the REP START is sent.
+ *
+ *@param      uint16_t address - the 10-bit address of the client, 0x000 - 0x3FF
+ *            uint8_t quantity - the amount of bytes that are expected to be received
+ *            uint8_t sendStop - if the transaction should be terminated with a STOP condition
+ *
+ *@return     uint8_t
+ *@retval     amount of bytes that were actually read. If 0, no read took place due to a bus error.
+ */
+uint8_t TwoWire::requestFrom10(uint16_t address, uint8_t quantity, uint8_t sendStop) {
+  #if (TWI_RX_BUFFER_LENGTH < 255) || (defined(TWI_INSTANCE_BUFFERS) && (TWI1_RX_BUFFER_LENGTH < 255))
+    if (quantity > TWI_RX_LENGTH(&vars)) {      // with 255, a uint8_t can't be more
+      quantity = TWI_RX_LENGTH(&vars);
+    }
+  #endif
+  #if defined(TWI_MASTER_ASYNC)
+    if (TWI_MasterAsyncWait(&vars) != TWI_NO_ERR) {  // Wait for the host engine to finish
+      return 0;
+    }
+  #endif
+  vars._clientAddress    = (0x78 | ((address >> 8) & 0x03)) << 1;
+  vars._clientAddressLow = (uint8_t)address;
+  return TWI_MasterRead(&vars, quantity, sendStop);
+}
+#endif
+
+
 /**
  *@brief      beginTransmission prepares the Wire object for a host WRITE.
  *
@@ -310,10 +561,32 @@ void TwoWire::beginTransmission(uint8_t address) {
     badArg("Supplied address seems to be 8 bit. Only 7-bit-addresses are supported");
     return;
   }
+  #if defined(TWI_MASTER_ASYNC)
+    TWI_MasterAsyncWait(&vars);                   // The host engine might still be using the buffer, aborted after the timeout
+  #endif
   // set address of targeted client
   vars._clientAddress = address << 1;
-  (*txTail) = (*txHead);  // reset transmitBuffer
+  (*txHead) = 0;          // reset transmitBuffer, starting at 0 keeps the data in one piece
+  (*txTail) = 0;
+}
+
+
+#if defined(TWI_10BIT_ADDRESS)
+/**
+ *@brief      beginTransmission10 prepares the Wire object for a host WRITE to a 10-bit address
+ *
+ *            endTransmission() sends the second address byte before the data. It is not
+ *            counted in the return value.
+ *
+ *@param      uint16_t address - the 10-bit address of the client, 0x000 - 0x3FF
+ *
+ *@return     void
+ */
+void TwoWire::beginTransmission10(uint16_t address) {
+  beginTransmission((uint8_t)(0x78 | ((address >> 8) & 0x03)));
+  vars._clientAddressLow = (uint8_t)address;
 }
+#endif
 
 
 /**
@@ -336,12 +609,297 @@ void TwoWire::beginTransmission(uint8_t address) {
  *              an error might have occurred.
  */
 uint8_t TwoWire::endTransmission(bool sendStop) {
+  #if defined(TWI_MASTER_ASYNC)
+    if (TWI_MasterAsyncWait(&vars) != TWI_NO_ERR) {  // Wait for the host engine to finish the queue
+      return 0;
+    }
+  #endif
   // transmit (blocking)
   return TWI_MasterWrite(&vars, sendStop);
 }
 
 
 
+/**
+ *@brief      writeRead performs a (blocking) host WRITE followed by a REP START and a host READ
+ *
+ *            This is the common register read: beginTransmission(address), write(register), then
+ *            writeRead() sends the register address and reads the quantity of bytes without a STOP
+ *            in between. The received bytes can be read with read().
+ *            When a greater quantity then TWI_RX_BUFFER_LENGTH - 1 is passed, the quantity gets limited.
+ *
+ *@param      uint8_t quantity - the amount of bytes that are expected to be received
+ *            uint8_t sendStop - if the transaction should be terminated with a STOP condition
+ *
+ *@return     uint16_t
+ *@retval     amount of bytes that were actually read. If 0, no read took place due to a bus error
+ *              or because the client did not acknowledge the write.
+ */
+uint16_t TwoWire::writeRead(uint8_t quantity, uint8_t sendStop) {
+  return TWI_MasterWriteRead(&vars, quantity, sendStop);
+}
+
+
+/**
+ *@brief      writeTo performs a (blocking) host WRITE directly from the passed buffer
+ *
+ *            Unlike beginTransmission/write/endTransmission, the data is not copied into the
+ *            transmit buffer first, but written to the bus straight from the memory of the caller.
+ *            Thus the amount of data is not limited by the buffer length, useful for EEPROM pages
+ *            or display frame buffers. A quantity of 0 sends just the address.
+ *
+ *@param      uint8_t address - the address of the client
+ *            const uint8_t *buffer - the data to write
+ *            size_t quantity - the amount of bytes to write
+ *            bool sendStop - if the transaction should be terminated with a STOP condition
+ *
+ *@return     size_t
+ *@retval     amount of bytes that were actually written. If it differs from quantity, an error occurred.
+ */
+size_t TwoWire::writeTo(uint8_t address, const uint8_t *buffer, size_t quantity, bool sendStop) {
+  struct twiTransaction xfer;
+  memset(&xfer, 0, sizeof(xfer));               // no stale fields from the stack reach the host engine
+  xfer.address  = address << 1;
+  xfer.txBuffer = buffer;
+  xfer.txLength = quantity;
+  xfer.rxLength = 0;
+  xfer.flags    = sendStop ? TWI_XFER_STOP : 0;
+  TWI_MasterTransfer(&vars, &xfer);
+  return xfer.txCount;
+}
+
+
+/**
+ *@brief      readFrom performs a (blocking) host READ directly into the passed buffer
+ *
+ *            Unlike requestFrom/read, the received bytes are not stored in the receive buffer
+ *            but land in the memory of the caller. Thus the amount of data is not limited by
+ *            the buffer length and there is no need to call read() for every byte.
+ *            The last byte is NACKed.
+ *
+ *@param      uint8_t address - the address of the client
+ *            uint8_t *buffer - where to put the received data
+ *            size_t quantity - the amount of bytes to read
+ *            bool sendStop - if the transaction should be terminated with a STOP condition
+ *
+ *@return     size_t
+ *@retval     amount of bytes that were actually read. If 0, no read took place due to a bus error.
+ */
+size_t TwoWire::readFrom(uint8_t address, uint8_t *buffer, size_t quantity, bool sendStop) {
+  struct twiTransaction xfer;
+  if (quantity == 0) {
+    return 0;                                     // A read without data is not possible
+  }
+  memset(&xfer, 0, sizeof(xfer));               // no stale fields from the stack reach the host engine
+  xfer.address  = address << 1;
+  xfer.rxBuffer = buffer;
+  xfer.rxLength = quantity;
+  xfer.txLength = 0;
+  xfer.flags    = sendStop ? TWI_XFER_STOP : 0;
+  TWI_MasterTransfer(&vars, &xfer);
+  return xfer.rxCount;
+}
+
+
+/**
+ *@brief      scan looks for clients on the bus
+ *
+ *            Only the address of every client from first to last is sent, in write direction and
+ *            one after another with a REP START. The result is a bitmap of 128 bits: the client
+ *            with the address a is present if (map[a >> 3] & (1 << (a & 7))) is not zero.
+ *            The scan stops at the first bus error or stuck bus, see TWI_MasterScan.
+ *            Addresses below 0x08 and above 0x77 are reserved and not probed by default.
+ *
+ *@param      uint8_t *map - 16 bytes for the result
+ *            uint8_t first - the first address to probe
+ *            uint8_t last - the last address to probe
+ *
+ *@return     uint8_t
+ *@retval     0 if all addresses were probed, otherwise the error that stopped the scan
+ */
+uint8_t TwoWire::scan(uint8_t *map, uint8_t first, uint8_t last) {
+  return TWI_MasterScan(&vars, map, first, last);
+}
+
+
+#if defined(TWI_SMBUS_BLOCK)
+/**
+ *@brief      blockWrite performs an SMBus block write
+ *
+ *            The command, the length and the bytes are sent in one host WRITE, followed by the PEC
+ *            if setPEC(TWI_PEC_HOST) was called. The transmit buffer is used, so the block has to
+ *            fit into it together with the command and the length.
+ *
+ *@param      uint8_t address - the address of the client
+ *            uint8_t command - the SMBus command code
+ *            const uint8_t *buffer - the data of the block
+ *            uint8_t length - the amount of bytes in the block
+ *
+ *@return     uint8_t
+ *@retval     amount of bytes of the block that were acknowledged, 0 if it didn't fit the transmit buffer
+ */
+uint8_t TwoWire::blockWrite(uint8_t address, uint8_t command, const uint8_t *buffer, uint8_t length) {
+  if (!beginBlock(address, command, buffer, length)) {
+    return 0;
+  }
+  uint8_t written = endTransmission(true);
+  return (written > 2) ? (written - 2) : 0;      // without the command and the length
+}
+
+
+/**
+ *@brief      blockRead performs an SMBus block read
+ *
+ *            The command is written, then a REP START reads the length from the client and
+ *            exactly that many bytes. They can be read with read(), the length is not stored.
+ *            A block that doesn't fit the receive buffer is cut off.
+ *
+ *@param      uint8_t address - the address of the client
+ *            uint8_t command - the SMBus command code
+ *
+ *@return     uint8_t
+ *@retval     amount of bytes that were received. 0 if the client did not answer, or with
+ *              setPEC(TWI_PEC_HOST), if the PEC did not match.
+ */
+uint8_t TwoWire::blockRead(uint8_t address, uint8_t command) {
+  beginTransmission(address);
+  write(command);
+  if (endTransmission(false) != 1) {
+    return 0;                                     // NACKed, the STOP was sent
+  }
+  return TWI_MasterReadBlock(&vars, TWI_RX_LENGTH(&vars) - 1);
+}
+
+
+/**
+ *@brief      blockProcessCall performs an SMBus block write-block read process call
+ *
+ *            Like blockWrite, but without a STOP. The answer of the client is read with a
+ *            REP START like in blockRead, the PEC covers both.
+ *
+ *@param      uint8_t address - the address of the client
+ *            uint8_t command - the SMBus command code
+ *            const uint8_t *buffer - the data of the block that is written
+ *            uint8_t length - the amount of bytes in that block
+ *
+ *@return     uint8_t
+ *@retval     amount of bytes that were received, see blockRead
+ */
+uint8_t TwoWire::blockProcessCall(uint8_t address, uint8_t command, const uint8_t *buffer, uint8_t length) {
+  if (!beginBlock(address, command, buffer, length)) {
+    return 0;
+  }
+  if (endTransmission(false) != (length + 2)) {
+    return 0;
+  }
+  return TWI_MasterReadBlock(&vars, TWI_RX_LENGTH(&vars) - 1);
+}
+
+
+/**
+ *@brief      beginBlock fills the transmit buffer with the command, the length and the block
+ *
+ *@return     bool
+ *@retval     false if it didn't fit, the transmit buffer is empty then
+ */
+bool TwoWire::beginBlock(uint8_t address, uint8_t command, const uint8_t *buffer, uint8_t length) {
+  beginTransmission(address);
+  if ((write(command) == 1) && (write(length) == 1) && (write(buffer, length) == length)) {
+    return true;
+  }
+  beginTransmission(address);                     // don't send a block with the wrong length
+  return false;
+}
+#endif
+
+
+#if defined(TWI_MASTER_ASYNC)
+/**
+ *@brief      endTransmissionAsync starts the host WRITE and returns without waiting for it
+ *
+ *            Works like endTransmission, but the transmission is handled by the TWIM interrupt.
+ *            Use masterBusy() or onMasterComplete() to find out when it has finished. If there are
+ *            transactions in the queue, it is started after them.
+ *            Don't call beginTransmission() or write() before, as they would change the data
+ *            that is being transmitted. (beginTransmission() waits for the transmission to finish)
+ *
+ *@param      bool sendStop - if the transaction should be terminated with a STOP condition
+ *
+ *@return     uint8_t
+ *@retval     0 if the transmission was started, TWI_ERR_BUSY if a transaction is still running
+ */
+uint8_t TwoWire::endTransmissionAsync(bool sendStop) {
+  return TWI_MasterWriteAsync(&vars, sendStop);
+}
+
+
+/**
+ *@brief      requestFromAsync starts a host READ and returns without waiting for it
+ *
+ *            Works like requestFrom, but the reception is handled by the TWIM interrupt.
+ *            The quantity is limited to TWI_RX_BUFFER_LENGTH - 1. The received bytes can be read
+ *            with read() once masterBusy() returns false or onMasterComplete() was called.
+ *
+ *@param      uint8_t address - the address of the client
+ *            uint8_t quantity - the amount of bytes that are expected to be received
+ *            uint8_t sendStop - if the transaction should be terminated with a STOP condition
+ *
+ *@return     uint8_t
+ *@retval     0 if the reception was started, TWI_ERR_BUSY if a transaction is still running
+ */
+uint8_t TwoWire::requestFromAsync(uint8_t address, uint8_t quantity, uint8_t sendStop) {
+  if (TWI_MasterAsyncBusy(&vars)) {
+    return TWI_ERR_BUSY;                          // Don't touch the address of the running transaction
+  }
+  vars._clientAddress = address << 1;
+  return TWI_MasterReadAsync(&vars, quantity, sendStop);
+}
+
+
+/**
+ *@brief      masterBusy returns if a transaction started with a ...Async function or enqueue is still running
+ *
+ *@param      void
+ *
+ *@return     bool
+ *@retval     true if the host is still busy
+ */
+bool TwoWire::masterBusy(void) {
+  return TWI_MasterAsyncBusy(&vars);
+}
+
+
+/**
+ *@brief      masterStatus returns the result of the last transaction started with a ...Async function
+ *
+ *@param      void
+ *
+ *@return     uint8_t
+ *@retval     TWI_NO_ERR (0) on success, otherwise one of the TWI_ERR_xxx codes
+ */
+uint8_t TwoWire::masterStatus(void) {
+  return vars._hostXfer.status;
+}
+
+
+/**
+ *@brief      enqueue adds a transaction to the queue of the host engine
+ *
+ *            The transactions are processed one after another from the interrupt, without
+ *            waiting for the loop in between. This way, a whole sensor sweep can be posted at once.
+ *            The blocking functions (endTransmission, requestFrom) wait for the queue to be empty.
+ *
+ *@param      struct twiTransaction *transaction - e.g. a WireTransaction
+ *
+ *@return     uint8_t
+ *@retval     0 if the transaction was queued, TWI_ERR_BUSY if it is still queued
+ */
+uint8_t TwoWire::enqueue(struct twiTransaction *transaction) {
+  return TWI_MasterEnqueue(&vars, transaction);
+}
+#endif
+
+
 /**
  *@brief      write fills the transmit buffers, host or client depending on when it is called
  *
@@ -359,6 +917,7 @@ size_t TwoWire::write(uint8_t data) {
   uint8_t* txHead;
   uint8_t* txTail;
   uint8_t* txBuffer;
+  uint8_t  txLength;
 
   #if defined(TWI_MANDS)                   // Add following if host and client are split
     if (vars._bools._toggleStreamFn == 0x01) {
@@ -371,6 +930,7 @@ size_t TwoWire::write(uint8_t data) {
         txTail   = &(vars._txTailS);
         txBuffer =   vars._txBufferS;
       #endif
+      txLength =   TWI_TX_LENGTH_S(&vars);
     } else
   #endif
   {
@@ -383,12 +943,13 @@ size_t TwoWire::write(uint8_t data) {
       txTail   = &(vars._txTail);
       txBuffer =   vars._txBuffer;
     #endif
+    txLength   =   TWI_TX_LENGTH(&vars);
   }
 
   /* Put byte in txBuffer */
-  nextHead = TWI_advancePosition(*txHead);
+  nextHead = TWI_advancePosition(*txHead, txLength);
 
-  if (nextHead == (*txTail)) {
+  if (TWI_bufferFull(nextHead, (*txTail), txLength)) {
     return 0;                             // Buffer full, stop accepting data
   }
   txBuffer[(*txHead)] = data;             // Load data into the buffer
@@ -401,21 +962,91 @@ size_t TwoWire::write(uint8_t data) {
 /**
  *@brief      write for arrays
  *
- *            calls the write function in a for-loop
+ *            Copies the data into the host or client transmit buffer, the same way write(uint8_t)
+ *            does it, but the buffer is selected only once and the data is copied in (at most two)
+ *            contiguous blocks up to the end of the ring and from its start.
+ *            If the buffer gets full, the rest of the data is dropped.
  *
  *@param      uint8_t *data - pointer to the array
  *            size_t quantity - amount of bytes to copy
  *
  *
- *@return     uint8_t
- *@retval     amount of bytes copied
+ *@return     size_t
+ *@retval     amount of bytes that were actually copied into the buffer
  */
 size_t TwoWire::write(const uint8_t *data, size_t quantity) {
-  for (size_t i = 0; i < quantity; i++) {
-    write(*(data + i));
+  uint8_t* txHead;
+  uint8_t* txTail;
+  uint8_t* txBuffer;
+  uint8_t  txLength;
+
+  #if defined(TWI_MANDS)                   // Add following if host and client are split
+    if (vars._bools._toggleStreamFn == 0x01) {
+      #if defined(TWI_MERGE_BUFFERS)       // Same Buffers for tx/rx
+        txHead   = &(vars._trHeadS);
+        txTail   = &(vars._trTailS);
+        txBuffer =   vars._trBufferS;
+      #else                                // Separate tx/rx Buffers
+        txHead   = &(vars._txHeadS);
+        txTail   = &(vars._txTailS);
+        txBuffer =   vars._txBufferS;
+      #endif
+      txLength =   TWI_TX_LENGTH_S(&vars);
+    } else
+  #endif
+  {
+    #if defined(TWI_MERGE_BUFFERS)         // Same Buffers for tx/rx
+      txHead   = &(vars._trHead);
+      txTail   = &(vars._trTail);
+      txBuffer =   vars._trBuffer;
+    #else                                  // Separate tx/rx Buffers
+      txHead   = &(vars._txHead);
+      txTail   = &(vars._txTail);
+      txBuffer =   vars._txBuffer;
+    #endif
+    txLength   =   TWI_TX_LENGTH(&vars);
+  }
+
+  uint8_t head = (*txHead);
+  uint8_t tail = (*txTail);
+  size_t  written = 0;
+
+  #if defined(TWI_LINEAR_BUFFERS)
+    (void)tail;
+    written = txLength - head;              // up to the end of the buffer, there is no wrap-around
+    if (written > quantity) {
+      written = quantity;
+    }
+    memcpy(&txBuffer[head], data, written);
+    head += written;
+  #else
+  while (written < quantity) {
+    uint8_t space;
+    if (head < tail) {
+      space = tail - head - 1;              // up to the byte before the tail
+    } else {
+      space = txLength - head;              // up to the end of the buffer
+      if (tail == 0) {
+        space--;                            // one byte has to stay free, a full buffer would look empty
+      }
+    }
+    if (space == 0) {
+      break;                                // Buffer full, stop accepting data
+    }
+    if (space > (quantity - written)) {
+      space = (quantity - written);
+    }
+    memcpy(&txBuffer[head], data + written, space);
+    written += space;
+    head    += space;
+    if (head >= txLength) {
+      head = 0;                             // round-robin-ing
+    }
   }
+  #endif
+  (*txHead) = head;
 
-  return quantity;
+  return written;
 }
 
 
@@ -454,6 +1085,7 @@ int TwoWire::read(void) {
   uint8_t* rxHead;
   uint8_t* rxTail;
   uint8_t* rxBuffer;
+  uint8_t  rxLength;
 
   #if defined(TWI_MANDS)                         // Add following if host and client are split
     if (vars._bools._toggleStreamFn == 0x01) {
@@ -466,6 +1098,7 @@ int TwoWire::read(void) {
         rxTail   = &(vars._rxTailS);
         rxBuffer =   vars._rxBufferS;
       #endif
+      rxLength =   TWI_RX_LENGTH_S(&vars);
     } else
   #endif
   {
@@ -478,6 +1111,7 @@ int TwoWire::read(void) {
       rxTail   = &(vars._rxTail);
       rxBuffer =   vars._rxBuffer;
     #endif
+    rxLength   =   TWI_RX_LENGTH(&vars);
   }
 
 
@@ -485,7 +1119,7 @@ int TwoWire::read(void) {
     return -1;                    // we don't have any characters
   } else {
     uint8_t c = rxBuffer[(*rxTail)];
-    (*rxTail) = TWI_advancePosition(*rxTail);
+    (*rxTail) = TWI_advancePosition(*rxTail, rxLength);
     return c;
   }
 }
@@ -549,16 +1183,16 @@ int TwoWire::peek(void) {
  */
 void TwoWire::flush(void) {
   #if defined(TWI_MERGE_BUFFERS)               // merged tx/rx Buffers
-    vars._trTail = vars._trHead;
+    TWI_resetBuffer(&vars._trHead, &vars._trTail);
     #if defined(TWI_MANDS)
-      vars._trTailS = vars._trHeadS;
+      TWI_resetBuffer(&vars._trHeadS, &vars._trTailS);
     #endif
   #else
-    vars._rxTail = vars._rxHead;
-    vars._txTail = vars._txHead;
+    TWI_resetBuffer(&vars._rxHead, &vars._rxTail);
+    TWI_resetBuffer(&vars._txHead, &vars._txTail);
     #if defined(TWI_MANDS)
-      vars._rxTailS = vars._rxHeadS;
-      vars._txTailS = vars._txHeadS;
+      TWI_resetBuffer(&vars._rxHeadS, &vars._rxTailS);
+      TWI_resetBuffer(&vars._txHeadS, &vars._txTailS);
     #endif
   #endif
 
@@ -644,6 +1278,35 @@ void TwoWire::onSlaveIRQ(TWI_t *module) {          // This function is static an
 
 
 
+#if defined(TWI_MASTER_ASYNC)
+/**
+ *@brief      onMasterIRQ is called by the host interrupts and calls the host state machine
+ *
+ *            Works the same way as onSlaveIRQ, see there.
+ *
+ *@param      TWI_t *module - the pointer to the TWI module
+ *
+ *@return     void
+ */
+void TwoWire::onMasterIRQ(TWI_t *module) {
+  #if defined(TWI1)
+    #if defined(USING_WIRE1)
+      if (module == &TWI0) {
+        TWI_HandleMasterIRQ(&(Wire.vars));
+      } else if (module == &TWI1) {
+        TWI_HandleMasterIRQ(&(Wire1.vars));
+      }
+    #else
+      TWI_HandleMasterIRQ(&(Wire.vars));
+    #endif
+  #else
+    TWI_HandleMasterIRQ(&(Wire.vars));
+  #endif
+  (void)module;
+}
+#endif
+
+
 /**
  *@brief      onReceive saves the pointer to the desired function to call on host WRITE / client READ.
  *
@@ -692,6 +1355,132 @@ void TwoWire::onRequest(void (*function)(void)) {
 }
 
 
+#if defined(TWI_SLAVE_REGISTERS)
+/**
+ *@brief      setSlaveRegisters lets the client act like a register based device
+ *
+ *            The first byte the host writes selects a register, the following bytes are
+ *            written to it and the registers after it. A host read returns the registers from
+ *            the selected one on. Everything is done in the interrupt, without calling
+ *            onReceive or onRequest, so the host is not kept waiting by user code.
+ *            Only available with TWI_SLAVE_REGISTERS defined in twi.h.
+ *
+ *@param      uint8_t *regs - the registers, NULL switches back to onReceive and onRequest.
+ *              They are changed in an interrupt, so read them with interrupts disabled
+ *              when more than one byte has to be consistent.
+ *            uint8_t size - number of registers
+ *            const uint8_t *protect - one byte per register, the host can't change the bits
+ *              set in it. NULL if every register is writable
+ *
+ *@return     void
+ */
+void TwoWire::setSlaveRegisters(uint8_t *regs, uint8_t size, const uint8_t *protect) {
+  TWI_SlaveSetRegisters(&vars, regs, size, protect);
+}
+#endif
+
+
+#if defined(TWI_SLAVE_RESPONSE)
+/**
+ *@brief      setSlaveResponse sets what the client sends when the host reads
+ *
+ *            The bytes are sent directly from the buffer instead of being copied with write(),
+ *            so the response can be longer than BUFFER_LENGTH, e.g. a 512 byte page. Every
+ *            host read starts at the beginning of the buffer. Can be called once in setup()
+ *            or in the onRequest function to send something else every time. With TWI_MANDS,
+ *            TWI_TX_BUFFER_LENGTH_S can be reduced to 2 when the client doesn't use write().
+ *            Only available with TWI_SLAVE_RESPONSE defined in twi.h.
+ *
+ *@param      const uint8_t *buffer - the response, it is read in the interrupt, so it has to
+ *              stay valid. NULL switches back to the bytes written with write()
+ *            size_t length - number of bytes, the host gets 0xFF if it reads more
+ *
+ *@return     void
+ */
+void TwoWire::setSlaveResponse(const uint8_t *buffer, size_t length) {
+  TWI_SlaveSetResponse(&vars, buffer, length);
+}
+#endif
+
+
+#if defined(TWI_SLAVE_ARMED)
+/**
+ *@brief      armSlaveResponse prepares what the client sends on the next host read
+ *
+ *            The bytes are copied, so the buffer can be reused right away. When the host
+ *            reads, the client acknowledges immediately, without calling onRequest, so SCL
+ *            isn't stretched by user code. This is needed for hosts that don't support clock
+ *            stretching. Can be called at any time, a read that is going on is not affected.
+ *            The same response is sent until the next call, setSlaveResponse() switches
+ *            back to onRequest. Only available with TWI_SLAVE_ARMED defined in twi.h.
+ *
+ *@param      const uint8_t *buffer - the response
+ *            uint8_t length - number of bytes, at most TWI_SLAVE_ARMED_LENGTH
+ *
+ *@return     uint8_t
+ *@retval     number of bytes that will be sent
+ */
+uint8_t TwoWire::armSlaveResponse(const uint8_t *buffer, uint8_t length) {
+  return TWI_SlaveArmResponse(&vars, buffer, length);
+}
+#endif
+
+
+#if defined(TWI_SLAVE_DEFERRED)
+/**
+ *@brief      slaveMessageAvailable returns the length of the oldest message the client received
+ *
+ *            With TWI_SLAVE_DEFERRED, the interrupt doesn't call onReceive. It stores every
+ *            message the host wrote, up to TWI_SLAVE_MESSAGES of them, and the sketch reads
+ *            them in loop() while the next one is already arriving. When all buffers are full,
+ *            the client NACKs its address until a message was read. Every START or REPSTART
+ *            begins a new message. With TWI_SLAVE_QUEUE, the messages share one buffer of
+ *            TWI_SLAVE_QUEUE_LENGTH bytes, so a burst of short ones fits.
+ *
+ *@param      void
+ *
+ *@return     uint8_t
+ *@retval     length of the message, 0 if there is none
+ */
+uint8_t TwoWire::slaveMessageAvailable(void) {
+  return TWI_SlaveMessageAvailable(&vars);
+}
+
+
+/**
+ *@brief      readSlaveMessage copies the oldest message the client received and removes it
+ *
+ *@param      uint8_t *buffer - where the message is copied to
+ *            uint8_t size - size of buffer, the rest of a longer message is lost
+ *            uint8_t *address - if not NULL, gets the address the message was sent to,
+ *              left-shifted with the write bit, like getIncomingAddress()
+ *
+ *@return     uint8_t
+ *@retval     number of bytes copied, 0 if there was no message
+ */
+uint8_t TwoWire::readSlaveMessage(uint8_t *buffer, uint8_t size, uint8_t *address) {
+  return TWI_SlaveReadMessage(&vars, buffer, size, address);
+}
+#endif
+
+
+#if defined(TWI_MASTER_ASYNC)
+/**
+ *@brief      onMasterComplete saves the pointer to the function to call when an async host transaction has finished.
+ *
+ *            remember, the specified function is called in an ISR, so keep it short.
+ *
+ *@param      void (*function)(uint8_t) - a void returning function that accepts the status
+ *              (TWI_NO_ERR or TWI_ERR_xxx) as parameter
+ *
+ *@return     void
+ */
+void TwoWire::onMasterComplete(void (*function)(uint8_t)) {
+  vars.user_onHostComplete = function;          // NULL is allowed here, it disables the notification
+}
+#endif
+
+
 #if defined(TWI_ERROR_ENABLED)
 uint8_t TwoWire::returnError() {
   return vars._errors;
@@ -717,6 +1506,26 @@ ISR(TWI0_TWIS_vect) {
 #endif
 
 
+#if defined(TWI_MASTER_ASYNC)
+/**
+ *@brief      TWI0 Master Interrupt vector
+ */
+ISR(TWI0_TWIM_vect) {
+  TwoWire::onMasterIRQ(&TWI0);
+}
+
+
+/**
+ *@brief      TWI1 Master Interrupt vector
+ */
+#if defined(TWI1)
+  ISR(TWI1_TWIM_vect) {
+    TwoWire::onMasterIRQ(&TWI1);
+  }
+#endif
+#endif
+
+
 /**
  *  Wire object constructors with the default TWI modules.
  *  If there is absolutely no way to swap the pins physically,
@@ -51,11 +51,19 @@ extern "C" {
   #define WIRE_HAS_END 1
 #endif
 
+// WIRE_HAS_TIMEOUT means Wire has setWireTimeout(), getWireTimeoutFlag() and clearWireTimeoutFlag()
+#if defined(TWI_TIMEOUT_SETTINGS) && !defined(WIRE_HAS_TIMEOUT)
+  #define WIRE_HAS_TIMEOUT 1
+#endif
+
 
 
 class TwoWire: public Stream {
  private:
   twiData vars;                 // using a struct to reduce the amount of parameters that have to be passed
+  #if defined(TWI_SMBUS_BLOCK)
+    bool beginBlock(uint8_t address, uint8_t command, const uint8_t *buffer, uint8_t length);
+  #endif
 
 
  public:
@@ -64,7 +72,32 @@ class TwoWire: public Stream {
     bool swap(uint8_t state = 1);
     bool swapModule(TWI_t *twi_module);
     void usePullups();
-    void setClock(uint32_t);
+    // riseTime in ns, per bus. With constants, MBAUD is calculated by the compiler, see TWI_baudFor()
+    void setClock(uint32_t clock, uint16_t riseTime = TWI_RISE_TIME_AUTO) {
+      if (__builtin_constant_p(clock) && __builtin_constant_p(riseTime)) {
+        TWI_MasterWriteBaud(&vars, TWI_baudFor(F_CPU, clock, TWI_riseTime(clock, riseTime)), (clock >= 600000), TWI_riseTime(clock, riseTime));
+      } else {
+        TWI_MasterSetBaud(&vars, clock, riseTime);
+      }
+    }
+    #if defined(TWI_GET_CLOCK)
+      uint32_t getClock(void);
+    #endif
+    #if defined(TWI_TIMEOUT_SETTINGS)
+      void setWireTimeout(uint32_t timeout = TWI_TIMEOUT_DEFAULT, bool reset_with_timeout = false);
+    #endif
+    bool getWireTimeoutFlag(void);
+    void clearWireTimeoutFlag(void);
+    bool recoverBus(void);
+    #if defined(TWI_TIMEOUT_SETTINGS)
+      void setBusRecovery(uint8_t timeouts);
+    #endif
+    #if defined(TWI_RETRY_ENABLE)
+      void setRetry(uint8_t attempts, uint16_t backoff, uint8_t errors = TWI_RETRY_ARBLOST);
+    #endif
+    #if defined(TWI_SMBUS_PEC)
+      void setPEC(uint8_t modes);
+    #endif
 
     void begin();
     // all attempts to make these look prettier were rejected by astyle, and it's not worth disabling linting over.
@@ -84,6 +117,9 @@ class TwoWire: public Stream {
     void begin(int      address) {
       begin((uint8_t) address, 0, 0);
     }
+    #if defined(TWI_10BIT_ADDRESS)
+      void begin10(uint16_t address);
+    #endif
 
     void end();
     void endMaster(void);
@@ -93,6 +129,9 @@ class TwoWire: public Stream {
     void beginTransmission(int     address) {
       beginTransmission((uint8_t)address);
     }
+    #if defined(TWI_10BIT_ADDRESS)
+      void beginTransmission10(uint16_t address);
+    #endif
     uint8_t endTransmission(bool);
     uint8_t endTransmission(void) {
       return endTransmission(true);
@@ -104,9 +143,37 @@ class TwoWire: public Stream {
     uint8_t requestFrom(uint8_t address, size_t  quantity);
     uint8_t requestFrom(int     address, int     quantity, int     sendStop);
     uint8_t requestFrom(int     address, int     quantity);
+    #if defined(TWI_10BIT_ADDRESS)
+      uint8_t requestFrom10(uint16_t address, uint8_t quantity, uint8_t sendStop = 1);
+    #endif
 
     uint16_t writeRead(uint8_t quantity, uint8_t sendStop);
 
+    size_t  writeTo(uint8_t address, const uint8_t *buffer, size_t quantity, bool sendStop = true);
+    size_t  readFrom(uint8_t address, uint8_t *buffer, size_t quantity, bool sendStop = true);
+    uint8_t scan(uint8_t *map, uint8_t first = 0x08, uint8_t last = 0x77);
+
+    #if defined(TWI_SMBUS_BLOCK)
+      uint8_t blockWrite(uint8_t address, uint8_t command, const uint8_t *buffer, uint8_t length);
+      uint8_t blockRead(uint8_t address, uint8_t command);
+      uint8_t blockProcessCall(uint8_t address, uint8_t command, const uint8_t *buffer, uint8_t length);
+    #endif
+
+    #if defined(TWI_MASTER_ASYNC)
+      uint8_t endTransmissionAsync(bool sendStop);
+      uint8_t endTransmissionAsync(void) {
+        return endTransmissionAsync(true);
+      }
+      uint8_t requestFromAsync(uint8_t address, uint8_t quantity, uint8_t sendStop);
+      uint8_t requestFromAsync(uint8_t address, uint8_t quantity) {
+        return requestFromAsync(address, quantity, 1);
+      }
+      bool    masterBusy(void);
+      uint8_t masterStatus(void);
+      void    onMasterComplete(void (*)(uint8_t));
+      uint8_t enqueue(struct twiTransaction *transaction);
+    #endif
+
     virtual size_t write(uint8_t);
     virtual size_t write(const uint8_t *, size_t);
     virtual int available(void);
@@ -119,6 +186,20 @@ class TwoWire: public Stream {
 
     void onReceive(void (*)(int));
     void onRequest(void (*)(void));
+    #if defined(TWI_SLAVE_REGISTERS)
+      void setSlaveRegisters(uint8_t *regs, uint8_t size, const uint8_t *protect = NULL);
+    #endif
+    #if defined(TWI_SLAVE_RESPONSE)
+      void setSlaveResponse(const uint8_t *buffer, size_t length);
+    #endif
+    #if defined(TWI_SLAVE_ARMED)
+      uint8_t armSlaveResponse(const uint8_t *buffer, uint8_t length);
+    #endif
+
+    #if defined(TWI_SLAVE_DEFERRED)
+      uint8_t slaveMessageAvailable(void);
+      uint8_t readSlaveMessage(uint8_t *buffer, uint8_t size, uint8_t *address = NULL);
+    #endif
 
     inline size_t write(unsigned long n) {
       return      write((uint8_t)     n);
@@ -142,8 +223,40 @@ class TwoWire: public Stream {
     uint8_t TWI_onRequestService(void);
 
     static void onSlaveIRQ(TWI_t *module);    // is called by the TWI interrupt routines
+    #if defined(TWI_MASTER_ASYNC)
+      static void onMasterIRQ(TWI_t *module);
+    #endif
 };
 
+#if defined(TWI_MASTER_ASYNC)
+/* A host transaction for TwoWire::enqueue(): writes txLength bytes from txBuffer, then, if
+ * rxLength is not zero, reads rxLength bytes into rxBuffer after a REP START. The buffers are
+ * accessed directly by the interrupt, so they (and the WireTransaction) must stay valid until
+ * busy() returns false. The hook is called from the interrupt after the transaction has finished,
+ * result and progress are in status, txCount and rxCount.
+ */
+class WireTransaction: public twiTransaction {
+ public:
+    WireTransaction(uint8_t client, const uint8_t *tx, size_t txLen, uint8_t *rx, size_t rxLen,
+                    bool sendStop = true, void (*hook)(struct twiTransaction *) = NULL) {
+      next       = NULL;
+      onComplete = hook;
+      txBuffer   = tx;
+      rxBuffer   = rx;
+      txLength   = txLen;
+      rxLength   = rxLen;
+      txCount    = 0;
+      rxCount    = 0;
+      address    = client << 1;
+      flags      = sendStop ? TWI_XFER_STOP : 0;
+      status     = TWI_NO_ERR;
+    }
+    bool busy(void) {
+      return (flags & TWI_XFER_QUEUED);
+    }
+};
+#endif
+
 #if defined(TWI0)
   extern TwoWire Wire;
 #endif
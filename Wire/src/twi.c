@@ -35,6 +35,96 @@ void SlaveIRQ_Stop(struct twiData *_data);
 void SlaveIRQ_DataReadNack(struct twiData *_data);
 void SlaveIRQ_DataReadAck(struct twiData *_data);
 void SlaveIRQ_DataWrite(struct twiData *_data);
+bool SlaveIRQ_StartMessage(struct twiData *_data, uint8_t address);
+bool SlaveIRQ_StoreMessageByte(struct twiData *_data, uint8_t payload);
+void SlaveIRQ_CommitMessage(struct twiData *_data);
+
+void MasterXfer_Start(TWI_t *module, struct twiTransaction *xfer);
+bool MasterXfer_Step(TWI_t *module, struct twiTransaction *xfer);
+void MasterXfer_TimedOut(struct twiData *_data);
+void MasterXfer_Abort(struct twiData *_data, uint8_t status);
+bool MasterXfer_Retry(struct twiData *_data, uint8_t error, uint8_t *attempt);
+#if defined(TWI_TIMEOUT_SETTINGS)
+  uint8_t MasterTimeoutToGc(uint32_t timeout);
+#endif
+
+
+#if defined(TWI_TIMEOUT_ENABLE)
+/* Time base of the host timeouts, the start is taken again whenever a byte was transferred.
+ * Without a timer for millis there is no micros(), then the passes through the polling loop
+ * are counted instead, assuming that each one takes about TWI_TIMEOUT_LOOP_CYCLES.
+ */
+  #if defined(MILLIS_USE_TIMERNONE)
+    #define TWI_TIMEOUT_LOOP_CYCLES   16
+
+    __attribute__((always_inline)) static inline uint32_t TWI_timeoutStart(void) {
+      return 0;
+    }
+
+    __attribute__((always_inline)) static inline bool TWI_timeoutExpired(uint32_t timeout, uint32_t *start) {
+      return (timeout != 0) && (++(*start) > ((timeout * (F_CPU / 1000000UL)) / TWI_TIMEOUT_LOOP_CYCLES));
+    }
+  #else
+    __attribute__((always_inline)) static inline uint32_t TWI_timeoutStart(void) {
+      return micros();
+    }
+
+    __attribute__((always_inline)) static inline bool TWI_timeoutExpired(uint32_t timeout, uint32_t *start) {
+      return (timeout != 0) && ((micros() - (*start)) > timeout);
+    }
+  #endif
+
+  #if defined(TWI_TIMEOUT_SETTINGS)
+    /* The timeout of setWireTimeout() */
+    __attribute__((always_inline)) static inline bool TWI_timeoutElapsed(struct twiData *_data, uint32_t *start) {
+      return TWI_timeoutExpired(_data->_timeout, start);
+    }
+
+    /* A byte was transferred: the bus works, so the count for the automatic recovery starts over */
+    __attribute__((always_inline)) static inline uint32_t TWI_timeoutProgress(struct twiData *_data) {
+      _data->_failures = 0;
+      return TWI_timeoutStart();
+    }
+  #else
+    __attribute__((always_inline)) static inline bool TWI_timeoutElapsed(struct twiData *_data, uint32_t *start) {
+      (void)_data;
+      return TWI_timeoutExpired(TWI_TIMEOUT_DEFAULT, start);
+    }
+
+    __attribute__((always_inline)) static inline uint32_t TWI_timeoutProgress(struct twiData *_data) {
+      (void)_data;
+      return TWI_timeoutStart();
+    }
+  #endif
+#else
+  __attribute__((always_inline)) static inline uint32_t TWI_timeoutStart(void) {
+    return 0;
+  }
+
+  __attribute__((always_inline)) static inline uint32_t TWI_timeoutProgress(struct twiData *_data) {
+    (void)_data;
+    return 0;
+  }
+#endif
+
+
+#if defined(TWI_SMBUS_PEC)
+/* The PEC of SMBus is a CRC-8 with the polynomial x^8 + x^2 + x + 1 (0x07), starting at 0, over
+ * every byte of the transaction including the address bytes. It is updated a nibble at a time:
+ * the table holds the CRC of every nibble shifted out, 16 bytes instead of 256 for a byte table
+ * and two lookups instead of eight shifts. A CRC that includes its own PEC byte is 0.
+ */
+static const uint8_t TWI_pecTable[16] = {
+  0x00, 0x07, 0x0E, 0x09, 0x1C, 0x1B, 0x12, 0x15, 0x38, 0x3F, 0x36, 0x31, 0x24, 0x23, 0x2A, 0x2D
+};
+
+__attribute__((always_inline)) static inline uint8_t TWI_pecUpdate(uint8_t crc, uint8_t data) {
+  crc ^= data;
+  crc  = (crc << 4) ^ TWI_pecTable[crc >> 4];
+  crc  = (crc << 4) ^ TWI_pecTable[crc >> 4];
+  return crc;
+}
+#endif
 
 
 // Function definitions
@@ -73,10 +163,17 @@ void TWI_MasterInit(struct twiData *_data) {
   #endif
 
   _data->_bools._hostEnabled  = 1;
-  _data->_module->MCTRLA        = TWI_ENABLE_bm;  // Master Interrupt flags stay disabled
+  #if defined(TWI_TIMEOUT_SETTINGS)
+    _data->_module->MCTRLA      = TWI_ENABLE_bm | _data->_busTimeout;  // Master Interrupt flags stay disabled
+  #else
+    _data->_module->MCTRLA      = TWI_ENABLE_bm;  // Master Interrupt flags stay disabled
+  #endif
+  #if defined(TWI_MASTER_SMART)
+    _data->_module->MCTRLA     |= TWI_SMEN_bm;    // Reading MDATA sends the acknowledge action
+  #endif
   _data->_module->MSTATUS       = TWI_BUSSTATE_IDLE_gc;
 
-  TWI_MasterSetBaud(_data, DEFAULT_FREQUENCY);
+  TWI_MasterSetBaud(_data, DEFAULT_FREQUENCY, TWI_RISE_TIME_AUTO);
 }
 
 
@@ -119,13 +216,32 @@ void TWI_SlaveInit(struct twiData *_data, uint8_t address, uint8_t receive_broad
     TWI0_ClearPins();
   #endif
 
+  #if defined(TWI_SLAVE_DEFERRED)
+    _data->_msgReceived = 0;                  // Start without any messages
+    _data->_msgHead     = 0;
+    _data->_msgTail     = 0;
+    _data->_msgCount    = 0;
+    #if defined(TWI_SLAVE_QUEUE)
+      _data->_msgWrite  = 0;
+    #endif
+  #endif
+
+  #if defined(TWI_SMBUS_PEC)
+    _data->_pecS     = 0;
+    _data->_pecSentS = 0;
+  #endif
+
   _data->_bools._clientEnabled = 1;
   _data->_module->SADDR       = address << 1 | receive_broadcast;
   _data->_module->SADDRMASK   = second_address;
-  _data->_module->SCTRLA      = TWI_DIEN_bm | TWI_APIEN_bm | TWI_PIEN_bm  | TWI_ENABLE_bm;
+  #if defined(TWI_SLAVE_SMART)
+    _data->_module->SCTRLA    = TWI_DIEN_bm | TWI_APIEN_bm | TWI_PIEN_bm  | TWI_SMEN_bm | TWI_ENABLE_bm;
+  #else
+    _data->_module->SCTRLA    = TWI_DIEN_bm | TWI_APIEN_bm | TWI_PIEN_bm  | TWI_ENABLE_bm;
+  #endif
 
   /* Bus Error Detection circuitry needs Master enabled to work */
-  _data->_module->MCTRLA = TWI_ENABLE_bm;
+  _data->_module->MCTRLA |= TWI_ENABLE_bm;    // keeps the settings of an already enabled host
 }
 
 
@@ -161,15 +277,22 @@ void TWI_Disable(struct twiData *_data) {
 /**
  *@brief      TWI_DisableMaster disables the TWI host
  *
+ *            Transactions of the host engine that are still running or queued are handed back
+ *            with TWI_ERR_ABORTED, so they can be started again after the next begin().
+ *
  *@param      struct twiData *_data is a pointer to the structure that holds the variables
  *              of a Wire object. Following struct elements are used in this function:
  *                _bools._hostEnabled
+ *                _hostActive
  *                _module
  *
  *@return     void
  */
 void TWI_DisableMaster(struct twiData *_data) {
   if (true == _data->_bools._hostEnabled) {
+    #if defined(TWI_MASTER_ASYNC)
+      MasterXfer_Abort(_data, TWI_ERR_ABORTED);                // Abort any running transaction
+    #endif
     if (false == _data->_bools._clientEnabled) {
       _data->_module->MCTRLA    = 0x00;  // has to stay enabled for bus error circuitry
     }
@@ -204,30 +327,166 @@ void TWI_DisableSlave(struct twiData *_data) {
 }
 
 
+#if defined(TWI_SLAVE_REGISTERS)
+/**
+ *@brief      TWI_SlaveSetRegisters makes the client serve a register file from the interrupt
+ *
+ *            The first byte of a host write sets the register pointer, the following bytes are
+ *            stored there with auto-increment. A host read streams the registers from the
+ *            pointer on. The pointer wraps around after the last register, a pointer outside
+ *            of the register file is NACKed. onReceive and onRequest are not called.
+ *
+ *@param      struct twiData *_data is a pointer to the structure that holds the variables
+ *              of a Wire object. Following struct elements are used in this function:
+ *                _regs
+ *                _regsProtect
+ *                _regsSize
+ *                _regsPointer
+ *            uint8_t *regs is the register file, NULL returns to the buffers and callbacks
+ *            uint8_t size is the number of registers
+ *            const uint8_t *protect has one byte per register, the bits set in it can't be
+ *              written by the host. NULL if all registers are writable
+ *
+ *@return     void
+ */
+void TWI_SlaveSetRegisters(struct twiData *_data, uint8_t *regs, uint8_t size, const uint8_t *protect) {
+  uint8_t oldSREG = SREG;                   // The client interrupt uses them
+  cli();
+  _data->_regs        = (size != 0) ? regs : NULL;
+  _data->_regsProtect = protect;
+  _data->_regsSize    = size;
+  _data->_regsPointer = 0;
+  SREG = oldSREG;
+}
+#endif
+
+
+#if defined(TWI_SLAVE_RESPONSE)
+/**
+ *@brief      TWI_SlaveSetResponse makes the client send the given memory on a host read
+ *
+ *            SlaveIRQ_DataReadAck reads the bytes directly from the buffer, they are not copied
+ *            to the transmit buffer, so the response is not limited by its length. Every host
+ *            read starts at the beginning of the buffer again. Can be called from onRequest.
+ *
+ *@param      struct twiData *_data is a pointer to the structure that holds the variables
+ *              of a Wire object. Following struct elements are used in this function:
+ *                _response
+ *                _responseLength
+ *                _responsePosition
+ *            const uint8_t *buffer has to stay valid as long as it is used, NULL returns to
+ *              the transmit buffer
+ *            size_t length is the number of bytes to send, the host reads 0xFF after them
+ *
+ *@return     void
+ */
+void TWI_SlaveSetResponse(struct twiData *_data, const uint8_t *buffer, size_t length) {
+  uint8_t oldSREG = SREG;                   // The client interrupt uses them
+  cli();
+  _data->_response         = buffer;
+  _data->_responseLength   = length;
+  _data->_responsePosition = 0;
+  #if defined(TWI_SLAVE_ARMED)
+    _data->_armedReady     = 0;             // Forget about any armed response
+    _data->_armedActive    = 0;
+  #endif
+  SREG = oldSREG;
+}
+#endif
+
+
+#if defined(TWI_SLAVE_ARMED)
+/**
+ *@brief      TWI_SlaveArmResponse prepares the response for the next host read
+ *
+ *            The data is copied to the buffer the client is not sending from. On the next
+ *            host read, SlaveIRQ_AddrRead swaps the buffers and acknowledges right away,
+ *            without calling onRequest. A read that is going on meanwhile keeps sending the
+ *            old response, so the host never gets a mix of both. The response is sent on every
+ *            host read until a new one is armed.
+ *
+ *@param      struct twiData *_data is a pointer to the structure that holds the variables
+ *              of a Wire object. Following struct elements are used in this function:
+ *                _armedReady
+ *                _armedNext
+ *                _armedLength
+ *                _armedBuffer
+ *            const uint8_t *buffer is the response
+ *            uint8_t length is its length, at most TWI_SLAVE_ARMED_LENGTH is used
+ *
+ *@return     uint8_t
+ *@retval     number of bytes that will be sent
+ */
+uint8_t TWI_SlaveArmResponse(struct twiData *_data, const uint8_t *buffer, uint8_t length) {
+  if (length > TWI_SLAVE_ARMED_LENGTH) {
+    length = TWI_SLAVE_ARMED_LENGTH;
+  }
+  uint8_t oldSREG = SREG;                     // The client interrupt swaps the buffers
+  cli();
+  _data->_armedReady = 0;                     // the buffer is not swapped in while it is written
+  uint8_t next = _data->_armedNext;
+  SREG = oldSREG;
+
+  memcpy(_data->_armedBuffer[next], buffer, length);
+  _data->_armedLength[next] = length;
+
+  cli();
+  _data->_armedReady = 1;
+  SREG = oldSREG;
+  return length;
+}
+#endif
+
+
 
 /**
  *@brief      TWI_MasterSetBaud sets the baud register to get the desired frequency
  *
- *            After checking if the host is actually enabled, the new baud is calculated.
- *              Then it is compared to the old baud. Only if they differ, the host is disabled,
- *              the baud register updated, and the host re-enabled
+ *            The baud is calculated at runtime with TWI_baudFor(), then TWI_MasterWriteBaud()
+ *              updates the register.
+ *
+ *@param      struct twiData *_data is a pointer to the structure that holds the variables
+ *              of a Wire object.
+ *            uint32_t frequency - the desired frequency in Hz
+ *            uint16_t riseTime - the rise time of SCL in ns, or TWI_RISE_TIME_AUTO
+ *
+ *@return     void
+ */
+void TWI_MasterSetBaud(struct twiData *_data, uint32_t frequency, uint16_t riseTime) {
+  riseTime = TWI_riseTime(frequency, riseTime);
+  TWI_MasterWriteBaud(_data, TWI_baudFor(F_CPU, frequency, riseTime), (frequency >= 600000), riseTime);
+}
+
+
+/**
+ *@brief      TWI_MasterWriteBaud writes a baud value to the baud register
+ *
+ *            After checking if the host is actually enabled, the new baud is compared to the old
+ *              one. Only if they differ, the host is disabled, the baud register updated, and the
+ *              host re-enabled
  *
  *@param      struct twiData *_data is a pointer to the structure that holds the variables
  *              of a Wire object. Following struct elements are used in this function:
  *              _bools._hostEnabled
  *              _module
+ *              _riseTime (TWI_GET_CLOCK)
+ *            uint8_t baud - the new MBAUD value
+ *            bool fastModePlus - enables the stronger drivers of Fast mode plus, above 600kHz
+ *            uint16_t riseTime - the rise time in ns the baud was calculated with, for TWI_MasterGetClock()
  *
  *@return     void
  */
-void TWI_MasterSetBaud(struct twiData *_data, uint32_t frequency) {
+void TWI_MasterWriteBaud(struct twiData *_data, uint8_t baud, bool fastModePlus, uint16_t riseTime) {
   if (_data->_bools._hostEnabled == 1) {                // Do something only if the host is enabled.
-    uint8_t newBaud = TWI_MasterCalcBaud(frequency);      // get the new Baud value
+    #if defined(TWI_GET_CLOCK)
+      _data->_riseTime = riseTime;
+    #endif
     uint8_t oldBaud = _data->_module->MBAUD;              // load the old Baud value
-    if (newBaud != oldBaud) {                             // compare both, in case the code is issuing this before every transmission.
+    if (baud != oldBaud) {                                // compare both, in case the code is issuing this before every transmission.
       uint8_t restore = _data->_module->MCTRLA;           // Save the old Master state
       _data->_module->MCTRLA    = 0;                         // Disable Master
-      _data->_module->MBAUD     = newBaud;                    // update Baud register
-      if (frequency >= 600000) {
+      _data->_module->MBAUD     = baud;                       // update Baud register
+      if (fastModePlus) {
         _data->_module->CTRLA  |=  TWI_FMPEN_bm;           // Enable FastMode+
       } else {
         _data->_module->CTRLA  &= ~TWI_FMPEN_bm;           // Disable FastMode+
@@ -236,7 +495,278 @@ void TWI_MasterSetBaud(struct twiData *_data, uint32_t frequency) {
       _data->_module->MSTATUS   = TWI_BUSSTATE_IDLE_gc;     // Force the state machine into Idle according to the data sheet
     }
   }
+  #if !defined(TWI_GET_CLOCK)
+    (void)riseTime;
+  #endif
+}
+
+
+#if defined(TWI_GET_CLOCK)
+/**
+ *@brief      TWI_MasterGetClock returns the SCL frequency the host actually runs at
+ *
+ *            Calculated back from the baud register and the rise time of the last setClock(),
+ *              so the rounding of the baud is included.
+ *
+ *@param      struct twiData *_data is a pointer to the structure that holds the variables
+ *              of a Wire object. Following struct elements are used in this function:
+ *              _bools._hostEnabled
+ *              _module
+ *              _riseTime
+ *
+ *@return     uint32_t
+ *@retval     the frequency in Hz, 0 if the host is not enabled
+ */
+uint32_t TWI_MasterGetClock(struct twiData *_data) {
+  if (_data->_bools._hostEnabled == 0) {
+    return 0;
+  }
+  return TWI_clockFor(F_CPU, _data->_module->MBAUD, _data->_riseTime);
+}
+#endif
+
+
+#if defined(TWI_TIMEOUT_SETTINGS)
+/**
+ *@brief      TWI_MasterSetTimeout sets the time a host transaction may go without progress
+ *
+ *            The software timeout is restarted with every byte, so a client that holds the clock
+ *            costs at most this time, no matter the clock speed and the bus speed. It is also
+ *            used for the inactive bus timeout of the host (MCTRLA.TIMEOUT): with 50us or more,
+ *            the longest of the 50, 100 and 200us settings that fits is selected, so a bus that
+ *            was left busy by a disturbance returns to idle by itself. Until this function is
+ *            called, the inactive bus timeout stays disabled, as the hardware comes up.
+ *            The client has no timeout of its own, it follows the host on the bus.
+ *
+ *@param      struct twiData *_data is a pointer to the structure that holds the variables
+ *              of a Wire object. Following struct elements are used in this function:
+ *                _timeout
+ *                _busTimeout
+ *                _bools._timeoutReset
+ *                _bools._hostEnabled
+ *                _module
+ *            uint32_t timeout in us, 0 disables the timeout
+ *            bool reset_with_timeout if true, the host is reset after a timeout
+ *
+ *@return     void
+ */
+void TWI_MasterSetTimeout(struct twiData *_data, uint32_t timeout, bool reset_with_timeout) {
+  _data->_timeout             = timeout;
+  _data->_bools._timeoutReset = reset_with_timeout;
+  _data->_busTimeout          = MasterTimeoutToGc(timeout);
+  if (_data->_bools._hostEnabled == 1) {
+    TWI_t *module   = _data->_module;
+    uint8_t restore = module->MCTRLA;
+    module->MCTRLA  = 0;                                    // The timeout is only changed with the host disabled
+    module->MCTRLA  = (restore & ~TWI_TIMEOUT_gm) | _data->_busTimeout;
+    module->MSTATUS = TWI_BUSSTATE_IDLE_gc;                 // Force the state machine into Idle according to the data sheet
+  }
+}
+
+
+/**
+ *@brief      MasterTimeoutToGc selects the inactive bus timeout of the host for a timeout in us
+ *
+ *@param      uint32_t timeout in us
+ *
+ *@return     uint8_t
+ *@retval     TWI_TIMEOUT_xxx_gc, disabled below 50us
+ */
+uint8_t MasterTimeoutToGc(uint32_t timeout) {
+  if (timeout >= 200) {
+    return TWI_TIMEOUT_200US_gc;
+  } else if (timeout >= 100) {
+    return TWI_TIMEOUT_100US_gc;
+  } else if (timeout >= 50) {
+    return TWI_TIMEOUT_50US_gc;
+  }
+  return TWI_TIMEOUT_DISABLED_gc;
+}
+#endif
+
+
+/**
+ *@brief      MasterXfer_TimedOut is called when a polled host transaction timed out
+ *
+ *            Sets the flag for getWireTimeoutFlag(). If a reset was requested with the timeout,
+ *            the host is flushed and disabled, which releases the bus, and enabled again in
+ *            the idle state. The baud rate and the other settings are kept.
+ *            After _recoverAfter timeouts in a row, TWI_MasterRecoverBus() is run.
+ *
+ *@param      struct twiData *_data is a pointer to the structure that holds the variables
+ *              of a Wire object. Following struct elements are used in this function:
+ *                _bools._timeoutFlag
+ *                _bools._timeoutReset
+ *                _recoverAfter
+ *                _failures
+ *                _module
+ *
+ *@return     void
+ */
+void MasterXfer_TimedOut(struct twiData *_data) {
+  _data->_bools._timeoutFlag = 1;
+  if (_data->_bools._timeoutReset == 1) {
+    TWI_t *module   = _data->_module;
+    uint8_t restore = module->MCTRLA;
+    module->MCTRLB  = TWI_FLUSH_bm;                       // Clear the internal state of the host
+    module->MCTRLA  = 0;                                  // Disable Master, SDA and SCL are released
+    module->MCTRLA  = restore;
+    module->MSTATUS = TWI_BUSSTATE_IDLE_gc;               // Force the state machine into Idle according to the data sheet
+  }
+  #if defined(TWI_TIMEOUT_SETTINGS)
+    if (_data->_recoverAfter != 0) {
+      if (++(_data->_failures) >= _data->_recoverAfter) {
+        TWI_MasterRecoverBus(_data);                        // also resets _failures
+      }
+    }
+  #endif
+}
+
+
+/**
+ *@brief      TWI_MasterRecoverBus frees a bus that is held low by a client and re-initializes the host
+ *
+ *            The host (and, with TWI_MANDS, the client) is disabled, so the pins can be used as
+ *            GPIO. Then SCL is clocked until the client releases SDA and a STOP is generated, see
+ *            TWI_RecoverPins() in twi_pins.c. Afterwards the host is enabled again with the
+ *            MCTRLA it had before, CTRLA and MBAUD are not touched, so the baud rate stays.
+ *            Must not be called while an asynchronous transaction is running.
+ *
+ *@param      struct twiData *_data is a pointer to the structure that holds the variables
+ *              of a Wire object. Following struct elements are used in this function:
+ *                _bools._hostEnabled
+ *                _failures
+ *                _module
+ *
+ *@return     bool
+ *@retval     true if SDA and SCL were high after the recovery, false if the bus is still
+ *              held or the host is not enabled
+ */
+bool TWI_MasterRecoverBus(struct twiData *_data) {
+  if (_data->_bools._hostEnabled == 0) {
+    return false;
+  }
+
+  TWI_t *module  = _data->_module;
+  uint8_t mctrla = module->MCTRLA;                      // Timeout, smart mode and enable
+  bool    free;
+
+  module->MCTRLB = TWI_FLUSH_bm;
+  module->MCTRLA = 0;                                   // Without the host...
+  #if defined(TWI_MANDS)
+    uint8_t sctrla = module->SCTRLA;
+    module->SCTRLA = 0;                                 // ...and the client, the pins are GPIO
+  #endif
+
+  #if defined(TWI1)
+    if (&TWI1 == module) {
+      free = TWI1_RecoverBus();
+    } else {
+      free = TWI0_RecoverBus();
+    }
+  #else
+    free = TWI0_RecoverBus();
+  #endif
+
+  module->MCTRLA  = mctrla;                             // The OUT bits were left cleared by TWI_RecoverPins
+  module->MSTATUS = TWI_BUSSTATE_IDLE_gc;               // Force the state machine into Idle according to the data sheet
+  #if defined(TWI_MANDS)
+    module->SCTRLA = sctrla;
+  #endif
+  #if defined(TWI_TIMEOUT_SETTINGS)
+    _data->_failures = 0;
+  #endif
+  return free;
+}
+
+
+#if defined(TWI_RETRY_ENABLE)
+/**
+ *@brief      TWI_MasterSetRetry sets how often and on which errors a host transaction is retried
+ *
+ *            Used by TWI_MasterWrite and TWI_MasterRead. The write replays the data that is still
+ *            in the transmit buffer, the read starts again at the beginning of the receive buffer.
+ *
+ *@param      struct twiData *_data is a pointer to the structure that holds the variables
+ *              of a Wire object. Following struct elements are used in this function:
+ *                _retryAttempts
+ *                _retryBackoff
+ *                _retryErrors
+ *            uint8_t attempts is the maximum number of attempts, 0 or 1 disables retries
+ *            uint16_t backoff is the wait in us before the first retry, doubled for every further one
+ *            uint8_t errors is a combination of TWI_RETRY_ARBLOST, TWI_RETRY_NACK and TWI_RETRY_TIMEOUT
+ *
+ *@return     void
+ */
+void TWI_MasterSetRetry(struct twiData *_data, uint8_t attempts, uint16_t backoff, uint8_t errors) {
+  _data->_retryAttempts = attempts;
+  _data->_retryBackoff  = backoff;
+  _data->_retryErrors   = errors;
+}
+#endif
+
+
+#if defined(TWI_SMBUS_PEC)
+/**
+ *@brief      TWI_SetPEC selects where the SMBus Packet Error Checking is used
+ *
+ *            Host: TWI_MasterWrite appends the PEC when it sends a STOP, TWI_MasterRead reads one
+ *            byte more than requested and checks it, a read with a REP START continues the CRC of
+ *            the write before it. The PEC byte is not counted and not stored.
+ *            Client: a host write is only passed to onReceive if its last byte is the correct PEC,
+ *            that byte is removed. When the data for a host read runs out, the PEC is sent.
+ *            A write that is followed by a REP START has no PEC of its own, it is passed on unchecked.
+ *
+ *@param      struct twiData *_data is a pointer to the structure that holds the variables
+ *              of a Wire object. Following struct elements are used in this function:
+ *                _pecModes
+ *            uint8_t modes is TWI_PEC_HOST and/or TWI_PEC_CLIENT, 0 disables the PEC
+ *
+ *@return     void
+ */
+void TWI_SetPEC(struct twiData *_data, uint8_t modes) {
+  _data->_pecModes = modes;
+}
+#endif
+
+
+#if defined(TWI_RETRY_ENABLE)
+/**
+ *@brief      MasterXfer_Retry decides if a failed host transaction is tried again
+ *
+ *            If the error is one that should be retried and attempts are left, the bus is
+ *            released with a STOP if it is still ours and the backoff time is waited. The
+ *            caller then starts over from the idle bus.
+ *
+ *@param      struct twiData *_data is a pointer to the structure that holds the variables
+ *              of a Wire object. Following struct elements are used in this function:
+ *                _retryAttempts
+ *                _retryBackoff
+ *                _retryErrors
+ *                _module
+ *            uint8_t error is the TWI_RETRY_xxx that made the attempt fail
+ *            uint8_t *attempt counts the retries of the caller, starting at 0
+ *
+ *@return     bool
+ *@retval     true if the transaction should be tried again
+ */
+bool MasterXfer_Retry(struct twiData *_data, uint8_t error, uint8_t *attempt) {
+  if (!(_data->_retryErrors & error) || ((*attempt) + 1 >= _data->_retryAttempts)) {
+    return false;
+  }
+  TWI_t *module = _data->_module;
+  if ((module->MSTATUS & TWI_BUSSTATE_gm) == TWI_BUSSTATE_OWNER_gc) {
+    module->MCTRLB = TWI_MCMD_STOP_gc;                  // Release the bus during the backoff
+  }
+  uint16_t backoff = _data->_retryBackoff;
+  for (uint8_t i = 0; i < (*attempt); i++) {
+    backoff = (backoff > 0x7FFF) ? 0xFFFF : (backoff << 1);
+  }
+  delayMicroseconds(backoff);
+  (*attempt)++;
+  return true;
 }
+#endif
 
 
 /**
@@ -258,9 +788,9 @@ void TWI_MasterSetBaud(struct twiData *_data, uint32_t frequency) {
  *@retval     amount of bytes available to read from the host or client buffer
  */
 uint8_t TWI_Available(struct twiData *_data) {
-  uint16_t num;
   uint8_t* rxHead;
   uint8_t* rxTail;
+  uint8_t  rxLength;
 
   #if defined(TWI_MANDS)                          // Add following if host and client are split
     if (_data->_bools._toggleStreamFn == 0x01) {
@@ -271,6 +801,7 @@ uint8_t TWI_Available(struct twiData *_data) {
         rxHead  = &(_data->_rxHeadS);
         rxTail  = &(_data->_rxTailS);
       #endif
+      rxLength  = TWI_RX_LENGTH_S(_data);
     } else
   #endif
   {
@@ -281,19 +812,10 @@ uint8_t TWI_Available(struct twiData *_data) {
       rxHead  = &(_data->_rxHead);
       rxTail  = &(_data->_rxTail);
     #endif
+    rxLength  = TWI_RX_LENGTH(_data);
   }
 
-  num = (BUFFER_LENGTH + (*rxHead) - (*rxTail));
-
-  #if defined(BUFFER_NOT_POWER_2)
-    if (num <  BUFFER_LENGTH) {
-      return  num;
-    } else {
-      return (num - BUFFER_LENGTH);
-    }
-  #else
-    return (num & (BUFFER_LENGTH - 1));             // a bitwise AND is more space-efficient but needs power of 2 buffer lengths
-  #endif
+  return TWI_usedBytes((*rxHead), (*rxTail), rxLength);
 }
 
 
@@ -311,6 +833,8 @@ uint8_t TWI_Available(struct twiData *_data) {
  *                _txBuffer[]
  *                _txHead
  *                _txTail
+ *                _timeout
+ *                _pec, _pecModes
  *            bool send_stop enables the STOP condition at the end of a write
  *
  *@return     uint8_t
@@ -334,20 +858,40 @@ uint8_t TWI_MasterWrite(struct twiData *_data, bool send_stop)  {
   uint8_t currentSM;
   uint8_t currentStatus;
   uint8_t dataWritten = 0;
-  uint16_t timeout = 0;
+  uint32_t timeout = TWI_timeoutStart();
+  #if defined(TWI_RETRY_ENABLE)
+    uint8_t attempt = 0;
+    uint8_t txStart = (*txTail);                            // a retry sends the same bytes again
+  #endif
+  #if defined(TWI_SMBUS_PEC)
+    uint8_t pec     = _data->_pec;                          // a REP START continues the CRC of the transaction
+    bool    pecSent = false;
+  #endif
+  #if defined(TWI_10BIT_ADDRESS)
+    bool addressLow = false;                                // the second byte of a 10-bit address is still to be sent
+  #endif
 
 
   if ((module->MSTATUS & TWI_BUSSTATE_gm) == TWI_BUSSTATE_UNKNOWN_gc) {
     return 0;                                                   // If the bus was not initialized, return
   }
 
+  if ((module->MSTATUS & TWI_BUSSTATE_gm) == TWI_BUSSTATE_OWNER_gc) {  // Bus is still ours, previous transaction had no STOP
+    module->MADDR = ADD_WRITE_BIT(_data->_clientAddress);      // REP START, this also clears the old WIF/RIF
+    #if defined(TWI_SMBUS_PEC)
+      pec = TWI_pecUpdate(pec, ADD_WRITE_BIT(_data->_clientAddress));
+    #endif
+    #if defined(TWI_10BIT_ADDRESS)
+      addressLow = TWI_isTenBit(_data->_clientAddress);
+    #endif
+  }
 
   while (true) {
     currentStatus = module->MSTATUS;
     currentSM = currentStatus & TWI_BUSSTATE_gm;  // get the current mode of the state machine
 
     #if defined(TWI_TIMEOUT_ENABLE)
-      if (++timeout > (F_CPU/1000)) {
+      if (TWI_timeoutElapsed(_data, &timeout)) {
         if      (currentSM == TWI_BUSSTATE_OWNER_gc) {
           TWI_SET_ERROR(TWI_ERR_TIMEOUT);
         } else if (currentSM == TWI_BUSSTATE_IDLE_gc) {
@@ -355,6 +899,16 @@ uint8_t TWI_MasterWrite(struct twiData *_data, bool send_stop)  {
         } else {
           TWI_SET_ERROR(TWI_ERR_UNDEFINED);
         }
+        MasterXfer_TimedOut(_data);
+        #if defined(TWI_RETRY_ENABLE)
+          if (MasterXfer_Retry(_data, TWI_RETRY_TIMEOUT, &attempt)) {
+            TWI_SET_ERROR(TWI_NO_ERR);
+            (*txTail)   = txStart;
+            dataWritten = 0;
+            timeout     = TWI_timeoutStart();
+            continue;
+          }
+        #endif
         break;
       }
     #endif
@@ -362,26 +916,78 @@ uint8_t TWI_MasterWrite(struct twiData *_data, bool send_stop)  {
     if (currentStatus & (TWI_ARBLOST_bm | TWI_BUSERR_bm)) {     // Check for Bus error
         module->MSTATUS = (TWI_ARBLOST_bm | TWI_BUSERR_bm);       // reset error flags
         TWI_SET_ERROR(TWI_ERR_BUS_ARB);                 // set error flag
+        #if defined(TWI_RETRY_ENABLE)
+          if (MasterXfer_Retry(_data, TWI_RETRY_ARBLOST, &attempt)) {
+            TWI_SET_ERROR(TWI_NO_ERR);
+            (*txTail)   = txStart;                                // start over when the bus is idle again
+            dataWritten = 0;
+            timeout     = TWI_timeoutStart();
+            continue;
+          }
+        #endif
         break;                                                    // leave RX loop
     }
 
     if (currentSM == TWI_BUSSTATE_IDLE_gc) {    // Bus has not sent START yet and is not BUSY
         module->MADDR = ADD_WRITE_BIT(_data->_clientAddress);
-        timeout = 0;
+        timeout = TWI_timeoutStart();
+        #if defined(TWI_SMBUS_PEC)
+          pec     = TWI_pecUpdate(0, ADD_WRITE_BIT(_data->_clientAddress));   // a new transaction, or a retry of it
+          pecSent = false;
+        #endif
+        #if defined(TWI_10BIT_ADDRESS)
+          addressLow = TWI_isTenBit(_data->_clientAddress);
+        #endif
     } else if (currentSM == TWI_BUSSTATE_OWNER_gc) {  // Address was sent, host is owner
       if (currentStatus & TWI_WIF_bm) {                 // data sent
         if (currentStatus & TWI_RXACK_bm) {               // AND the RXACK bit is set
+          #if defined(TWI_RETRY_ENABLE)
+            if ((dataWritten == 0) && MasterXfer_Retry(_data, TWI_RETRY_NACK, &attempt)) {
+              timeout = TWI_timeoutStart();                   // Address NACKed, nothing was sent yet
+              continue;
+            }
+          #endif
+          #if defined(TWI_SMBUS_PEC)
+            if (pecSent) {                                    // The client NACKs a PEC that does not match
+              TWI_SET_ERROR(TWI_ERR_PEC);
+              dataWritten = 0;
+              send_stop = 1;
+              break;
+            }
+          #endif
           if (dataWritten != 0) dataWritten--;              // last Byte has failed, so decrement the counter, except if it was Address
           TWI_SET_ERROR(TWI_ERR_RXACK);                              // set error flag
           send_stop = 1;
           break;                                              // leave loop
         } else {                                          // otherwise WRITE was ACKed
+          #if defined(TWI_10BIT_ADDRESS)
+            if (addressLow) {                               // 10-bit address: the second byte comes before the data
+              module->MDATA = _data->_clientAddressLow;
+              #if defined(TWI_SMBUS_PEC)
+                pec = TWI_pecUpdate(pec, _data->_clientAddressLow);
+              #endif
+              addressLow = false;
+              timeout = TWI_timeoutProgress(_data);
+              continue;                                     // a NACK of it counts as an address NACK
+            }
+          #endif
           if ((*txHead) != (*txTail)) {                     // check if there is data to be written
             module->MDATA = txBuffer[(*txTail)];              // Writing to the register to send data
-            (*txTail) = TWI_advancePosition(*txTail);         // advance tail
+            #if defined(TWI_SMBUS_PEC)
+              pec = TWI_pecUpdate(pec, txBuffer[(*txTail)]);    // while the byte is shifted out
+            #endif
+            (*txTail) = TWI_advancePosition(*txTail, TWI_TX_LENGTH(_data));   // advance tail
             dataWritten++;                                    // data was Written
-            timeout = 0;                                      // reset timeout
+            timeout = TWI_timeoutProgress(_data);             // reset timeout
           } else {                                          // else there is no data to be written
+            #if defined(TWI_SMBUS_PEC)
+              if ((_data->_pecModes & TWI_PEC_HOST) && (send_stop != 0) && (dataWritten != 0) && !pecSent) {
+                module->MDATA = pec;                            // PEC after the last byte, it is not counted
+                pecSent = true;
+                timeout = TWI_timeoutProgress(_data);
+                continue;
+              }
+            #endif
             break;                                            // TX finished, leave loop, error is still TWI_NO_ERR
           }
         }
@@ -393,6 +999,9 @@ uint8_t TWI_MasterWrite(struct twiData *_data, bool send_stop)  {
   if (send_stop != 0 || !(TWI_CHK_ERROR(TWI_NO_ERR))) {
     module->MCTRLB = TWI_MCMD_STOP_gc;                          // Send STOP
   }
+  #if defined(TWI_SMBUS_PEC)
+    _data->_pec = pec;                                          // for a read with REP START
+  #endif
   #if defined(TWI_ERROR_ENABLED)
     TWI_SAVE_ERROR(_data->_errors);                             // save error flags
   #endif
@@ -401,6 +1010,29 @@ uint8_t TWI_MasterWrite(struct twiData *_data, bool send_stop)  {
 
 
 
+#if defined(TWI_MASTER_SMART)
+/**
+ *@brief      MasterRead_SetAck prepares the acknowledge action that reading MDATA sends in smart mode
+ *
+ *            The last byte is NACKed. ACKACT is only written for it and for the first byte, the
+ *            bytes in between are ACKed without any MCTRLB write.
+ *
+ *@param      TWI_t *module is the pointer to the TWI module
+ *            size_t received is the amount of bytes read before this one
+ *            size_t length is the amount of bytes to read
+ *
+ *@return     void
+ */
+__attribute__((always_inline)) static inline void MasterRead_SetAck(TWI_t *module, size_t received, size_t length) {
+  if ((received + 1) >= length) {
+    module->MCTRLB = TWI_ACKACT_bm;                             // NACK the last byte
+  } else if (received == 0) {
+    module->MCTRLB = 0;                                         // ACK, the last read left ACKACT at NACK
+  }
+}
+#endif
+
+
 /**
  *@brief      TWI_MasterRead performs a host read operation on the TWI bus
  *
@@ -415,22 +1047,31 @@ uint8_t TWI_MasterWrite(struct twiData *_data, bool send_stop)  {
  *                _rxBuffer[]
  *                _rxHead
  *                _rxTail
+ *                _timeout
+ *                _pec, _pecModes
  *
  *            uint8_t bytesToRead is the desired amount of bytes to read. When finished, a
- *              NACK is issued.
+ *              NACK is issued. With the PEC, one byte more is read and not stored.
  *            bool send_stop enables the STOP condition at the end of a write
+ *            bool block, only with TWI_SMBUS_BLOCK, see TWI_MasterReadBlock
  *
  *@return     uint8_t
  *@retval     amount of bytes that were actually read. If 0, no read took place due to a bus error
  */
+#if defined(TWI_SMBUS_BLOCK)
+static uint8_t MasterRead_Poll(struct twiData *_data, uint8_t bytesToRead, bool send_stop, bool block) {
+#else
 uint8_t TWI_MasterRead(struct twiData *_data, uint8_t bytesToRead, bool send_stop) {
+#endif
   #if defined(TWI_MERGE_BUFFERS)                                // Same Buffers for tx/rx
     uint8_t* rxHead   = &(_data->_trHead);
     uint8_t* rxTail   = &(_data->_trTail);
     uint8_t* rxBuffer =   _data->_trBuffer;
   #else                                                         // Separate tx/rx Buffers
     uint8_t* rxHead   = &(_data->_rxHead);
-    // uint8_t* rxTail   = &(_data->_rxTail);
+    #if defined(TWI_LINEAR_BUFFERS)
+      uint8_t* rxTail = &(_data->_rxTail);
+    #endif
     uint8_t* rxBuffer =   _data->_rxBuffer;
   #endif
 
@@ -446,14 +1087,43 @@ uint8_t TWI_MasterRead(struct twiData *_data, uint8_t bytesToRead, bool send_sto
   TWI_INIT_ERROR;             // local variable for errors
   uint8_t command  = 0;
   uint8_t dataRead = 0;
-  uint16_t timeout = 0;
+  uint32_t timeout = TWI_timeoutStart();
+  #if defined(TWI_RETRY_ENABLE)
+    uint8_t attempt = 0;
+  #endif
+
+  #if defined(TWI_LINEAR_BUFFERS) || defined(TWI_MERGE_BUFFERS)
+    TWI_resetBuffer(rxHead, rxTail);                            // every read starts at the beginning of the buffer, or drops
+  #endif                                                        // the bytes a failed write left in the shared buffer
+  #if defined(TWI_SMBUS_PEC)
+    uint8_t pec       = _data->_pec;                            // a REP START continues the CRC of the write before
+    uint8_t pecLength = (_data->_pecModes & TWI_PEC_HOST) ? 1 : 0;  // 1 until the PEC byte was read
+    uint8_t rxStart   = (*rxHead);                              // a wrong PEC drops the bytes again
+  #else
+    const uint8_t pecLength = 0;
+  #endif
+  #if defined(TWI_10BIT_ADDRESS)
+    uint8_t addressSteps = 0;                                   // 10-bit: second address byte, then the REP START to read
+  #endif
+  #if defined(TWI_SMBUS_BLOCK)
+    uint8_t capacity     = bytesToRead;                         // a block read only knows the length after the first byte
+    bool    countPending = block;
+  #endif
+
+  if ((module->MSTATUS & TWI_BUSSTATE_gm) == TWI_BUSSTATE_OWNER_gc) {  // Bus is still ours, previous transaction had no STOP
+    module->MADDR = ADD_READ_BIT(_data->_clientAddress);       // REP START, otherwise the old WIF would look like a NACK
+                                                                // a 10-bit client was addressed by the write before
+    #if defined(TWI_SMBUS_PEC)
+      pec = TWI_pecUpdate(pec, ADD_READ_BIT(_data->_clientAddress));
+    #endif
+  }
 
   while (true) {
     currentStatus = module->MSTATUS;
     currentSM = currentStatus & TWI_BUSSTATE_gm;  // get the current mode of the state machine
 
     #if defined(TWI_TIMEOUT_ENABLE)
-      if (++timeout > (F_CPU/1000)) {
+      if (TWI_timeoutElapsed(_data, &timeout)) {
         if      (currentSM == TWI_BUSSTATE_OWNER_gc) {
           TWI_SET_ERROR(TWI_ERR_TIMEOUT);
         } else if (currentSM == TWI_BUSSTATE_IDLE_gc) {
@@ -461,6 +1131,14 @@ uint8_t TWI_MasterRead(struct twiData *_data, uint8_t bytesToRead, bool send_sto
         } else {
           TWI_SET_ERROR(TWI_ERR_UNDEFINED);
         }
+        MasterXfer_TimedOut(_data);
+        #if defined(TWI_RETRY_ENABLE)
+          if ((dataRead == 0) && MasterXfer_Retry(_data, TWI_RETRY_TIMEOUT, &attempt)) {
+            TWI_SET_ERROR(TWI_NO_ERR);
+            timeout = TWI_timeoutStart();
+            continue;
+          }
+        #endif
         break;
       }
     #endif
@@ -468,6 +1146,13 @@ uint8_t TWI_MasterRead(struct twiData *_data, uint8_t bytesToRead, bool send_sto
     if (currentStatus & (TWI_ARBLOST_bm | TWI_BUSERR_bm)) {   // Check for Bus error
       module->MSTATUS = (TWI_ARBLOST_bm | TWI_BUSERR_bm);       // reset error flags
       TWI_SET_ERROR(TWI_ERR_BUS_ARB);                           // set error flag
+      #if defined(TWI_RETRY_ENABLE)
+        if ((dataRead == 0) && MasterXfer_Retry(_data, TWI_RETRY_ARBLOST, &attempt)) {
+          TWI_SET_ERROR(TWI_NO_ERR);
+          timeout = TWI_timeoutStart();                         // start over when the bus is idle again
+          continue;
+        }
+      #endif
       break;                                                    // leave TX loop
     }
 
@@ -480,45 +1165,927 @@ uint8_t TWI_MasterRead(struct twiData *_data, uint8_t bytesToRead, bool send_sto
     }
 
     if (currentSM == TWI_BUSSTATE_IDLE_gc) {    // Bus has not sent START yet
-        module->MADDR = ADD_READ_BIT(_data->_clientAddress);
-        timeout = 0;
+        #if defined(TWI_10BIT_ADDRESS)
+          uint8_t address = ADD_READ_BIT(_data->_clientAddress);
+          addressSteps = 0;
+          if (TWI_isTenBit(address)) {          // 10-bit: the address is written first, then read with a REP START
+            address      = ADD_WRITE_BIT(address);
+            addressSteps = 2;
+          }
+        #else
+          uint8_t address = ADD_READ_BIT(_data->_clientAddress);
+        #endif
+        module->MADDR = address;
+        timeout = TWI_timeoutStart();
+        #if defined(TWI_SMBUS_PEC)
+          pec = TWI_pecUpdate(0, address);      // a new transaction, or a retry of it
+        #endif
+        #if defined(TWI_SMBUS_BLOCK)
+          bytesToRead  = capacity;
+          countPending = block;
+        #endif
     } else if (currentSM == TWI_BUSSTATE_OWNER_gc) {  // Address sent, check for WIF/RIF
       if (currentStatus & TWI_RIF_bm) {                    // data received
-        if (dataRead > (BUFFER_LENGTH-1)) {                   // Buffer overflow with this incoming Byte
+        #if defined(TWI_SMBUS_BLOCK)
+          if (countPending) {                                 // Block read: the first byte is the amount that follows
+            #if defined(TWI_MASTER_SMART)
+              module->MCTRLB = 0;                             // ACK, the last read left ACKACT at NACK
+            #endif
+            uint8_t count = module->MDATA;
+            #if defined(TWI_SMBUS_PEC)
+              pec = TWI_pecUpdate(pec, count);
+            #endif
+            countPending = false;
+            timeout = TWI_timeoutProgress(_data);
+            if (count > capacity) {                           // more than fits, the rest is not read
+              TWI_SET_ERROR(TWI_ERR_BUF_OVERFLOW);
+              count = capacity;
+              #if defined(TWI_SMBUS_PEC)
+                pecLength = 0;                                // no PEC after a truncated block, the check fails
+              #endif
+            }
+            bytesToRead = count;
+            if ((bytesToRead != 0) || (pecLength != 0)) {
+              #if !defined(TWI_MASTER_SMART)                  // in smart mode, reading MDATA did it
+                module->MCTRLB = TWI_MCMD_RECVTRANS_gc;
+              #endif
+            } else {                                          // Empty block. In smart mode the count was ACKed,
+              command = TWI_ACKACT_bm | TWI_MCMD_STOP_gc;     // so the byte after it is NACKed instead
+            }
+            continue;
+          }
+          if (block && (dataRead == bytesToRead) && (pecLength == 0)) {
+            command = TWI_ACKACT_bm | TWI_MCMD_STOP_gc;       // that byte after an empty block, it is not read
+            continue;
+          }
+        #endif
+        bool pecByte = (pecLength != 0) && (dataRead == bytesToRead);   // the PEC is not stored
+        if (!pecByte && (dataRead > (TWI_RX_LENGTH(_data)-1))) {  // Buffer overflow with this incoming Byte
           TWI_SET_ERROR(TWI_ERR_BUF_OVERFLOW);
           command = TWI_ACKACT_bm | TWI_MCMD_STOP_gc;         // send STOP + NACK
         } else {
+          #if defined(TWI_MASTER_SMART)
+            MasterRead_SetAck(module, dataRead, (size_t)bytesToRead + pecLength);
+          #endif
+          #if defined(TWI_SMBUS_PEC)
+            uint8_t payload = module->MDATA;
+            pec = TWI_pecUpdate(pec, payload);
+            if (pecByte) {
+              pecLength = 0;                                      // checked after the loop
+            } else {
+              rxBuffer[(*rxHead)] = payload;
+              (*rxHead) = TWI_advancePosition(*rxHead, TWI_RX_LENGTH(_data));
+              dataRead++;
+            }
+          #else
                                                     // Data is fine and we have space, so read out the data register
-          rxBuffer[(*rxHead)] = module->MDATA;        // and save it in the Buffer.
-          (*rxHead) = TWI_advancePosition(*rxHead);               // advance head
-          dataRead++;                                             // Byte was read
-          timeout = 0;                                            // reset timeout
-
-          if (dataRead < bytesToRead) {                           // expecting more bytes, so
-            module->MCTRLB = TWI_MCMD_RECVTRANS_gc;               // send an ACK so the Slave so it can send the next byte
+            rxBuffer[(*rxHead)] = module->MDATA;      // and save it in the Buffer.
+            (*rxHead) = TWI_advancePosition(*rxHead, TWI_RX_LENGTH(_data));  // advance head
+            dataRead++;                                           // Byte was read
+          #endif
+          timeout = TWI_timeoutProgress(_data);                   // reset timeout
+
+          if ((dataRead < bytesToRead) || (pecLength != 0)) {     // expecting more bytes, so
+            #if !defined(TWI_MASTER_SMART)                        // in smart mode, reading MDATA did it
+              module->MCTRLB = TWI_MCMD_RECVTRANS_gc;             // send an ACK so the Slave so it can send the next byte
+            #endif
           } else {                                                // Otherwise,
             if (send_stop != 0) {
-              command = TWI_ACKACT_bm | TWI_MCMD_STOP_gc;       // send STOP + NACK
+              #if defined(TWI_MASTER_SMART)
+                command = TWI_MCMD_STOP_gc;                     // the NACK was sent with the MDATA read, send STOP
+              #else
+                command = TWI_ACKACT_bm | TWI_MCMD_STOP_gc;     // send STOP + NACK
+              #endif
             } else {
+              #if !defined(TWI_MASTER_SMART)
+                module->MCTRLB = TWI_ACKACT_bm;                 // NACK goes out with the next (REP) START
+              #endif
               break;
             }
           }
         }
       } else if (currentStatus & TWI_WIF_bm) {  // Address NACKed
+        #if defined(TWI_10BIT_ADDRESS)
+          if ((addressSteps != 0) && !(currentStatus & TWI_RXACK_bm)) {  // or a step of a 10-bit address was ACKed
+            uint8_t next;
+            if (addressSteps == 2) {
+              next = _data->_clientAddressLow;
+              module->MDATA = next;
+            } else {
+              next = ADD_READ_BIT(_data->_clientAddress);
+              module->MADDR = next;             // REP START in read direction
+            }
+            #if defined(TWI_SMBUS_PEC)
+              pec = TWI_pecUpdate(pec, next);
+            #endif
+            addressSteps--;
+            continue;
+          }
+        #endif
+        #if defined(TWI_RETRY_ENABLE)
+          if (MasterXfer_Retry(_data, TWI_RETRY_NACK, &attempt)) {
+            timeout = TWI_timeoutStart();
+            continue;
+          }
+        #endif
         TWI_SET_ERROR(TWI_ERR_RXACK);           // set error flag
         command = TWI_MCMD_STOP_gc;
       }
     }
   }
 
+  #if defined(TWI_SMBUS_PEC)
+    _data->_pec = pec;
+    if ((_data->_pecModes & TWI_PEC_HOST) && ((pecLength != 0) || (pec != 0))) {
+      if (TWI_CHK_ERROR(TWI_NO_ERR)) {                          // PEC missing or wrong, the data can't be trusted
+        TWI_SET_ERROR(TWI_ERR_PEC);
+      }
+      (*rxHead) = rxStart;
+      dataRead  = 0;
+    }
+  #endif
   #if defined(TWI_ERROR_ENABLED)
     TWI_SAVE_ERROR(_data->_errors);                             // save error flags
   #endif
   return dataRead;
 }
 
-/**
- *@brief      TWI_HandleSlaveIRQ checks the status register and decides the next action based on that
+#if defined(TWI_SMBUS_BLOCK)
+uint8_t TWI_MasterRead(struct twiData *_data, uint8_t bytesToRead, bool send_stop) {
+  return MasterRead_Poll(_data, bytesToRead, send_stop, false);
+}
+
+
+/**
+ *@brief      TWI_MasterReadBlock performs an SMBus block read on the TWI bus
+ *
+ *            Like TWI_MasterRead, but the first byte from the client is the amount of bytes that
+ *            follow. It is not stored, the loop reads exactly that many bytes (and the PEC) and
+ *            NACKs the last one, so there is no second transaction and no over-read.
+ *            Usually the command was written with TWI_MasterWrite(_data, false) before, this
+ *            read then starts with a REP START. It always ends with a STOP.
+ *
+ *@param      struct twiData *_data is a pointer to the structure that holds the variables
+ *              of a Wire object, see TWI_MasterRead
+ *            uint8_t maxBytes is the most the destination can take. A longer block is cut off
+ *              with TWI_ERR_BUF_OVERFLOW, the bytes up to there are kept unless the PEC is used.
+ *
+ *@return     uint8_t
+ *@retval     amount of bytes of the block that were read, without the count
+ */
+uint8_t TWI_MasterReadBlock(struct twiData *_data, uint8_t maxBytes) {
+  return MasterRead_Poll(_data, maxBytes, true, true);
+}
+#endif
+
+/**
+ *@brief      MasterXfer_Start sends the first address of a transaction
+ *
+ *            If there is something to write, the write address is sent, otherwise the read address.
+ *            When the host still owns the bus (previous transaction without STOP), writing MADDR
+ *            results in a REP START. The progress counters and the status are reset here.
+ *
+ *@param      TWI_t *module is the pointer to the TWI module
+ *            struct twiTransaction *xfer is the transaction to start
+ *
+ *@return     void
+ */
+void MasterXfer_Start(TWI_t *module, struct twiTransaction *xfer) {
+  xfer->txCount = 0;
+  xfer->rxCount = 0;
+  xfer->status  = TWI_NO_ERR;
+  if ((xfer->txLength == 0) && (xfer->rxLength != 0)) {        // Nothing to write, start with the read
+    xfer->flags |= (TWI_XFER_BUSY | TWI_XFER_READING);
+    module->MADDR = ADD_READ_BIT(xfer->address);
+  } else {
+    xfer->flags = (xfer->flags & ~TWI_XFER_READING) | TWI_XFER_BUSY;
+    module->MADDR = ADD_WRITE_BIT(xfer->address);
+  }
+}
+
+
+/**
+ *@brief      MasterXfer_Step is the host state machine and advances a transaction by one step
+ *
+ *            It evaluates MSTATUS once and reacts on RIF, WIF and the error flags. If none of them
+ *            is set, nothing happens. This makes it usable from the TWIM interrupt as well as from
+ *            a polling loop.
+ *            The write phase is followed by a REP START and the read phase if rxLength is not zero.
+ *            The last received byte is NACKed. Without TWI_XFER_STOP, the NACK is only prepared
+ *            and sent together with the next (REP) START.
+ *
+ *@param      TWI_t *module is the pointer to the TWI module
+ *            struct twiTransaction *xfer is the transaction that is on the bus
+ *
+ *@return     bool
+ *@retval     true if the transaction has finished, the result is in xfer->status
+ */
+bool MasterXfer_Step(TWI_t *module, struct twiTransaction *xfer) {
+  uint8_t currentStatus = module->MSTATUS;
+
+  if (currentStatus & (TWI_ARBLOST_bm | TWI_BUSERR_bm)) {     // Check for Bus error
+    module->MSTATUS = (TWI_ARBLOST_bm | TWI_BUSERR_bm);         // reset error flags, the bus is not ours anymore
+    xfer->status = TWI_ERR_BUS_ARB;
+  } else if (currentStatus & TWI_RIF_bm) {                    // data received
+    #if defined(TWI_MASTER_SMART)
+      MasterRead_SetAck(module, xfer->rxCount, xfer->rxLength);
+    #endif
+    xfer->rxBuffer[xfer->rxCount] = module->MDATA;
+    xfer->rxCount++;
+    if (xfer->rxCount < xfer->rxLength) {                       // expecting more bytes, so
+      #if !defined(TWI_MASTER_SMART)                            // in smart mode, reading MDATA did it
+        module->MCTRLB = TWI_MCMD_RECVTRANS_gc;                 // send an ACK so the Slave so it can send the next byte
+      #endif
+      return false;
+    }
+    #if defined(TWI_MASTER_SMART)                               // the NACK was sent with the MDATA read
+      if (xfer->flags & TWI_XFER_STOP) {
+        module->MCTRLB = TWI_MCMD_STOP_gc;                      // send STOP
+      }
+    #else
+      if (xfer->flags & TWI_XFER_STOP) {
+        module->MCTRLB = TWI_ACKACT_bm | TWI_MCMD_STOP_gc;      // send STOP + NACK
+      } else {
+        module->MCTRLB = TWI_ACKACT_bm;                         // NACK goes out with the next (REP) START
+      }
+    #endif
+  } else if (currentStatus & TWI_WIF_bm) {                    // address or data sent
+    if (currentStatus & TWI_RXACK_bm) {                         // and it was NACKed
+      if ((xfer->txCount != 0) && !(xfer->flags & TWI_XFER_READING)) {
+        xfer->txCount--;                                          // last Byte has failed, except if it was Address
+      }
+      xfer->status = TWI_ERR_RXACK;
+      module->MCTRLB = TWI_MCMD_STOP_gc;
+    } else if (xfer->flags & TWI_XFER_READING) {                // WIF in the read phase is not expected
+      xfer->status = TWI_ERR_UNDEFINED;
+      module->MCTRLB = TWI_MCMD_STOP_gc;
+    } else if (xfer->txCount < xfer->txLength) {                // more data to write
+      module->MDATA = xfer->txBuffer[xfer->txCount];
+      xfer->txCount++;
+      return false;
+    } else if (xfer->rxLength != 0) {                           // write phase done, REP START for the read phase
+      xfer->flags |= TWI_XFER_READING;
+      module->MADDR = ADD_READ_BIT(xfer->address);
+      return false;
+    } else if (xfer->flags & TWI_XFER_STOP) {
+      module->MCTRLB = TWI_MCMD_STOP_gc;                        // Send STOP
+    }
+  } else {
+    return false;                                             // Nothing happened yet
+  }
+  xfer->flags &= ~TWI_XFER_BUSY;
+  return true;
+}
+
+
+/**
+ *@brief      TWI_MasterTransfer performs a transaction by polling the host state machine
+ *
+ *            This is the blocking counterpart of the interrupt driven host engine. As the data is
+ *            taken from / put into the buffers of the transaction directly, there is no copy
+ *            into the Wire buffers and no limit by their lengths.
+ *            If the host still owns the bus from a transaction without STOP, a REP START is sent.
+ *            A 10-bit address is refused with TWI_ERR_TENBIT, the state machine only sends
+ *            the first address byte.
+ *            The timeout is handled the same way as in TWI_MasterWrite/TWI_MasterRead and
+ *            restarted whenever a byte was transferred.
+ *
+ *@param      struct twiData *_data is a pointer to the structure that holds the variables
+ *              of a Wire object. Following struct elements are used in this function:
+ *                _module
+ *                _hostActive
+ *                _timeout
+ *            struct twiTransaction *xfer is the transaction to perform
+ *
+ *@return     uint8_t
+ *@retval     TWI_NO_ERR or one of the TWI_ERR_xxx codes, also saved in xfer->status.
+ *              xfer->txCount and xfer->rxCount hold the amount of bytes transferred.
+ */
+uint8_t TWI_MasterTransfer(struct twiData *_data, struct twiTransaction *xfer) {
+  TWI_t *module = _data->_module;     // Compiler treats the pointer to the TWI module as volatile and
+                                      // creates bloat-y code, using a local variable fixes that
+  #if defined(TWI_TIMEOUT_ENABLE)
+    uint8_t currentSM;
+    uint32_t timeout = TWI_timeoutStart();
+    size_t progress  = 0;
+  #endif
+
+  xfer->txCount = 0;
+  xfer->rxCount = 0;
+  #if defined(TWI_10BIT_ADDRESS)
+    if (TWI_isTenBit(xfer->address)) {                        // The second address byte would be missing
+      xfer->status = TWI_ERR_TENBIT;
+      return TWI_ERR_TENBIT;
+    }
+  #endif
+  #if defined(TWI_MASTER_ASYNC)
+    if (TWI_MasterAsyncWait(_data) != TWI_NO_ERR) {          // Wait for the host engine to finish the queue
+      xfer->status = TWI_ERR_TIMEOUT;
+      return TWI_ERR_TIMEOUT;
+    }
+  #endif
+  if ((module->MSTATUS & TWI_BUSSTATE_gm) == TWI_BUSSTATE_UNKNOWN_gc) {
+    xfer->status = TWI_ERR_UNDEFINED;                         // If the bus was not initialized, return
+    return TWI_ERR_UNDEFINED;
+  }
+
+  while ((module->MSTATUS & TWI_BUSSTATE_gm) == TWI_BUSSTATE_BUSY_gc) {   // Another host is using the bus
+    #if defined(TWI_TIMEOUT_ENABLE)
+      if (TWI_timeoutElapsed(_data, &timeout)) {
+        MasterXfer_TimedOut(_data);
+        xfer->status = TWI_ERR_UNDEFINED;
+        return TWI_ERR_UNDEFINED;
+      }
+    #endif
+  }
+
+  #if defined(TWI_TIMEOUT_ENABLE)
+    timeout = TWI_timeoutStart();
+  #endif
+  MasterXfer_Start(module, xfer);
+  while (MasterXfer_Step(module, xfer) == false) {
+    #if defined(TWI_TIMEOUT_ENABLE)
+      if (progress != (xfer->txCount + xfer->rxCount)) {      // a byte was transferred
+        progress = (xfer->txCount + xfer->rxCount);
+        timeout  = TWI_timeoutProgress(_data);                // reset timeout
+      } else if (TWI_timeoutElapsed(_data, &timeout)) {
+        currentSM = module->MSTATUS & TWI_BUSSTATE_gm;
+        if      (currentSM == TWI_BUSSTATE_OWNER_gc) {
+          xfer->status = TWI_ERR_TIMEOUT;
+          module->MCTRLB = TWI_MCMD_STOP_gc;                  // Release the bus
+        } else if (currentSM == TWI_BUSSTATE_IDLE_gc) {
+          xfer->status = TWI_ERR_PULLUP;
+        } else {
+          xfer->status = TWI_ERR_UNDEFINED;
+        }
+        xfer->flags &= ~TWI_XFER_BUSY;
+        MasterXfer_TimedOut(_data);
+        break;
+      }
+    #endif
+  }
+
+  #if defined(TWI_ERROR_ENABLED)
+    _data->_errors = xfer->status;                            // save error flags
+  #endif
+  return xfer->status;
+}
+
+
+#if defined(TWI_TIMEOUT_ENABLE)
+/**
+ *@brief      MasterScan_Budget returns the time in us one probe of TWI_MasterScan may take
+ *
+ *            TWI_SCAN_BUDGET_BITS bit times at the baud rate in MBAUD. The rise time, which
+ *            makes the bits a bit longer, is covered by the margin of TWI_SCAN_BUDGET_BITS.
+ */
+static uint32_t MasterScan_Budget(TWI_t *module) {
+  uint32_t cyclesPerBit = 10 + 2 * (uint32_t)module->MBAUD;       // f_SCL = F_CPU / (10 + 2 * BAUD + F_CPU * t_rise)
+  return ((cyclesPerBit * TWI_SCAN_BUDGET_BITS) / (F_CPU / 1000000UL)) + 2;  // + the resolution of micros()
+}
+#endif
+
+
+/**
+ *@brief      TWI_MasterScan looks for clients by sending only their address
+ *
+ *            Every address from first to last is sent in write direction. A client that ACKs is
+ *            marked in the map, the next address follows with a REP START and only the last
+ *            one is terminated with a STOP. No data byte is transferred, the clients only see
+ *            an empty write.
+ *            Each probe gets TWI_SCAN_BUDGET_BITS bit times instead of the timeout of
+ *            setWireTimeout(). On a bus error, lost arbitration or a probe that runs out of
+ *            time, e.g. because of missing pull-ups or a client holding SCL, the scan is aborted
+ *            and the map holds the clients that were found until then.
+ *            MCTRLA.QCEN is not used: the quick command only changes probes in read direction,
+ *            where the client could drive SDA low after the ACK, preventing the STOP.
+ *
+ *@param      struct twiData *_data is a pointer to the structure that holds the variables
+ *              of a Wire object. Following struct elements are used in this function:
+ *                _bools._hostEnabled
+ *                _timeout
+ *                _module
+ *            uint8_t *map receives the result, 16 bytes, bit (address & 7) of map[address >> 3]
+ *              is set if the client with that address is present
+ *            uint8_t first is the first address to probe
+ *            uint8_t last is the last address to probe, at most 0x7F
+ *
+ *@return     uint8_t
+ *@retval     TWI_NO_ERR if every address was probed, otherwise the error that aborted the scan
+ */
+uint8_t TWI_MasterScan(struct twiData *_data, uint8_t *map, uint8_t first, uint8_t last) {
+  TWI_t *module = _data->_module;     // Compiler treats the pointer to the TWI module as volatile and
+                                      // creates bloat-y code, using a local variable fixes that
+  uint8_t status = TWI_NO_ERR;
+  uint8_t currentStatus;
+  #if defined(TWI_TIMEOUT_ENABLE)
+    uint32_t timeout = TWI_timeoutStart();
+  #endif
+
+  memset(map, 0, 16);
+  if (last > 0x7F) {
+    last = 0x7F;
+  }
+
+  #if defined(TWI_MASTER_ASYNC)
+    if (TWI_MasterAsyncWait(_data) != TWI_NO_ERR) {          // Wait for the host engine to finish the queue
+      return TWI_ERR_TIMEOUT;
+    }
+  #endif
+
+  if ((_data->_bools._hostEnabled == 0) ||
+      ((module->MSTATUS & TWI_BUSSTATE_gm) == TWI_BUSSTATE_UNKNOWN_gc)) {
+    status = TWI_ERR_UNDEFINED;                               // If the bus was not initialized, return
+  }
+
+  while ((status == TWI_NO_ERR) && ((module->MSTATUS & TWI_BUSSTATE_gm) == TWI_BUSSTATE_BUSY_gc)) {  // Another host is using the bus
+    #if defined(TWI_TIMEOUT_ENABLE)
+      if (TWI_timeoutElapsed(_data, &timeout)) {
+        MasterXfer_TimedOut(_data);
+        status = TWI_ERR_UNDEFINED;
+      }
+    #endif
+  }
+
+  #if defined(TWI_TIMEOUT_ENABLE)
+    uint32_t budget = MasterScan_Budget(module);
+  #endif
+  for (uint8_t address = first; (status == TWI_NO_ERR) && (address <= last); address++) {
+    #if defined(TWI_TIMEOUT_ENABLE)
+      timeout = TWI_timeoutStart();
+    #endif
+    module->MADDR = ADD_WRITE_BIT(address << 1);              // START, or REP START after the previous probe
+
+    while (true) {
+      currentStatus = module->MSTATUS;
+      if (currentStatus & (TWI_ARBLOST_bm | TWI_BUSERR_bm)) {   // Check for Bus error
+        module->MSTATUS = (TWI_ARBLOST_bm | TWI_BUSERR_bm);       // reset error flags
+        status = TWI_ERR_BUS_ARB;
+        break;
+      }
+      if (currentStatus & TWI_WIF_bm) {                         // address sent
+        if (!(currentStatus & TWI_RXACK_bm)) {                    // and ACKed
+          map[address >> 3] |= (1 << (address & 0x07));
+        }
+        break;
+      }
+      #if defined(TWI_TIMEOUT_ENABLE)
+        if (TWI_timeoutExpired(budget, &timeout)) {
+          uint8_t currentSM = currentStatus & TWI_BUSSTATE_gm;
+          if      (currentSM == TWI_BUSSTATE_OWNER_gc) {
+            status = TWI_ERR_TIMEOUT;
+            module->MCTRLB = TWI_MCMD_STOP_gc;                    // Release the bus
+          } else if (currentSM == TWI_BUSSTATE_IDLE_gc) {
+            status = TWI_ERR_PULLUP;
+          } else {
+            status = TWI_ERR_UNDEFINED;
+          }
+          MasterXfer_TimedOut(_data);
+          break;
+        }
+      #endif
+    }
+    if (address == 0x7F) {
+      break;                                                  // address++ would not end the loop
+    }
+  }
+
+  if ((module->MSTATUS & TWI_BUSSTATE_gm) == TWI_BUSSTATE_OWNER_gc) {
+    module->MCTRLB = TWI_MCMD_STOP_gc;                        // Send STOP after the last probe
+  }
+  #if defined(TWI_ERROR_ENABLED)
+    _data->_errors = status;                                  // save error flags
+  #endif
+  return status;
+}
+
+
+/**
+ *@brief      TWI_MasterWriteRead writes the transmit buffer and reads into the receive buffer in one go
+ *
+ *            The typical register access: the data that was put into the transmit buffer (usually
+ *            the register address) is written, followed by a REP START and the read. There is no
+ *            STOP in between and it is done in one pass of the host state machine.
+ *            The receive buffer is reset before the read.
+ *            The host state machine only sends one address byte and no PEC, so for a 10-bit client
+ *            or with the PEC of the host, TWI_MasterWrite and TWI_MasterRead are used instead.
+ *
+ *@param      struct twiData *_data is a pointer to the structure that holds the variables
+ *              of a Wire object. Following struct elements are used in this function:
+ *                _clientAddress
+ *                _txBuffer[]
+ *                _txHead
+ *                _txTail
+ *                _rxBuffer[]
+ *                _rxHead
+ *                _rxTail
+ *                _pecModes
+ *            uint8_t bytesToRead is the desired amount of bytes to read, limited to TWI_RX_BUFFER_LENGTH - 1
+ *            bool send_stop enables the STOP condition at the end of the read
+ *
+ *@return     uint8_t
+ *@retval     amount of bytes that were read. If 0, no read took place due to an error in the write
+ */
+uint8_t TWI_MasterWriteRead(struct twiData *_data, uint8_t bytesToRead, bool send_stop) {
+  #if defined(TWI_MERGE_BUFFERS)                              // Same Buffers for tx/rx
+    uint8_t* txHead   = &(_data->_trHead);
+    uint8_t* txTail   = &(_data->_trTail);
+    uint8_t* rxHead   = &(_data->_trHead);
+    uint8_t* rxTail   = &(_data->_trTail);
+    uint8_t* txBuffer =   _data->_trBuffer;
+    uint8_t* rxBuffer =   _data->_trBuffer;               // The read phase starts after the write phase has finished
+  #else                                                       // Separate tx/rx Buffers
+    uint8_t* txHead   = &(_data->_txHead);
+    uint8_t* txTail   = &(_data->_txTail);
+    uint8_t* rxHead   = &(_data->_rxHead);
+    uint8_t* rxTail   = &(_data->_rxTail);
+    uint8_t* txBuffer =   _data->_txBuffer;
+    uint8_t* rxBuffer =   _data->_rxBuffer;
+  #endif
+  struct twiTransaction xfer;
+
+  if (bytesToRead > (TWI_RX_LENGTH(_data) - 1)) {             // a completely filled ring buffer would look empty
+    bytesToRead = (TWI_RX_LENGTH(_data) - 1);
+  }
+
+  #if defined(TWI_10BIT_ADDRESS) || defined(TWI_SMBUS_PEC)
+    bool polled = false;
+    #if defined(TWI_10BIT_ADDRESS)
+      polled |= TWI_isTenBit(_data->_clientAddress);
+    #endif
+    #if defined(TWI_SMBUS_PEC)
+      polled |= ((_data->_pecModes & TWI_PEC_HOST) != 0);
+    #endif
+    if (polled) {
+      uint8_t txLength = (uint8_t)((*txHead) - (*txTail));
+      #if defined(TWI_MASTER_ASYNC)
+        if (TWI_MasterAsyncWait(_data) != TWI_NO_ERR) {      // Wait for the host engine to finish the queue
+          TWI_resetBuffer(txHead, txTail);
+          return 0;
+        }
+      #endif
+      if (TWI_MasterWrite(_data, false) != txLength) {        // a failed write ends with a STOP
+        return 0;
+      }
+      TWI_resetBuffer(rxHead, rxTail);
+      return TWI_MasterRead(_data, bytesToRead, send_stop);   // REP START, to the same 10-bit client only the first byte
+    }
+  #endif
+
+  xfer.address  = _data->_clientAddress;
+  xfer.txBuffer = &txBuffer[(*txTail)];
+  xfer.txLength = (uint8_t)((*txHead) - (*txTail));           // beginTransmission() starts at 0, no wrap-around possible
+  xfer.rxBuffer = rxBuffer;
+  xfer.rxLength = bytesToRead;
+  xfer.flags    = send_stop ? TWI_XFER_STOP : 0;
+  TWI_MasterTransfer(_data, &xfer);
+
+  TWI_resetBuffer(txHead, txTail);                            // Transmit buffer was consumed
+  (*rxTail) = 0;
+  (*rxHead) = (uint8_t)xfer.rxCount;                          // the read phase filled the buffer from the start
+  return (uint8_t)xfer.rxCount;
+}
+
+
+#if defined(TWI_MASTER_ASYNC)
+/**
+ *@brief      TWI_MasterWriteAsync starts a host write of the transmit buffer and returns immediately
+ *
+ *            The transmission is handled by the TWIM interrupt. If other transactions are queued,
+ *            it is started after them. Completion is reported through the user_onHostComplete
+ *            function, if set, and TWI_MasterAsyncBusy().
+ *            The transmit buffer must not be changed until the transaction has finished.
+ *
+ *@param      struct twiData *_data is a pointer to the structure that holds the variables
+ *              of a Wire object. Following struct elements are used in this function:
+ *                _hostXfer
+ *                _clientAddress
+ *                _txBuffer[]
+ *                _txHead
+ *                _txTail
+ *            bool send_stop enables the STOP condition at the end of a write
+ *
+ *@return     uint8_t
+ *@retval     TWI_NO_ERR if the transaction was started, TWI_ERR_BUSY, TWI_ERR_TENBIT or
+ *              TWI_ERR_UNDEFINED otherwise
+ */
+uint8_t TWI_MasterWriteAsync(struct twiData *_data, bool send_stop) {
+  #if defined(TWI_MERGE_BUFFERS)                              // Same Buffers for tx/rx
+    uint8_t* txHead   = &(_data->_trHead);
+    uint8_t* txTail   = &(_data->_trTail);
+    uint8_t* txBuffer =   _data->_trBuffer;
+  #else                                                       // Separate tx/rx Buffers
+    uint8_t* txHead   = &(_data->_txHead);
+    uint8_t* txTail   = &(_data->_txTail);
+    uint8_t* txBuffer =   _data->_txBuffer;
+  #endif
+  struct twiTransaction *xfer = &(_data->_hostXfer);
+
+  if (xfer->flags & TWI_XFER_QUEUED) {                        // Buffer is still in use by the last transaction
+    return TWI_ERR_BUSY;
+  }
+  #if defined(TWI_10BIT_ADDRESS)
+    if (TWI_isTenBit(_data->_clientAddress)) {                // The host engine only sends one address byte
+      TWI_resetBuffer(txHead, txTail);                        // dropped like after a failed endTransmission()
+      return TWI_ERR_TENBIT;
+    }
+  #endif
+
+  xfer->address  = _data->_clientAddress;
+  xfer->txBuffer = &txBuffer[(*txTail)];
+  xfer->txLength = (uint8_t)((*txHead) - (*txTail));          // beginTransmission() starts at 0, no wrap-around possible
+  xfer->rxLength = 0;
+  xfer->flags    = send_stop ? TWI_XFER_STOP : 0;
+  TWI_resetBuffer(txHead, txTail);                            // Data was handed over to the host engine
+
+  return TWI_MasterEnqueue(_data, xfer);
+}
+
+
+/**
+ *@brief      TWI_MasterReadAsync starts a host read into the receive buffer and returns immediately
+ *
+ *            The reception is handled by the TWIM interrupt. The receive buffer is reset, the
+ *            received bytes become available when the transaction has finished.
+ *
+ *@param      struct twiData *_data is a pointer to the structure that holds the variables
+ *              of a Wire object. Following struct elements are used in this function:
+ *                _hostXfer
+ *                _clientAddress
+ *                _rxBuffer[]
+ *                _rxHead
+ *                _rxTail
+ *            uint8_t bytesToRead is the desired amount of bytes to read, limited to TWI_RX_BUFFER_LENGTH - 1
+ *            bool send_stop enables the STOP condition at the end of the read
+ *
+ *@return     uint8_t
+ *@retval     TWI_NO_ERR if the transaction was started, TWI_ERR_BUSY, TWI_ERR_TENBIT or
+ *              TWI_ERR_UNDEFINED otherwise
+ */
+uint8_t TWI_MasterReadAsync(struct twiData *_data, uint8_t bytesToRead, bool send_stop) {
+  #if defined(TWI_MERGE_BUFFERS)                              // Same Buffers for tx/rx
+    uint8_t* rxHead   = &(_data->_trHead);
+    uint8_t* rxTail   = &(_data->_trTail);
+    uint8_t* rxBuffer =   _data->_trBuffer;
+  #else                                                       // Separate tx/rx Buffers
+    uint8_t* rxHead   = &(_data->_rxHead);
+    uint8_t* rxTail   = &(_data->_rxTail);
+    uint8_t* rxBuffer =   _data->_rxBuffer;
+  #endif
+  struct twiTransaction *xfer = &(_data->_hostXfer);
+
+  if (xfer->flags & TWI_XFER_QUEUED) {                        // Buffer is still in use by the last transaction
+    return TWI_ERR_BUSY;
+  }
+  #if defined(TWI_10BIT_ADDRESS)
+    if (TWI_isTenBit(_data->_clientAddress)) {                // The host engine only sends one address byte
+      return TWI_ERR_TENBIT;
+    }
+  #endif
+  if (bytesToRead > (TWI_RX_LENGTH(_data) - 1)) {             // a completely filled ring buffer would look empty
+    bytesToRead = (TWI_RX_LENGTH(_data) - 1);
+  }
+
+  (*rxHead) = 0;                                              // the host engine fills the buffer from the start
+  (*rxTail) = 0;
+  xfer->address  = _data->_clientAddress;
+  xfer->rxBuffer = rxBuffer;
+  xfer->rxLength = bytesToRead;
+  xfer->txLength = 0;
+  xfer->flags    = send_stop ? TWI_XFER_STOP : 0;
+
+  return TWI_MasterEnqueue(_data, xfer);
+}
+
+
+/**
+ *@brief      TWI_MasterAsyncBusy returns if the host engine is working on a transaction
+ *
+ *            This includes all queued transactions.
+ *
+ *@param      struct twiData *_data is a pointer to the structure that holds the variables
+ *              of a Wire object. Following struct elements are used in this function:
+ *                _hostActive
+ *
+ *@return     bool
+ *@retval     true if a transaction is still running or queued
+ */
+bool TWI_MasterAsyncBusy(struct twiData *_data) {
+  return (_data->_hostActive != NULL);
+}
+
+
+/**
+ *@brief      TWI_MasterAsyncWait waits until the host engine has finished all queued transactions
+ *
+ *            The timeout of setWireTimeout() is restarted whenever the engine transferred a byte
+ *            or moved on to the next transaction, like in TWI_MasterTransfer. When it runs out,
+ *            e.g. because a client holds SCL, the running and all queued transactions are aborted
+ *            with TWI_ERR_TIMEOUT, the bus is released with a STOP if the host still owns it and
+ *            the timeout is handled by MasterXfer_TimedOut().
+ *
+ *@param      struct twiData *_data is a pointer to the structure that holds the variables
+ *              of a Wire object. Following struct elements are used in this function:
+ *                _hostActive
+ *                _module
+ *                _timeout
+ *
+ *@return     uint8_t
+ *@retval     TWI_NO_ERR if the host engine is idle, TWI_ERR_TIMEOUT if the queue was aborted
+ */
+uint8_t TWI_MasterAsyncWait(struct twiData *_data) {
+  #if defined(TWI_TIMEOUT_ENABLE)
+    uint32_t timeout = TWI_timeoutStart();
+    struct twiTransaction *watched = _data->_hostActive;
+    size_t progress  = 0;
+  #endif
+  struct twiTransaction *xfer;
+
+  while ((xfer = _data->_hostActive) != NULL) {
+    #if defined(TWI_TIMEOUT_ENABLE)
+      volatile struct twiTransaction *active = xfer;            // updated by the TWIM interrupt
+      size_t count = active->txCount + active->rxCount;
+      if (xfer != watched) {                                    // the previous transaction has finished
+        watched  = xfer;
+        progress = count;
+        timeout  = TWI_timeoutStart();
+      } else if (progress != count) {                           // a byte was transferred
+        progress = count;
+        timeout  = TWI_timeoutProgress(_data);                  // reset timeout
+      } else if (TWI_timeoutElapsed(_data, &timeout)) {
+        MasterXfer_Abort(_data, TWI_ERR_TIMEOUT);
+        if ((_data->_module->MSTATUS & TWI_BUSSTATE_gm) == TWI_BUSSTATE_OWNER_gc) {
+          _data->_module->MCTRLB = TWI_MCMD_STOP_gc;            // Release the bus
+        }
+        MasterXfer_TimedOut(_data);
+        return TWI_ERR_TIMEOUT;
+      }
+    #endif
+  }
+  return TWI_NO_ERR;
+}
+
+
+/**
+ *@brief      MasterXfer_Abort stops the host engine and hands all queued transactions back
+ *
+ *            The host interrupts are disabled before the queue is taken, so the TWIM interrupt
+ *            does not work on it anymore. Every transaction gets the status and TWI_XFER_QUEUED
+ *            is cleared, so it can be enqueued again. onComplete is not called.
+ *
+ *@param      struct twiData *_data is a pointer to the structure that holds the variables
+ *              of a Wire object. Following struct elements are used in this function:
+ *                _hostActive
+ *                _hostXfer
+ *                _module
+ *            uint8_t status - TWI_ERR_xxx code the transactions end with
+ *
+ *@return     void
+ */
+void MasterXfer_Abort(struct twiData *_data, uint8_t status) {
+  uint8_t oldSREG = SREG;                                     // The TWIM interrupt works on the queue, too
+  cli();
+  _data->_module->MCTRLA &= ~(TWI_RIEN_bm | TWI_WIEN_bm);
+  struct twiTransaction *xfer = _data->_hostActive;
+  _data->_hostActive = NULL;
+  SREG = oldSREG;
+
+  while (xfer != NULL) {
+    struct twiTransaction *next = xfer->next;
+    xfer->status = status;
+    xfer->flags &= ~(TWI_XFER_QUEUED | TWI_XFER_BUSY);        // transaction belongs to the user again
+    #if defined(TWI_ERROR_ENABLED)
+      if (xfer == &(_data->_hostXfer)) {
+        _data->_errors = status;                              // save error flags
+      }
+    #endif
+    xfer = next;
+  }
+}
+
+
+/**
+ *@brief      TWI_MasterEnqueue appends a transaction to the queue of the interrupt driven host engine
+ *
+ *            If the host engine is idle, the transaction is started right away, otherwise it is
+ *            started from the TWIM interrupt as soon as the previous one has finished, so there
+ *            is no software gap between them. The transaction (and the buffers it points to) must
+ *            stay valid until TWI_XFER_QUEUED was cleared, which happens right before onComplete
+ *            is called. A transaction may be enqueued again from its onComplete function.
+ *            The address is written before the interrupts are enabled, as this clears a WIF
+ *            that was left set by a previous transaction without STOP.
+ *
+ *@param      struct twiData *_data is a pointer to the structure that holds the variables
+ *              of a Wire object. Following struct elements are used in this function:
+ *                _hostActive
+ *                _hostLast
+ *                _module
+ *            struct twiTransaction *xfer is the transaction to add
+ *
+ *@return     uint8_t
+ *@retval     TWI_NO_ERR if the transaction was queued, TWI_ERR_BUSY if it is still queued from
+ *              an earlier call, TWI_ERR_TENBIT for a 10-bit address, TWI_ERR_UNDEFINED if the
+ *              host is not initialized
+ */
+uint8_t TWI_MasterEnqueue(struct twiData *_data, struct twiTransaction *xfer) {
+  TWI_t *module = _data->_module;
+
+  if (xfer->flags & TWI_XFER_QUEUED) {
+    return TWI_ERR_BUSY;
+  }
+  #if defined(TWI_10BIT_ADDRESS)
+    if (TWI_isTenBit(xfer->address)) {                        // The second address byte would be missing
+      xfer->status = TWI_ERR_TENBIT;
+      return TWI_ERR_TENBIT;
+    }
+  #endif
+  if ((module->MSTATUS & TWI_BUSSTATE_gm) == TWI_BUSSTATE_UNKNOWN_gc) {
+    xfer->status = TWI_ERR_UNDEFINED;                         // If the bus was not initialized, return
+    return TWI_ERR_UNDEFINED;
+  }
+
+  xfer->next   = NULL;
+  xfer->flags |= TWI_XFER_QUEUED;
+
+  uint8_t oldSREG = SREG;                                     // The TWIM interrupt works on the queue, too
+  cli();
+  if (_data->_hostActive == NULL) {                           // Host engine is idle, start right away
+    _data->_hostActive = xfer;
+    _data->_hostLast   = xfer;
+    MasterXfer_Start(module, xfer);                           // If the bus is busy, the host waits for it to become idle
+    module->MCTRLA |= (TWI_RIEN_bm | TWI_WIEN_bm);
+  } else {
+    _data->_hostLast->next = xfer;
+    _data->_hostLast       = xfer;
+  }
+  SREG = oldSREG;
+  return TWI_NO_ERR;
+}
+
+
+/**
+ *@brief      TWI_HandleMasterIRQ is called by the TWIM interrupt and runs the host state machine
+ *
+ *            When a transaction has finished, the next one in the queue is started immediately.
+ *            If the queue is empty, the host interrupts are disabled (without a STOP, WIF/RIF stay
+ *            set until the next START). Then the finished transaction is reported: for the one of
+ *            endTransmissionAsync()/requestFromAsync() the received bytes are made available and
+ *            user_onHostComplete is called, for all others their own onComplete function.
+ *
+ *@param      struct twiData *_data is a pointer to the structure that holds the variables
+ *              of a Wire object. Following struct elements are used in this function:
+ *                _hostActive
+ *                _hostXfer
+ *                _module
+ *                _rxHead
+ *                user_onHostComplete()
+ *
+ *@return     void
+ */
+void TWI_HandleMasterIRQ(struct twiData *_data) {
+  #if defined(TWI_MERGE_BUFFERS)                              // Same Buffers for tx/rx
+    uint8_t* rxHead   = &(_data->_trHead);
+  #else                                                       // Separate tx/rx Buffers
+    uint8_t* rxHead   = &(_data->_rxHead);
+  #endif
+  TWI_t *module = _data->_module;
+  struct twiTransaction *xfer = _data->_hostActive;
+
+  if (xfer == NULL) {                                         // Should not happen, but avoid an interrupt storm
+    module->MCTRLA &= ~(TWI_RIEN_bm | TWI_WIEN_bm);
+    return;
+  }
+
+  if (MasterXfer_Step(module, xfer)) {
+    struct twiTransaction *next = xfer->next;
+    _data->_hostActive = next;
+    if (next != NULL) {
+      MasterXfer_Start(module, next);                         // back-to-back, before any user code runs
+    } else {
+      module->MCTRLA &= ~(TWI_RIEN_bm | TWI_WIEN_bm);
+    }
+    xfer->flags &= ~TWI_XFER_QUEUED;                          // transaction belongs to the user again
+
+    if (xfer == &(_data->_hostXfer)) {
+      if (xfer->rxLength != 0) {
+        (*rxHead) = (uint8_t)xfer->rxCount;                   // make the received bytes available to read()
+      }
+      #if defined(TWI_ERROR_ENABLED)
+        _data->_errors = xfer->status;                        // save error flags
+      #endif
+      if (_data->user_onHostComplete != NULL) {
+        _data->user_onHostComplete(xfer->status);
+      }
+    } else if (xfer->onComplete != NULL) {
+      xfer->onComplete(xfer);
+    }
+  }
+}
+#endif
+
+
+/**
+ *@brief      TWI_HandleSlaveIRQ checks the status register and decides the next action based on that
  *
  *            OK, so this function is a bit trickier. Apparently, the status register is not reset on
  *            every START condition so every of the 6 general states has multiple possible values. Also,
@@ -576,8 +2143,19 @@ void TWI_HandleSlaveIRQ(struct twiData *_data) {
 
   if (clientStatus & (TWI_BUSERR_bm | TWI_COLL_bm)) {  // if Bus error/Collision was detected
     _data->_module->SDATA;                            // Read data to remove Status flags
-    (*rxTail) = (*rxHead);                          // Abort
-    (*txTail) = (*txHead);                          // Abort
+    TWI_resetBuffer(rxHead, rxTail);                // Abort
+    TWI_resetBuffer(txHead, txTail);                // Abort
+    #if defined(TWI_SLAVE_DEFERRED)
+      _data->_msgReceived = 0;                      // Abort
+    #endif
+    #if defined(TWI_SMBUS_PEC)
+      _data->_pecS = 0;                             // Abort
+    #endif
+    #if defined(TWI_10BIT_ADDRESS)
+      if (_data->_slaveTenBit != TWI_TENBIT_OFF) {
+        _data->_slaveTenBit = TWI_TENBIT_IDLE;      // Abort
+      }
+    #endif
   } else {                                          // No Bus error/Collision was detected
     #if defined(TWI_MANDS)
       _data->_bools._toggleStreamFn = 0x01;
@@ -647,41 +2225,159 @@ void SlaveIRQ_AddrRead(struct twiData *_data) {
       uint8_t* txTail   = &(_data->_txTail);
     #endif
   #endif
-
-
-  (*address) = _data->_module->SDATA;         // saving address to pass to the user function
-                                              // There is no way to identify a REPSTART, so when a Master Read occurs after a host write
-  NotifyUser_onReceive(_data);                // Notify user program "onReceive" if necessary
-  #if !defined(TWI_MERGE_BUFFERS)             // if not single Buffer operation
-    (*txTail) = (*txHead);                    // reset buffer positions so the client can start writing at zero.
+
+
+  #if defined(TWI_10BIT_ADDRESS)
+    if ((_data->_slaveTenBit != TWI_TENBIT_OFF) && (_data->_slaveTenBit != TWI_TENBIT_SELECTED)) {
+      uint8_t addressByte = _data->_module->SDATA;  // a 10-bit read needs a write with the full address before,
+      (void)addressByte;                          // otherwise it is meant for another client with the same first byte
+      _data->_module->SCTRLB = TWI_ACKACT_bm | TWI_SCMD_COMPTRANS_gc;  // NACK the address and wait for any Start (S/Sr) condition
+      return;
+    }
+  #endif
+  (*address) = _data->_module->SDATA;         // saving address to pass to the user function
+  #if defined(TWI_SMBUS_PEC)
+    _data->_pecS     = TWI_pecUpdate(_data->_pecS, (*address));  // continues the CRC of a write before the REP START
+    _data->_pecSentS = 0;
+  #endif
+  #if defined(TWI_SLAVE_REGISTERS)
+    if (_data->_regs != NULL) {               // Register file, the data comes from SlaveIRQ_DataReadAck
+      _data->_module->SCTRLB = TWI_SCMD_RESPONSE_gc;
+      return;
+    }
+  #endif
+                                              // There is no way to identify a REPSTART, so when a Master Read occurs after a host write
+  #if defined(TWI_SLAVE_DEFERRED)
+    SlaveIRQ_CommitMessage(_data);            // the written bytes are one message
+  #endif
+  NotifyUser_onReceive(_data);                // Notify user program "onReceive" if necessary
+  #if !defined(TWI_MERGE_BUFFERS)             // if not single Buffer operation
+    TWI_resetBuffer(txHead, txTail);          // reset buffer positions so the client can start writing at zero.
+  #endif
+  #if defined(TWI_SLAVE_RESPONSE)
+    _data->_responsePosition = 0;             // send the response from the start
+  #endif
+  #if defined(TWI_SLAVE_ARMED)
+    if (_data->_armedReady) {                 // A new response was armed, send it from now on
+      uint8_t next = _data->_armedNext;
+      _data->_response       = _data->_armedBuffer[next];
+      _data->_responseLength = _data->_armedLength[next];
+      _data->_armedNext      = next ^ 0x01;   // the old one is free, the host is done with it
+      _data->_armedReady     = 0;
+      _data->_armedActive    = 1;
+    }
+    if (_data->_armedActive) {                // Nothing to prepare, don't keep the host waiting
+      _data->_module->SCTRLB = TWI_SCMD_RESPONSE_gc;  // "Execute Acknowledge Action succeeded by client data interrupt"
+      return;
+    }
+  #endif
+  NotifyUser_onRequest(_data);                // Notify user program "onRequest" if necessary
+  _data->_module->SCTRLB = TWI_SCMD_RESPONSE_gc;  // "Execute Acknowledge Action succeeded by client data interrupt"
+}
+
+void SlaveIRQ_AddrWrite(struct twiData *_data) {
+  #if defined(TWI_MANDS)                            // Master and Slave split
+    uint8_t*    address = &(_data->_incomingAddress);
+    #if defined(TWI_MERGE_BUFFERS)                  // Same Buffers for tx/rx
+      uint8_t* rxHead   = &(_data->_trHeadS);
+      uint8_t* rxTail   = &(_data->_trTailS);
+    #endif
+
+  #else                                             // Slave using the host buffer
+    uint8_t*    address = &(_data->_clientAddress);
+    #if defined(TWI_MERGE_BUFFERS)                  // Same Buffers for tx/rx
+      uint8_t* rxHead   = &(_data->_trHead);
+      uint8_t* rxTail   = &(_data->_trTail);
+    #endif
+  #endif
+
+
+  #if defined(TWI_SLAVE_DEFERRED)
+    SlaveIRQ_CommitMessage(_data);            // a REPSTART ends the previous message
+  #endif
+  (*address) = _data->_module->SDATA;
+  #if defined(TWI_SMBUS_PEC)
+    _data->_pecS = TWI_pecUpdate(_data->_pecS, (*address));
+  #endif
+  #if defined(TWI_10BIT_ADDRESS)
+    if (_data->_slaveTenBit != TWI_TENBIT_OFF) {
+      _data->_slaveTenBit = TWI_TENBIT_SECOND;  // The first byte only matched the two high bits
+    }
+  #endif
+  #if defined(TWI_SLAVE_REGISTERS)
+    _data->_bools._regPointerNext = 1;        // The first byte selects the register
+  #endif
+  #if defined(TWI_SLAVE_SMART)
+    _data->_bools._refuseData = 0;            // The SCTRLB write below sets ACKACT to ACK again
+  #endif
+  #if defined(TWI_SLAVE_DEFERRED)
+    if (!SlaveIRQ_StartMessage(_data, (*address))) {  // No room, the main loop has to read a message first
+      _data->_module->SCTRLB = TWI_ACKACT_bm | TWI_SCMD_COMPTRANS_gc;  // NACK the address and wait for any Start (S/Sr) condition
+      return;
+    }
+  #endif
+  #if defined(TWI_MERGE_BUFFERS)              // if single Buffer operation
+    TWI_resetBuffer(rxHead, rxTail);          // reset buffer positions so the host can start writing at zero.
   #endif
-  NotifyUser_onRequest(_data);                // Notify user program "onRequest" if necessary
-  _data->_module->SCTRLB = TWI_SCMD_RESPONSE_gc;  // "Execute Acknowledge Action succeeded by client data interrupt"
+  _data->_module->SCTRLB = TWI_SCMD_RESPONSE_gc;  // "Execute Acknowledge Action succeeded by reception of next byte"
 }
 
-void SlaveIRQ_AddrWrite(struct twiData *_data) {
+#if defined(TWI_SMBUS_PEC)
+/**
+ *@brief      SlaveIRQ_CheckPEC checks the PEC at the end of a host write and removes it from the receive buffer
+ *
+ *            The CRC over the address, the data and the PEC is 0 if they match. Otherwise the
+ *            whole write is dismissed. After a host read there is nothing to check, the host does that.
+ *
+ *@param      struct twiData *_data is a pointer to the structure that holds the variables
+ *              of a Wire object. Following struct elements are used in this function:
+ *                _pecModes
+ *                _pecS
+ *                _incomingAddress/_clientAddress
+ *                _rxHead(S)
+ *                _rxTail(S)
+ *
+ *@return     bool
+ *@retval     true if onReceive can be called
+ */
+static bool SlaveIRQ_CheckPEC(struct twiData *_data) {
   #if defined(TWI_MANDS)                            // Master and Slave split
-    uint8_t*    address = &(_data->_incomingAddress);
+    uint8_t     address = _data->_incomingAddress;
     #if defined(TWI_MERGE_BUFFERS)                  // Same Buffers for tx/rx
       uint8_t* rxHead   = &(_data->_trHeadS);
       uint8_t* rxTail   = &(_data->_trTailS);
+    #else                                           // Separate tx/rx Buffers
+      uint8_t* rxHead   = &(_data->_rxHeadS);
+      uint8_t* rxTail   = &(_data->_rxTailS);
     #endif
+    const uint8_t rxLength = TWI_RX_LENGTH_S(_data);
 
   #else                                             // Slave using the host buffer
-    uint8_t*    address = &(_data->_clientAddress);
+    uint8_t     address = _data->_clientAddress;
     #if defined(TWI_MERGE_BUFFERS)                  // Same Buffers for tx/rx
       uint8_t* rxHead   = &(_data->_trHead);
       uint8_t* rxTail   = &(_data->_trTail);
+    #else                                           // Separate tx/rx Buffers
+      uint8_t* rxHead   = &(_data->_rxHead);
+      uint8_t* rxTail   = &(_data->_rxTail);
     #endif
+    const uint8_t rxLength = TWI_RX_LENGTH(_data);
   #endif
 
-
-  (*address) = _data->_module->SDATA;
-  #if defined(TWI_MERGE_BUFFERS)              // if single Buffer operation
-    (*rxTail) = (*rxHead);                    // reset buffer positions so the host can start writing at zero.
-  #endif
-  _data->_module->SCTRLB = TWI_SCMD_RESPONSE_gc;  // "Execute Acknowledge Action succeeded by reception of next byte"
+  uint8_t pec  = _data->_pecS;
+  _data->_pecS = 0;                                 // the next START begins a new CRC
+  if (!(_data->_pecModes & TWI_PEC_CLIENT) || (address & 0x01) || ((*rxHead) == (*rxTail))) {
+    return true;                                    // not used, a host read or nothing received
+  }
+  if (pec != 0) {
+    TWI_resetBuffer(rxHead, rxTail);                // Dismiss the write, the data can't be trusted
+    return false;
+  }
+  (*rxHead) = ((*rxHead) == 0) ? (rxLength - 1) : ((*rxHead) - 1);  // remove the PEC byte
+  return true;
 }
+#endif
+
 
 void SlaveIRQ_Stop(struct twiData *_data) {
   #if defined(TWI_MANDS)                            // Master and Slave split
@@ -689,8 +2385,8 @@ void SlaveIRQ_Stop(struct twiData *_data) {
       uint8_t* rxHead   = &(_data->_trHeadS);
       uint8_t* rxTail   = &(_data->_trTailS);
     #else                                           // Separate tx/rx Buffers
-      uint8_t* rxHead   = &(_data->_txHeadS);
-      uint8_t* rxTail   = &(_data->_txTailS);
+      uint8_t* rxHead   = &(_data->_rxHeadS);
+      uint8_t* rxTail   = &(_data->_rxTailS);
     #endif
 
   #else                                             // Slave using the host buffer
@@ -698,17 +2394,87 @@ void SlaveIRQ_Stop(struct twiData *_data) {
       uint8_t* rxHead   = &(_data->_trHead);
       uint8_t* rxTail   = &(_data->_trTail);
     #else                                           // Separate tx/rx Buffers
-      uint8_t* rxHead   = &(_data->_txHead);
-      uint8_t* rxTail   = &(_data->_txTail);
+      uint8_t* rxHead   = &(_data->_rxHead);
+      uint8_t* rxTail   = &(_data->_rxTail);
     #endif
   #endif
 
 
   _data->_module->SSTATUS = TWI_APIF_bm;      // Clear Flag, no further action needed
+  #if defined(TWI_10BIT_ADDRESS)
+    if (_data->_slaveTenBit != TWI_TENBIT_OFF) {
+      _data->_slaveTenBit = TWI_TENBIT_IDLE;  // A STOP deselects the client
+    }
+  #endif
+  #if defined(TWI_SLAVE_DEFERRED)
+    SlaveIRQ_CommitMessage(_data);            // hand the message over to the main loop
+  #endif
+  #if defined(TWI_SLAVE_REGISTERS)
+    if (_data->_regs != NULL) {               // Register file, nothing to notify
+      return;
+    }
+  #endif
+  #if defined(TWI_SMBUS_PEC)
+    if (!SlaveIRQ_CheckPEC(_data)) {          // Message was dismissed
+      return;
+    }
+  #endif
   NotifyUser_onReceive(_data);                // Notify user program "onReceive" if necessary
-  (*rxTail) = (*rxHead);                      // User should have handled all data, if not, set available rxBytes to 0
+  TWI_resetBuffer(rxHead, rxTail);            // User should have handled all data, if not, set available rxBytes to 0
+}
+
+/**
+ *@brief      SlaveIRQ_Accept acknowledges the byte SlaveIRQ_DataWrite has read from SDATA
+ *
+ *            In smart mode, the hardware did that when SDATA was read.
+ */
+__attribute__((always_inline)) static inline void SlaveIRQ_Accept(struct twiData *_data) {
+  #if defined(TWI_SLAVE_SMART)
+    (void)_data;
+  #else
+    _data->_module->SCTRLB = TWI_SCMD_RESPONSE_gc;  // "Execute Acknowledge Action succeeded by reception of next byte"
+  #endif
+}
+
+
+/**
+ *@brief      SlaveIRQ_Refuse NACKs the byte SlaveIRQ_DataWrite has read from SDATA
+ *
+ *            In smart mode, the byte was already ACKed when SDATA was read. The next one is
+ *            NACKed instead and dropped by SlaveIRQ_DataWrite, so the host stops one byte later.
+ */
+__attribute__((always_inline)) static inline void SlaveIRQ_Refuse(struct twiData *_data) {
+  #if defined(TWI_SLAVE_SMART)
+    _data->_module->SCTRLB = TWI_ACKACT_bm;         // NACK with the next SDATA read
+    _data->_bools._refuseData = 1;
+  #else
+    _data->_module->SCTRLB = TWI_ACKACT_bm | TWI_SCMD_COMPTRANS_gc;  // "Execute ACK Action succeeded by waiting for any Start (S/Sr) condition"
+  #endif
+}
+
+
+/**
+ *@brief      SlaveIRQ_SendPEC sends the PEC once the data for a host read has run out
+ *
+ *@return     bool
+ *@retval     true if the PEC was sent, false if the client has nothing more to send
+ */
+__attribute__((always_inline)) static inline bool SlaveIRQ_SendPEC(struct twiData *_data) {
+  #if defined(TWI_SMBUS_PEC)
+    if ((_data->_pecModes & TWI_PEC_CLIENT) && !_data->_pecSentS) {
+      _data->_pecSentS = 1;
+      _data->_module->SDATA = _data->_pecS;
+      #if !defined(TWI_SLAVE_SMART)                     // in smart mode, writing SDATA did it
+        _data->_module->SCTRLB = TWI_SCMD_RESPONSE_gc;  // "Execute a byte read operation followed by Acknowledge Action"
+      #endif
+      return true;
+    }
+  #endif
+  (void)_data;
+  return false;
 }
 
+
 void SlaveIRQ_DataReadNack(struct twiData *_data) {
   #if defined(TWI_MANDS)                            // Master and Slave split
     #if defined(TWI_MERGE_BUFFERS)                  // Same Buffers for tx/rx
@@ -732,7 +2498,7 @@ void SlaveIRQ_DataReadNack(struct twiData *_data) {
 
   _data->_bools._ackMatters = false;                        // stop checking for NACK
   _data->_module->SCTRLB = TWI_SCMD_COMPTRANS_gc;   // "Wait for any Start (S/Sr) condition"
-  (*txTail) = (*txHead);                            // Abort further data writes
+  TWI_resetBuffer(txHead, txTail);                  // Abort further data writes
 }
 
 void SlaveIRQ_DataReadAck(struct twiData *_data) {
@@ -746,6 +2512,7 @@ void SlaveIRQ_DataReadAck(struct twiData *_data) {
       uint8_t* txTail   = &(_data->_txTailS);
       uint8_t* txBuffer =   _data->_txBufferS;
     #endif
+    const uint8_t txLength = TWI_TX_LENGTH_S(_data);
 
   #else                                             // Slave using the host buffer
     #if defined(TWI_MERGE_BUFFERS)                  // Same Buffers for tx/rx
@@ -757,16 +2524,54 @@ void SlaveIRQ_DataReadAck(struct twiData *_data) {
       uint8_t* txTail   = &(_data->_txTail);
       uint8_t* txBuffer =   _data->_txBuffer;
     #endif
+    const uint8_t txLength = TWI_TX_LENGTH(_data);
   #endif
 
 
   _data->_bools._ackMatters = true;         // start checking for NACK
+  #if defined(TWI_SLAVE_REGISTERS)
+    if (_data->_regs != NULL) {             // Register file: stream from the register pointer
+      uint8_t pointer = _data->_regsPointer;
+      _data->_module->SDATA = _data->_regs[pointer];
+      if (++pointer >= _data->_regsSize) {
+        pointer = 0;                          // wrap around after the last register
+      }
+      _data->_regsPointer = pointer;
+      #if !defined(TWI_SLAVE_SMART)           // in smart mode, writing SDATA did it
+        _data->_module->SCTRLB = TWI_SCMD_RESPONSE_gc;  // "Execute a byte read operation followed by Acknowledge Action"
+      #endif
+      return;
+    }
+  #endif
+  #if defined(TWI_SLAVE_RESPONSE)
+    if (_data->_response != NULL) {         // Send from the user memory, the transmit buffer is not used
+      size_t position = _data->_responsePosition;
+      if (position < _data->_responseLength) {
+        _data->_module->SDATA = _data->_response[position];
+        _data->_responsePosition = position + 1;
+        #if defined(TWI_SMBUS_PEC)
+          _data->_pecS = TWI_pecUpdate(_data->_pecS, _data->_response[position]);
+        #endif
+        #if !defined(TWI_SLAVE_SMART)         // in smart mode, writing SDATA did it
+          _data->_module->SCTRLB = TWI_SCMD_RESPONSE_gc;  // "Execute a byte read operation followed by Acknowledge Action"
+        #endif
+      } else if (!SlaveIRQ_SendPEC(_data)) {            // No more data available
+        _data->_module->SCTRLB = TWI_SCMD_COMPTRANS_gc; // "Wait for any Start (S/Sr) condition"
+      }
+      return;
+    }
+  #endif
   if ((*txHead) != (*txTail)) {             // Data is available
     _data->_module->SDATA = txBuffer[(*txTail)];      // Writing to the register to send data
-    (*txTail) = TWI_advancePosition(*txTail);         // Advance tail
-    _data->_module->SCTRLB = TWI_SCMD_RESPONSE_gc;    // "Execute a byte read operation followed by Acknowledge Action"
+    #if defined(TWI_SMBUS_PEC)
+      _data->_pecS = TWI_pecUpdate(_data->_pecS, txBuffer[(*txTail)]);
+    #endif
+    (*txTail) = TWI_advancePosition(*txTail, txLength);   // Advance tail
+    #if !defined(TWI_SLAVE_SMART)                       // in smart mode, writing SDATA did it
+      _data->_module->SCTRLB = TWI_SCMD_RESPONSE_gc;    // "Execute a byte read operation followed by Acknowledge Action"
+    #endif
 
-  } else {                                            // No more data available
+  } else if (!SlaveIRQ_SendPEC(_data)) {              // No more data available
     _data->_module->SCTRLB = TWI_SCMD_COMPTRANS_gc;   // "Wait for any Start (S/Sr) condition"
   }
 }
@@ -782,6 +2587,7 @@ void SlaveIRQ_DataWrite(struct twiData *_data) {
       uint8_t* rxTail   = &(_data->_rxTailS);
       uint8_t* rxBuffer =   _data->_rxBufferS;
     #endif
+    const uint8_t rxLength = TWI_RX_LENGTH_S(_data);
 
   #else                                             // Slave using the host buffer
     #if defined(TWI_MERGE_BUFFERS)                  // Same Buffers for tx/rx
@@ -793,22 +2599,405 @@ void SlaveIRQ_DataWrite(struct twiData *_data) {
       uint8_t* rxTail   = &(_data->_rxTail);
       uint8_t* rxBuffer =   _data->_rxBuffer;
     #endif
+    const uint8_t rxLength = TWI_RX_LENGTH(_data);
+  #endif
+
+
+  #if defined(TWI_SLAVE_SMART)
+    if (_data->_bools._refuseData) {              // The hardware NACKs this byte, drop it
+      uint8_t dropped = _data->_module->SDATA;
+      (void)dropped;
+      return;
+    }
+  #endif
+
+  #if defined(TWI_10BIT_ADDRESS)
+    if (_data->_slaveTenBit == TWI_TENBIT_SECOND) {  // The second address byte, not data
+      uint8_t addressLow = _data->_module->SDATA;
+      if (addressLow == _data->_slaveAddressLow) {
+        _data->_slaveTenBit = TWI_TENBIT_SELECTED;
+        #if defined(TWI_SMBUS_PEC)
+          _data->_pecS = TWI_pecUpdate(_data->_pecS, addressLow);
+        #endif
+        _data->_module->SCTRLB = TWI_SCMD_RESPONSE_gc;  // "Execute Acknowledge Action succeeded by reception of next byte"
+      } else {                                    // Another client with the same first byte
+        _data->_slaveTenBit = TWI_TENBIT_IDLE;
+        _data->_module->SCTRLB = TWI_ACKACT_bm | TWI_SCMD_COMPTRANS_gc;  // "Execute ACK Action succeeded by waiting for any Start (S/Sr) condition"
+      }
+      return;
+    }
+  #endif
+
+  #if defined(TWI_SLAVE_REGISTERS)
+    if (_data->_regs != NULL) {                   // Register file
+      uint8_t payload = _data->_module->SDATA;
+      uint8_t pointer = _data->_regsPointer;
+      if (_data->_bools._regPointerNext) {        // First byte: register pointer
+        _data->_bools._regPointerNext = 0;
+        pointer = payload;
+        if (pointer >= _data->_regsSize) {        // No such register
+          SlaveIRQ_Refuse(_data);
+          return;
+        }
+      } else {                                    // Following bytes: register contents
+        uint8_t protect = (_data->_regsProtect != NULL) ? _data->_regsProtect[pointer] : 0x00;
+        _data->_regs[pointer] = (_data->_regs[pointer] & protect) | (payload & ~protect);
+        if (++pointer >= _data->_regsSize) {
+          pointer = 0;                            // wrap around after the last register
+        }
+      }
+      _data->_regsPointer = pointer;
+      SlaveIRQ_Accept(_data);
+      return;
+    }
   #endif
 
+  #if defined(TWI_SLAVE_DEFERRED)
+    if (SlaveIRQ_StoreMessageByte(_data, _data->_module->SDATA)) {
+      SlaveIRQ_Accept(_data);
+    } else {                                      // Message doesn't fit and was dismissed
+      SlaveIRQ_Refuse(_data);
+    }
+    return;
+  #endif
 
-  uint8_t payload = _data->_module->SDATA;
-  uint8_t nextHead = TWI_advancePosition(*rxHead);
+  uint8_t nextHead = TWI_advancePosition(*rxHead, rxLength);
 
-  if (nextHead == (*rxTail)) {                  // if buffer is full
+  if (TWI_bufferFull(nextHead, (*rxTail), rxLength)) {  // if buffer is full, checked before SDATA is read because that ACKs in smart mode
     _data->_module->SCTRLB = TWI_ACKACT_bm | TWI_SCMD_COMPTRANS_gc;  // "Execute ACK Action succeeded by waiting for any Start (S/Sr) condition"
-    (*rxTail) = (*rxHead);                                           // Dismiss all received Data since data integrity can't be guaranteed
+    TWI_resetBuffer(rxHead, rxTail);                                 // Dismiss all received Data since data integrity can't be guaranteed
 
   } else {                                      // if buffer is not full
-    rxBuffer[(*rxHead)] = payload;                  // Load data into the buffer
+    rxBuffer[(*rxHead)] = _data->_module->SDATA;    // Load data into the buffer
+    #if defined(TWI_SMBUS_PEC)
+      _data->_pecS = TWI_pecUpdate(_data->_pecS, rxBuffer[(*rxHead)]);
+    #endif
     (*rxHead) = nextHead;                           // Advance Head
-    _data->_module->SCTRLB = TWI_SCMD_RESPONSE_gc;  // "Execute Acknowledge Action succeeded by reception of next byte"
+    SlaveIRQ_Accept(_data);                         // "Execute Acknowledge Action succeeded by reception of next byte"
+  }
+}
+
+#if defined(TWI_SLAVE_QUEUE)
+/**
+ *@brief      MessageQueue_advance returns the position in _msgQueue count bytes after pos
+ */
+__attribute__((always_inline)) static inline uint8_t MessageQueue_advance(uint8_t pos, uint8_t count) {
+  uint16_t next = (uint16_t)pos + count;
+  if (next >= TWI_SLAVE_QUEUE_LENGTH) {
+    next -= TWI_SLAVE_QUEUE_LENGTH;
+  }
+  return (uint8_t)next;
+}
+
+
+/**
+ *@brief      MessageQueue_used returns the number of bytes between the oldest message and pos
+ */
+__attribute__((always_inline)) static inline uint8_t MessageQueue_used(struct twiData *_data, uint8_t pos) {
+  uint8_t tail = _data->_msgTail;
+  if (pos >= tail) {
+    return pos - tail;
+  }
+  return TWI_SLAVE_QUEUE_LENGTH - tail + pos;
+}
+
+
+/**
+ *@brief      SlaveIRQ_StartMessage prepares for a message on a host write
+ *
+ *            The queue is a ring buffer, every message starts with its length and the address
+ *            it was sent to. One byte always stays free, so a full queue can be told apart from
+ *            an empty one.
+ *
+ *@param      struct twiData *_data is a pointer to the structure that holds the variables
+ *              of a Wire object. Following struct elements are used in this function:
+ *                _msgHead
+ *                _msgWrite
+ *                _msgTail
+ *                _msgQueue
+ *            uint8_t address is the address the client reacted to
+ *
+ *@return     bool
+ *@retval     true if there is room for the header and at least one byte
+ */
+bool SlaveIRQ_StartMessage(struct twiData *_data, uint8_t address) {
+  uint8_t head = _data->_msgHead;
+  if (MessageQueue_used(_data, head) + 3 > TWI_SLAVE_QUEUE_LENGTH - 1) {
+    return false;
+  }
+  uint8_t pos = MessageQueue_advance(head, 1);
+  _data->_msgQueue[pos] = address;
+  _data->_msgWrite = MessageQueue_advance(pos, 1);
+  return true;
+}
+
+
+/**
+ *@brief      SlaveIRQ_StoreMessageByte adds a byte to the message that is being received
+ *
+ *@param      struct twiData *_data is a pointer to the structure that holds the variables
+ *              of a Wire object. Following struct elements are used in this function:
+ *                _msgReceived
+ *                _msgWrite
+ *                _msgTail
+ *                _msgQueue
+ *            uint8_t payload is the received byte
+ *
+ *@return     bool
+ *@retval     false if the queue is full, the message is dismissed then
+ */
+bool SlaveIRQ_StoreMessageByte(struct twiData *_data, uint8_t payload) {
+  uint8_t write    = _data->_msgWrite;
+  uint8_t received = _data->_msgReceived;
+  if ((received == 0xFF) || (MessageQueue_used(_data, write) >= TWI_SLAVE_QUEUE_LENGTH - 1)) {
+    _data->_msgReceived = 0;
+    return false;
+  }
+  _data->_msgQueue[write] = payload;
+  _data->_msgWrite    = MessageQueue_advance(write, 1);
+  _data->_msgReceived = received + 1;
+  return true;
+}
+
+
+/**
+ *@brief      SlaveIRQ_CommitMessage hands the received bytes over to the main loop
+ *
+ *            Called on a STOP or a REPSTART. The length is written in front of the message,
+ *            the next one starts right after it.
+ *
+ *@param      struct twiData *_data is a pointer to the structure that holds the variables
+ *              of a Wire object. Following struct elements are used in this function:
+ *                _msgReceived
+ *                _msgHead
+ *                _msgWrite
+ *                _msgCount
+ *                _msgQueue
+ *
+ *@return     void
+ */
+void SlaveIRQ_CommitMessage(struct twiData *_data) {
+  uint8_t received = _data->_msgReceived;
+  if (received > 0) {
+    _data->_msgQueue[_data->_msgHead] = received;
+    _data->_msgHead     = _data->_msgWrite;
+    _data->_msgReceived = 0;
+    _data->_msgCount++;
+  }
+}
+
+
+/**
+ *@brief      TWI_SlaveMessageAvailable returns the length of the oldest received message
+ *
+ *@param      struct twiData *_data is a pointer to the structure that holds the variables
+ *              of a Wire object. Following struct elements are used in this function:
+ *                _msgCount
+ *                _msgTail
+ *                _msgQueue
+ *
+ *@return     uint8_t
+ *@retval     length of the message, 0 if there is none
+ */
+uint8_t TWI_SlaveMessageAvailable(struct twiData *_data) {
+  if (_data->_msgCount == 0) {
+    return 0;
+  }
+  return _data->_msgQueue[_data->_msgTail];
+}
+
+
+/**
+ *@brief      TWI_SlaveReadMessage copies the oldest received message and removes it from the queue
+ *
+ *            The interrupt only writes behind the complete messages, so the copy is done with
+ *            interrupts enabled and the client keeps receiving meanwhile.
+ *
+ *@param      struct twiData *_data is a pointer to the structure that holds the variables
+ *              of a Wire object. Following struct elements are used in this function:
+ *                _msgCount
+ *                _msgTail
+ *                _msgQueue
+ *            uint8_t *buffer is where the message is copied to, NULL dismisses it
+ *            uint8_t size is the size of buffer, the rest of a longer message is dismissed
+ *            uint8_t *address receives the left-shifted address the message was sent to, can be NULL
+ *
+ *@return     uint8_t
+ *@retval     number of bytes copied, 0 if there was no message
+ */
+uint8_t TWI_SlaveReadMessage(struct twiData *_data, uint8_t *buffer, uint8_t size, uint8_t *address) {
+  if (_data->_msgCount == 0) {
+    return 0;
+  }
+  uint8_t tail   = _data->_msgTail;
+  uint8_t length = _data->_msgQueue[tail];
+  uint8_t pos    = MessageQueue_advance(tail, 1);
+  if (address != NULL) {
+    (*address) = _data->_msgQueue[pos];
+  }
+  pos = MessageQueue_advance(pos, 1);
+  uint8_t copied = (length > size) ? size : length;
+  if (buffer != NULL) {
+    for (uint8_t i = 0; i < copied; i++) {
+      buffer[i] = _data->_msgQueue[pos];
+      pos = MessageQueue_advance(pos, 1);
+    }
+  }
+  _data->_msgTail = MessageQueue_advance(tail, length + 2);   // frees the space for the interrupt
+
+  uint8_t oldSREG = SREG;                     // The client interrupt increases it
+  cli();
+  _data->_msgCount--;
+  SREG = oldSREG;
+  return copied;
+}
+
+#elif defined(TWI_SLAVE_DEFERRED)
+/**
+ *@brief      SlaveIRQ_StartMessage prepares for a message on a host write
+ *
+ *@param      struct twiData *_data is a pointer to the structure that holds the variables
+ *              of a Wire object. Following struct elements are used in this function:
+ *                _msgHead
+ *                _msgCount
+ *                _msgAddress
+ *            uint8_t address is the address the client reacted to
+ *
+ *@return     bool
+ *@retval     true if there is a free buffer
+ */
+bool SlaveIRQ_StartMessage(struct twiData *_data, uint8_t address) {
+  if (_data->_msgCount >= TWI_SLAVE_MESSAGES) {
+    return false;
+  }
+  _data->_msgAddress[_data->_msgHead] = address;
+  return true;
+}
+
+
+/**
+ *@brief      SlaveIRQ_StoreMessageByte adds a byte to the message that is being received
+ *
+ *@param      struct twiData *_data is a pointer to the structure that holds the variables
+ *              of a Wire object. Following struct elements are used in this function:
+ *                _msgReceived
+ *                _msgHead
+ *                _msgBuffer
+ *            uint8_t payload is the received byte
+ *
+ *@return     bool
+ *@retval     false if the buffer is full, the message is dismissed then
+ */
+bool SlaveIRQ_StoreMessageByte(struct twiData *_data, uint8_t payload) {
+  uint8_t received = _data->_msgReceived;
+  if (received >= TWI_SLAVE_MESSAGE_LENGTH) {
+    _data->_msgReceived = 0;                  // data integrity can't be guaranteed
+    return false;
+  }
+  _data->_msgBuffer[_data->_msgHead][received] = payload;
+  _data->_msgReceived = received + 1;
+  return true;
+}
+
+
+/**
+ *@brief      SlaveIRQ_CommitMessage hands the received bytes over to the main loop
+ *
+ *            Called on a STOP or a REPSTART. The buffer becomes the newest message and the
+ *            client receives into the next one. SlaveIRQ_StartMessage made sure that it is free.
+ *
+ *@param      struct twiData *_data is a pointer to the structure that holds the variables
+ *              of a Wire object. Following struct elements are used in this function:
+ *                _msgReceived
+ *                _msgHead
+ *                _msgCount
+ *                _msgLength
+ *
+ *@return     void
+ */
+void SlaveIRQ_CommitMessage(struct twiData *_data) {
+  uint8_t received = _data->_msgReceived;
+  if (received > 0) {
+    uint8_t head = _data->_msgHead;
+    _data->_msgLength[head] = received;
+    if (++head >= TWI_SLAVE_MESSAGES) {
+      head = 0;
+    }
+    _data->_msgHead     = head;
+    _data->_msgReceived = 0;
+    _data->_msgCount++;
+  }
+}
+
+
+/**
+ *@brief      TWI_SlaveMessageAvailable returns the length of the oldest received message
+ *
+ *@param      struct twiData *_data is a pointer to the structure that holds the variables
+ *              of a Wire object. Following struct elements are used in this function:
+ *                _msgCount
+ *                _msgTail
+ *                _msgLength
+ *
+ *@return     uint8_t
+ *@retval     length of the message, 0 if there is none
+ */
+uint8_t TWI_SlaveMessageAvailable(struct twiData *_data) {
+  if (_data->_msgCount == 0) {
+    return 0;
+  }
+  return _data->_msgLength[_data->_msgTail];
+}
+
+
+/**
+ *@brief      TWI_SlaveReadMessage copies the oldest received message and frees its buffer
+ *
+ *            The interrupt only writes to buffers that don't hold a message, so the copy is
+ *            done with interrupts enabled and the client keeps receiving meanwhile.
+ *
+ *@param      struct twiData *_data is a pointer to the structure that holds the variables
+ *              of a Wire object. Following struct elements are used in this function:
+ *                _msgCount
+ *                _msgTail
+ *                _msgLength
+ *                _msgAddress
+ *                _msgBuffer
+ *            uint8_t *buffer is where the message is copied to, NULL dismisses it
+ *            uint8_t size is the size of buffer, the rest of a longer message is dismissed
+ *            uint8_t *address receives the left-shifted address the message was sent to, can be NULL
+ *
+ *@return     uint8_t
+ *@retval     number of bytes copied, 0 if there was no message
+ */
+uint8_t TWI_SlaveReadMessage(struct twiData *_data, uint8_t *buffer, uint8_t size, uint8_t *address) {
+  if (_data->_msgCount == 0) {
+    return 0;
+  }
+  uint8_t tail   = _data->_msgTail;
+  uint8_t length = _data->_msgLength[tail];
+  if (length > size) {
+    length = size;
   }
+  if (address != NULL) {
+    (*address) = _data->_msgAddress[tail];
+  }
+  if (buffer != NULL) {
+    memcpy(buffer, _data->_msgBuffer[tail], length);
+  }
+  if (++tail >= TWI_SLAVE_MESSAGES) {
+    tail = 0;
+  }
+  _data->_msgTail = tail;
+
+  uint8_t oldSREG = SREG;                     // The client interrupt increases it
+  cli();
+  _data->_msgCount--;
+  SREG = oldSREG;
+  return length;
 }
+#endif
+
 
 /**
  *@brief      NotifyUser_onRequest is called from the TWI_HandleSlaveIRQ function on host READ
@@ -857,33 +3046,3 @@ void NotifyUser_onReceive(struct twiData *_data) {
   }
 }
 
-
-/**
- *@brief      TWI_advancePosition increments the given number if it smaller then the BUFFER_LENGTH value
- *
- *            When using round-robin buffers, it is important to reset at 0 when the position reaches
- *            the end of a buffer. This is done with this inline function.
- *            Because the AVR Dx chips were using a buffer of 130. I was not able to use the trick with
- *            the bitwise AND on Buffers that are a power of 2. To reduce the space usage on the smaller
- *            chips, I decided to add a #define based check to use the bitwise AND. To avoid duplicates of
- *            this part of the code, I wrote an extra function for that. It also increases readability.
- *
- *
- *@param      uint8_t pos is the number to be incremented/set to zero
- *
- *@return     uint8_t
- *@retval     the incremented number or zero.
- */
-uint8_t TWI_advancePosition(uint8_t pos) {
-  uint8_t nextPos = (pos + 1);
-  #if defined(BUFFER_NOT_POWER_2)
-    if (nextPos > (BUFFER_LENGTH - 1)) nextPos = 0;  // round-robin-ing
-  #else
-    nextPos &= (BUFFER_LENGTH - 1);
-  #endif
-
-  return nextPos;
-}
-
-
-
@@ -41,6 +41,20 @@ SOFTWARE.
   #define DEFAULT_FREQUENCY 100000
 #endif
 
+/* Rise time of SCL in ns, it depends on the pull-ups and the capacitance of the bus and makes
+ * every clock a bit longer. setClock() without a rise time uses these, depending on the speed.
+ */
+#define TWI_RISE_TIME_AUTO  0xFFFF
+#ifndef TWI_RISE_TIME_SM
+  #define TWI_RISE_TIME_SM   500    // up to 100kHz
+#endif
+#ifndef TWI_RISE_TIME_FM
+  #define TWI_RISE_TIME_FM   250    // up to 400kHz
+#endif
+#ifndef TWI_RISE_TIME_FMP
+  #define TWI_RISE_TIME_FMP  120    // Fast mode plus, with stronger pull-ups
+#endif
+
 /* These options are or will be controlled by boards.txt menu options
 #define USING_WIRE1       // On devices with two TWIs, this identifies if the user wants to use Wire1
 #define TWI_MANDS         // This enables the simultaneous use of the Master and Slave functionality - where supported
@@ -81,15 +95,187 @@ SOFTWARE.
     #define BUFFER_LENGTH 32   /* and 32k tinyAVR   - 3-5% of available RAM                   */
   #else                        /* >=4k: Dx32/m320x (4k) m480x (6k),  Dx64 (8k) Dx128 (16k)    */
     #define BUFFER_LENGTH 130  /* 130 - 128b on all Dx with >= 4k RAM, to match official      */
-    #define BUFFER_NOT_POWER_2
   #endif                       /* 4809 core plus that couple bytes mentioned above.           */
 #endif
 
+/* Every buffer can be sized on its own, e.g. with -DTWI_RX_BUFFER_LENGTH=4. If not defined, they
+ * get BUFFER_LENGTH. The _S lengths are for the client buffers with TWI_MANDS, without TWI_MANDS the
+ * client uses the host buffers. Lengths that are a power of 2 use a bitwise AND for the ring
+ * arithmetic, all others a compare. The positions are uint8_t, so 255 is the maximum.
+ */
+#ifndef TWI_TX_BUFFER_LENGTH
+  #define TWI_TX_BUFFER_LENGTH    BUFFER_LENGTH
+#endif
+#ifndef TWI_RX_BUFFER_LENGTH
+  #define TWI_RX_BUFFER_LENGTH    BUFFER_LENGTH
+#endif
+#ifndef TWI_TX_BUFFER_LENGTH_S
+  #define TWI_TX_BUFFER_LENGTH_S  BUFFER_LENGTH
+#endif
+#ifndef TWI_RX_BUFFER_LENGTH_S
+  #define TWI_RX_BUFFER_LENGTH_S  BUFFER_LENGTH
+#endif
+
+#if (TWI_TX_BUFFER_LENGTH   < 2) || (TWI_TX_BUFFER_LENGTH   > 255) || (TWI_RX_BUFFER_LENGTH   < 2) || (TWI_RX_BUFFER_LENGTH   > 255) || \
+    (TWI_TX_BUFFER_LENGTH_S < 2) || (TWI_TX_BUFFER_LENGTH_S > 255) || (TWI_RX_BUFFER_LENGTH_S < 2) || (TWI_RX_BUFFER_LENGTH_S > 255)
+  #error "The TWI buffer lengths have to be between 2 and 255."
+#endif
+#if defined(TWI_MERGE_BUFFERS) && ((TWI_TX_BUFFER_LENGTH != TWI_RX_BUFFER_LENGTH) || (TWI_TX_BUFFER_LENGTH_S != TWI_RX_BUFFER_LENGTH_S))
+  #error "With TWI_MERGE_BUFFERS, tx and rx share one buffer, so their lengths have to be the same."
+#endif
+
+/* The lengths above are the ones of Wire. With USING_WIRE1, the buffers of Wire1 can be sized on
+ * their own with the TWI1_ lengths, e.g. -DTWI1_RX_BUFFER_LENGTH_S=4, they default to the ones of Wire.
+ * If any of them differ, TWI_INSTANCE_BUFFERS is defined: the buffers are no longer part of struct
+ * twiData, Wire.cpp allocates them for each object and struct twiData points to them. Only the
+ * lengths that differ are read from struct twiData, the others stay constants.
+ */
+#if defined(USING_WIRE1)
+  #ifndef TWI1_TX_BUFFER_LENGTH
+    #define TWI1_TX_BUFFER_LENGTH    TWI_TX_BUFFER_LENGTH
+  #endif
+  #ifndef TWI1_RX_BUFFER_LENGTH
+    #define TWI1_RX_BUFFER_LENGTH    TWI_RX_BUFFER_LENGTH
+  #endif
+  #ifndef TWI1_TX_BUFFER_LENGTH_S
+    #define TWI1_TX_BUFFER_LENGTH_S  TWI_TX_BUFFER_LENGTH_S
+  #endif
+  #ifndef TWI1_RX_BUFFER_LENGTH_S
+    #define TWI1_RX_BUFFER_LENGTH_S  TWI_RX_BUFFER_LENGTH_S
+  #endif
+
+  #if (TWI1_TX_BUFFER_LENGTH   < 2) || (TWI1_TX_BUFFER_LENGTH   > 255) || (TWI1_RX_BUFFER_LENGTH   < 2) || (TWI1_RX_BUFFER_LENGTH   > 255) || \
+      (TWI1_TX_BUFFER_LENGTH_S < 2) || (TWI1_TX_BUFFER_LENGTH_S > 255) || (TWI1_RX_BUFFER_LENGTH_S < 2) || (TWI1_RX_BUFFER_LENGTH_S > 255)
+    #error "The TWI1 buffer lengths have to be between 2 and 255."
+  #endif
+  #if defined(TWI_MERGE_BUFFERS) && ((TWI1_TX_BUFFER_LENGTH != TWI1_RX_BUFFER_LENGTH) || (TWI1_TX_BUFFER_LENGTH_S != TWI1_RX_BUFFER_LENGTH_S))
+    #error "With TWI_MERGE_BUFFERS, tx and rx share one buffer, so the TWI1 lengths have to be the same."
+  #endif
+
+  #if (TWI1_TX_BUFFER_LENGTH != TWI_TX_BUFFER_LENGTH) || (TWI1_RX_BUFFER_LENGTH != TWI_RX_BUFFER_LENGTH) || \
+      (defined(TWI_MANDS) && ((TWI1_TX_BUFFER_LENGTH_S != TWI_TX_BUFFER_LENGTH_S) || (TWI1_RX_BUFFER_LENGTH_S != TWI_RX_BUFFER_LENGTH_S)))
+    #define TWI_INSTANCE_BUFFERS
+  #endif
+#endif
+
+/* TWI_TX_LENGTH() and the like return the length of a buffer of the given struct twiData. */
+#if defined(TWI_INSTANCE_BUFFERS) && (TWI1_TX_BUFFER_LENGTH != TWI_TX_BUFFER_LENGTH)
+  #define TWI_TX_LENGTH(_data)    ((_data)->_txLength)
+#else
+  #define TWI_TX_LENGTH(_data)    (TWI_TX_BUFFER_LENGTH)
+#endif
+#if defined(TWI_INSTANCE_BUFFERS) && (TWI1_RX_BUFFER_LENGTH != TWI_RX_BUFFER_LENGTH)
+  #define TWI_RX_LENGTH(_data)    ((_data)->_rxLength)
+#else
+  #define TWI_RX_LENGTH(_data)    (TWI_RX_BUFFER_LENGTH)
+#endif
+#if defined(TWI_INSTANCE_BUFFERS) && defined(TWI_MANDS) && (TWI1_TX_BUFFER_LENGTH_S != TWI_TX_BUFFER_LENGTH_S)
+  #define TWI_TX_LENGTH_S(_data)  ((_data)->_txLengthS)
+#else
+  #define TWI_TX_LENGTH_S(_data)  (TWI_TX_BUFFER_LENGTH_S)
+#endif
+#if defined(TWI_INSTANCE_BUFFERS) && defined(TWI_MANDS) && (TWI1_RX_BUFFER_LENGTH_S != TWI_RX_BUFFER_LENGTH_S)
+  #define TWI_RX_LENGTH_S(_data)  ((_data)->_rxLengthS)
+#else
+  #define TWI_RX_LENGTH_S(_data)  (TWI_RX_BUFFER_LENGTH_S)
+#endif
+
+/* With TWI_SLAVE_ARMED, armSlaveResponse() copies into one of two buffers of TWI_SLAVE_ARMED_LENGTH,
+ * the client sends from the other one.
+ */
+#if defined(TWI_SLAVE_ARMED)
+  #ifndef TWI_SLAVE_RESPONSE
+    #define TWI_SLAVE_RESPONSE      // The armed buffer is sent like the one of setSlaveResponse()
+  #endif
+  #ifndef TWI_SLAVE_ARMED_LENGTH
+    #define TWI_SLAVE_ARMED_LENGTH  TWI_TX_BUFFER_LENGTH_S
+  #endif
+  #if (TWI_SLAVE_ARMED_LENGTH < 1) || (TWI_SLAVE_ARMED_LENGTH > 255)
+    #error "TWI_SLAVE_ARMED_LENGTH has to be between 1 and 255."
+  #endif
+#endif
+
+/* With TWI_SLAVE_DEFERRED, the client receives into one of TWI_SLAVE_MESSAGES buffers of
+ * TWI_SLAVE_MESSAGE_LENGTH each, the receive buffer of the client is not used then.
+ * TWI_SLAVE_QUEUE stores the messages one after another in TWI_SLAVE_QUEUE_LENGTH bytes instead,
+ * each one takes 2 bytes more than its length. That fits more short messages into the same RAM.
+ */
+#if defined(TWI_SLAVE_QUEUE)
+  #ifndef TWI_SLAVE_DEFERRED
+    #define TWI_SLAVE_DEFERRED      // Same interface, only the storage is different
+  #endif
+  #ifndef TWI_SLAVE_QUEUE_LENGTH
+    #if (2 * TWI_RX_BUFFER_LENGTH_S > 255)
+      #define TWI_SLAVE_QUEUE_LENGTH  255
+    #else
+      #define TWI_SLAVE_QUEUE_LENGTH  (2 * TWI_RX_BUFFER_LENGTH_S)
+    #endif
+  #endif
+  #if (TWI_SLAVE_QUEUE_LENGTH < 4) || (TWI_SLAVE_QUEUE_LENGTH > 255)
+    #error "TWI_SLAVE_QUEUE_LENGTH has to be between 4 and 255."
+  #endif
+#elif defined(TWI_SLAVE_DEFERRED)
+  #ifndef TWI_SLAVE_MESSAGES
+    #define TWI_SLAVE_MESSAGES        2
+  #endif
+  #ifndef TWI_SLAVE_MESSAGE_LENGTH
+    #define TWI_SLAVE_MESSAGE_LENGTH  TWI_RX_BUFFER_LENGTH_S
+  #endif
+  #if (TWI_SLAVE_MESSAGES < 2) || (TWI_SLAVE_MESSAGES > 255) || (TWI_SLAVE_MESSAGE_LENGTH < 1) || (TWI_SLAVE_MESSAGE_LENGTH > 255)
+    #error "TWI_SLAVE_MESSAGES has to be between 2 and 255, TWI_SLAVE_MESSAGE_LENGTH between 1 and 255."
+  #endif
+#endif
+
 
 #define TWI_TIMEOUT_ENABLE    // Enabled by default, might be disabled for debugging or other reasons
+// #define TWI_TIMEOUT_SETTINGS  // setWireTimeout() and setBusRecovery(), costs 7 bytes of RAM per Wire object. Otherwise the timeout is fixed to TWI_TIMEOUT_DEFAULT
+
+#if defined(TWI_TIMEOUT_SETTINGS) && !defined(TWI_TIMEOUT_ENABLE)
+  #error "TWI_TIMEOUT_SETTINGS needs TWI_TIMEOUT_ENABLE."
+#endif
+
+#if !defined(TWI_TIMEOUT_DEFAULT)
+  #define TWI_TIMEOUT_DEFAULT 25000 // us without progress on the bus until a host transaction is abandoned, see setWireTimeout()
+#endif
+
+#if !defined(TWI_SCAN_BUDGET_BITS)
+  #define TWI_SCAN_BUDGET_BITS 40   // bit times one probe of scan() may take, START, address and ACK are 10 of them
+#endif
 
 // #define TWI_ERROR_ENABLED
 
+// #define TWI_GET_CLOCK      // getClock() reports the SCL frequency, needs 2 bytes of RAM per Wire object for the rise time of setClock()
+
+// #define TWI_MASTER_ASYNC   // Interrupt driven host engine on the TWIM vector, needed for endTransmissionAsync()/requestFromAsync()
+
+// #define TWI_LINEAR_BUFFERS // Buffers are filled from 0 and reset on every transaction instead of wrapping around
+
+// #define TWI_RETRY_ENABLE   // endTransmission()/requestFrom() retry on the errors selected with setRetry()
+
+// #define TWI_MASTER_SMART     // The host uses the smart mode, reading MDATA acknowledges a received byte
+// #define TWI_SLAVE_SMART      // The client uses the smart mode, reading or writing SDATA acknowledges a data byte
+
+// #define TWI_SLAVE_REGISTERS  // The client can serve a register file from the interrupt, see setSlaveRegisters()
+
+// #define TWI_SLAVE_RESPONSE   // The client can send straight from user memory, see setSlaveResponse()
+// #define TWI_SLAVE_ARMED      // The client sends a response prepared ahead of time, without onRequest, see armSlaveResponse()
+
+// #define TWI_SLAVE_DEFERRED   // The client stores whole messages for the main loop instead of calling onReceive, see readSlaveMessage()
+// #define TWI_SLAVE_QUEUE      // Like TWI_SLAVE_DEFERRED, but the messages are queued in one buffer
+
+// #define TWI_SMBUS_PEC        // SMBus Packet Error Checking, the CRC-8 is appended and verified byte by byte, see setPEC()
+// #define TWI_SMBUS_BLOCK      // SMBus block read, block write and block process call, see blockRead()
+
+// #define TWI_10BIT_ADDRESS    // 10-bit addresses for the host and the client, see beginTransmission10() and begin10()
+
+#if defined(TWI_10BIT_ADDRESS) && defined(TWI_SLAVE_SMART)
+  #error "A client with a 10-bit address has to check the second address byte before it is acknowledged, this doesn't work with TWI_SLAVE_SMART."
+#endif
+
+#if defined(TWI_SMBUS_PEC) && (defined(TWI_SLAVE_REGISTERS) || defined(TWI_SLAVE_DEFERRED))
+  #error "TWI_SMBUS_PEC only checks what the client receives into its buffer, not with TWI_SLAVE_REGISTERS or TWI_SLAVE_DEFERRED."
+#endif
+
 // The error result may not be accurate, it just helps narrowing the problem down
 #define  TWI_NO_ERR            0      // Default
 #define  TWI_ERR_PULLUP        1  // Likely problem with pull-ups
@@ -99,6 +285,10 @@ SOFTWARE.
 #define  TWI_ERR_RXACK         5  // Address or data was NACKed
 #define  TWI_ERR_CLKHLD        6  // Something's holding the clock
 #define  TWI_ERR_UNDEFINED     7  // Software can't tell error source
+#define  TWI_ERR_BUSY          8  // Host engine is still busy with the previous transaction
+#define  TWI_ERR_PEC           9  // The PEC did not match the data, or the client NACKed it
+#define  TWI_ERR_ABORTED      10  // The host was disabled before the transaction had finished
+#define  TWI_ERR_TENBIT       11  // The transaction engine only sends one address byte, no 10-bit address
 
 #if defined(TWI_ERROR_ENABLED)
   #define TWI_ERROR_VAR   twi_error
@@ -118,13 +308,58 @@ SOFTWARE.
 
 
 struct twiDataBools {       // using a struct so the compiler can use skip if bit is set/cleared
-  uint8_t _reserved:      4;
+  bool _refuseData:       1;  // with TWI_SLAVE_SMART, the client NACKs and drops the next byte, see SlaveIRQ_Refuse()
+  bool _regPointerNext:   1;  // the next byte the host writes is the register pointer, see TWI_SlaveSetRegisters()
+  bool _timeoutFlag:      1;  // a host transaction timed out, cleared by clearWireTimeoutFlag()
+  bool _timeoutReset:     1;  // reset the host when a transaction timed out
   bool _toggleStreamFn:   1;  // used to toggle between Slave and Master elements when TWI_MANDS defined
   bool _hostEnabled:      1;
   bool _clientEnabled:    1;
   bool _ackMatters:       1;
 };
 
+/* Errors that can be retried, see TWI_MasterSetRetry() */
+#define  TWI_RETRY_ARBLOST     0x01  // Arbitration lost or bus error, another host was using the bus
+#define  TWI_RETRY_NACK        0x02  // The address was NACKed, e.g. by an EEPROM that is busy writing
+#define  TWI_RETRY_TIMEOUT     0x04  // The timeout of setWireTimeout() ran out
+
+/* Where the PEC is used, see TWI_SetPEC() */
+#define  TWI_PEC_HOST          0x01  // endTransmission() appends it, requestFrom() reads and checks it
+#define  TWI_PEC_CLIENT        0x02  // onReceive only gets checked messages, the PEC follows what onRequest wrote
+
+/* States of a client with a 10-bit address, see TWI_HandleSlaveIRQ() */
+#define  TWI_TENBIT_OFF        0  // The client has a 7-bit address
+#define  TWI_TENBIT_IDLE       1  // Not addressed, a host read is NACKed
+#define  TWI_TENBIT_SECOND     2  // The first address byte (11110xx) matched, the next byte written decides
+#define  TWI_TENBIT_SELECTED   3  // Addressed, also a host read with REP START that follows
+
+/* Flags of a twiTransaction */
+#define  TWI_XFER_STOP         0x01  // Terminate the transaction with a STOP, otherwise the bus is kept for a REP START
+#define  TWI_XFER_QUEUED       0x20  // Internal: transaction is owned by the host engine until it has finished
+#define  TWI_XFER_READING      0x40  // Internal: the read address was sent, host engine is in the read phase
+#define  TWI_XFER_BUSY         0x80  // Internal: transaction is on the bus
+
+/* A transaction is what the host engine works on: first the txLength bytes of txBuffer are
+ * written, then, if rxLength is not zero, a REP START is issued and rxLength bytes are read into
+ * rxBuffer. If both lengths are zero, only the address is sent (write direction).
+ * txCount and rxCount hold the progress and are valid after the transaction has finished.
+ * With TWI_MASTER_ASYNC, transactions can be queued. They are linked with next and processed
+ * one after another from the TWIM interrupt, onComplete is called after each one of them.
+ */
+struct twiTransaction {
+  struct twiTransaction *next;
+  void (*onComplete)(struct twiTransaction *);
+  const uint8_t *txBuffer;
+  uint8_t *rxBuffer;
+  size_t   txLength;
+  size_t   rxLength;
+  size_t   txCount;
+  size_t   rxCount;
+  uint8_t  address;          // left-shifted client address, the R/W bit is added by the host engine
+  volatile uint8_t flags;    // TWI_XFER_xxx
+  volatile uint8_t status;   // TWI_NO_ERR or one of the TWI_ERR_xxx codes
+};
+
 /* My original idea was to pass the whole TwoWire class as a  */
 /* Pointer to this functions but this didn't work of course.  */
 /* But I had the idea: since the class is basically just a    */
@@ -136,12 +371,75 @@ struct twiData {
   TWI_t *_module;
 
   struct twiDataBools _bools;      // the structure to hold the bools for the class
+  #if defined(TWI_GET_CLOCK)
+    uint16_t _riseTime;            // in ns, of the last setClock(), see TWI_MasterGetClock()
+  #endif
 
   #if defined(TWI_ERROR_ENABLED)
     uint8_t _errors;
   #endif
 
+  #if defined(TWI_TIMEOUT_SETTINGS)
+    uint32_t _timeout;             // in us, 0 disables the timeout
+    uint8_t  _recoverAfter;        // consecutive timeouts until the bus is recovered, 0 disables it
+    uint8_t  _failures;            // consecutive timeouts so far
+    uint8_t  _busTimeout;          // MCTRLA.TIMEOUT, disabled until setWireTimeout() selects one
+  #endif
+
+  #if defined(TWI_RETRY_ENABLE)
+    uint8_t  _retryAttempts;       // attempts of a host transaction, 0 or 1 means no retry
+    uint8_t  _retryErrors;         // TWI_RETRY_xxx
+    uint16_t _retryBackoff;        // in us before the first retry, doubled for every further one
+  #endif
+
+  #if defined(TWI_SMBUS_PEC)
+    uint8_t  _pecModes;            // TWI_PEC_xxx
+    uint8_t  _pec;                 // CRC of the host so far, a read after a write without STOP continues it
+    uint8_t  _pecS;                // CRC of the client since the last START
+    uint8_t  _pecSentS;            // 1 when the client has sent its PEC
+  #endif
+
+  #if defined(TWI_SLAVE_REGISTERS)
+    uint8_t       *_regs;          // register file of the client, NULL when the buffers and callbacks are used
+    const uint8_t *_regsProtect;   // bits of every register the host can't write, NULL if all are writable
+    uint8_t        _regsSize;
+    uint8_t        _regsPointer;   // register the host reads or writes next
+  #endif
+
+  #if defined(TWI_SLAVE_RESPONSE)
+    const uint8_t *_response;        // what the client sends on a host read, NULL when the transmit buffer is used
+    size_t         _responseLength;
+    size_t         _responsePosition; // next byte of _response, starts at 0 on every host read
+  #endif
+
+  #if defined(TWI_SLAVE_ARMED)
+    volatile uint8_t _armedReady;    // 1 when _armedBuffer[_armedNext] holds a new response
+    uint8_t          _armedNext;     // buffer armSlaveResponse() fills, the client sends from the other one
+    uint8_t          _armedActive;   // 1 while an armed response is sent, onRequest is not called then
+    uint8_t          _armedLength[2];
+  #endif
+
+  #if defined(TWI_SLAVE_QUEUE)
+    uint8_t          _msgReceived;   // bytes of the message the client is receiving
+    uint8_t          _msgHead;       // length byte of that message in _msgQueue, followed by the address and the data
+    uint8_t          _msgWrite;      // where its next byte goes
+    uint8_t          _msgTail;       // length byte of the oldest complete message
+    volatile uint8_t _msgCount;      // complete messages, increased by the interrupt, decreased by TWI_SlaveReadMessage
+  #elif defined(TWI_SLAVE_DEFERRED)
+    uint8_t          _msgReceived;   // bytes of the message the client is receiving into _msgBuffer[_msgHead]
+    uint8_t          _msgHead;
+    uint8_t          _msgTail;       // oldest complete message
+    volatile uint8_t _msgCount;      // complete messages, increased by the interrupt, decreased by TWI_SlaveReadMessage
+    uint8_t          _msgLength[TWI_SLAVE_MESSAGES];
+    uint8_t          _msgAddress[TWI_SLAVE_MESSAGES];
+  #endif
+
   uint8_t _clientAddress;
+  #if defined(TWI_10BIT_ADDRESS)
+    uint8_t _clientAddressLow;     // second address byte if _clientAddress is 11110xx0, see TWI_isTenBit()
+    uint8_t _slaveAddressLow;      // second byte of the own address of a client with a 10-bit address
+    uint8_t _slaveTenBit;          // TWI_TENBIT_xxx
+  #endif
   #if defined(TWI_MERGE_BUFFERS)
     uint8_t _trHead;
     uint8_t _trTail;
@@ -168,25 +466,231 @@ struct twiData {
   void (*user_onRequest)(void);
   void (*user_onReceive)(int);
 
-  #if defined(TWI_MERGE_BUFFERS)
-    uint8_t _trBuffer[BUFFER_LENGTH];
-  #else
-    uint8_t _txBuffer[BUFFER_LENGTH];
-    uint8_t _rxBuffer[BUFFER_LENGTH];
+  #if defined(TWI_MASTER_ASYNC)
+    struct twiTransaction *volatile _hostActive;   // Transaction the host engine is working on, NULL when idle
+    struct twiTransaction *_hostLast;               // End of the queue, only valid if _hostActive is not NULL
+    struct twiTransaction  _hostXfer;               // Transaction used by endTransmissionAsync()/requestFromAsync()
+    void (*user_onHostComplete)(uint8_t);
   #endif
 
-  #if defined(TWI_MANDS)
+  #if defined(TWI_INSTANCE_BUFFERS)              // Wire and Wire1 differ, the buffers are in Wire.cpp
+    #if defined(TWI_MERGE_BUFFERS)
+      uint8_t *_trBuffer;
+    #else
+      uint8_t *_txBuffer;
+      uint8_t *_rxBuffer;
+    #endif
+    #if defined(TWI_MANDS)
+      #if defined(TWI_MERGE_BUFFERS)
+        uint8_t *_trBufferS;
+      #else
+        uint8_t *_txBufferS;
+        uint8_t *_rxBufferS;
+      #endif
+    #endif
+    #if (TWI1_TX_BUFFER_LENGTH != TWI_TX_BUFFER_LENGTH)
+      uint8_t _txLength;                          // see TWI_TX_LENGTH()
+    #endif
+    #if (TWI1_RX_BUFFER_LENGTH != TWI_RX_BUFFER_LENGTH)
+      uint8_t _rxLength;
+    #endif
+    #if defined(TWI_MANDS) && (TWI1_TX_BUFFER_LENGTH_S != TWI_TX_BUFFER_LENGTH_S)
+      uint8_t _txLengthS;
+    #endif
+    #if defined(TWI_MANDS) && (TWI1_RX_BUFFER_LENGTH_S != TWI_RX_BUFFER_LENGTH_S)
+      uint8_t _rxLengthS;
+    #endif
+  #else
     #if defined(TWI_MERGE_BUFFERS)
-      uint8_t _trBufferS[BUFFER_LENGTH];
+      uint8_t _trBuffer[TWI_TX_BUFFER_LENGTH];
     #else
-      uint8_t _txBufferS[BUFFER_LENGTH];
-      uint8_t _rxBufferS[BUFFER_LENGTH];
+      uint8_t _txBuffer[TWI_TX_BUFFER_LENGTH];
+      uint8_t _rxBuffer[TWI_RX_BUFFER_LENGTH];
     #endif
+
+    #if defined(TWI_MANDS)
+      #if defined(TWI_MERGE_BUFFERS)
+        uint8_t _trBufferS[TWI_TX_BUFFER_LENGTH_S];
+      #else
+        uint8_t _txBufferS[TWI_TX_BUFFER_LENGTH_S];
+        uint8_t _rxBufferS[TWI_RX_BUFFER_LENGTH_S];
+      #endif
+    #endif
+  #endif
+
+  #if defined(TWI_SLAVE_ARMED)
+    uint8_t _armedBuffer[2][TWI_SLAVE_ARMED_LENGTH];
+  #endif
+
+  #if defined(TWI_SLAVE_QUEUE)
+    uint8_t _msgQueue[TWI_SLAVE_QUEUE_LENGTH];
+  #elif defined(TWI_SLAVE_DEFERRED)
+    uint8_t _msgBuffer[TWI_SLAVE_MESSAGES][TWI_SLAVE_MESSAGE_LENGTH];
   #endif
 };
 
 
-uint8_t  TWI_advancePosition(uint8_t pos);  // returns the next Position with Round-Robin functionality
+#if defined(TWI_LINEAR_BUFFERS)
+/**
+ *@brief      TWI_advancePosition increments the given position
+ *
+ *            With TWI_LINEAR_BUFFERS the buffers do not wrap around. Every transaction
+ *            starts at 0 (see TWI_resetBuffer), so the head only has to be checked against
+ *            the length when a byte is added (see TWI_bufferFull).
+ */
+__attribute__((always_inline)) static inline uint8_t TWI_advancePosition(uint8_t pos, uint8_t length) {
+  (void)length;
+  return (pos + 1);
+}
+
+
+/**
+ *@brief      TWI_usedBytes returns the amount of bytes between tail and head of a buffer
+ */
+__attribute__((always_inline)) static inline uint8_t TWI_usedBytes(uint8_t head, uint8_t tail, uint8_t length) {
+  (void)length;
+  return (head - tail);
+}
+
+
+/**
+ *@brief      TWI_bufferFull returns true if the next head position would not fit the buffer anymore
+ *
+ *            With a length of 255, the head after the last byte wraps around to 0, so the
+ *            position of the byte to be added (nextHead - 1) is compared instead.
+ */
+__attribute__((always_inline)) static inline bool TWI_bufferFull(uint8_t nextHead, uint8_t tail, uint8_t length) {
+  (void)tail;
+  return ((uint8_t)(nextHead - 1) >= length);
+}
+
+
+/**
+ *@brief      TWI_resetBuffer dismisses all data in a buffer and starts again at 0
+ */
+__attribute__((always_inline)) static inline void TWI_resetBuffer(uint8_t *head, uint8_t *tail) {
+  (*head) = 0;
+  (*tail) = 0;
+}
+
+#else
+/**
+ *@brief      TWI_advancePosition increments the given position and wraps around at the end of the buffer
+ *
+ *            It is inlined, so the length is usually a constant and a power of 2 turns into a bitwise AND.
+ *            The length is only not known at compile time, if TWI_MANDS is used and the host
+ *            and client buffers differ in size, or if Wire and Wire1 differ (see TWI_TX_LENGTH()),
+ *            then it falls back to a compare.
+ */
+__attribute__((always_inline)) static inline uint8_t TWI_advancePosition(uint8_t pos, uint8_t length) {
+  uint8_t nextPos = (pos + 1);
+  if (__builtin_constant_p(length) && ((length & (length - 1)) == 0)) {
+    return (nextPos & (length - 1));
+  }
+  if (nextPos >= length) {
+    nextPos = 0;                  // round-robin-ing
+  }
+  return nextPos;
+}
+
+
+/**
+ *@brief      TWI_usedBytes returns the amount of bytes between tail and head of a buffer
+ */
+__attribute__((always_inline)) static inline uint8_t TWI_usedBytes(uint8_t head, uint8_t tail, uint8_t length) {
+  uint8_t num = (head - tail);
+  if (__builtin_constant_p(length) && ((length & (length - 1)) == 0)) {
+    return (num & (length - 1));
+  }
+  if (head < tail) {
+    num += length;
+  }
+  return num;
+}
+
+
+/**
+ *@brief      TWI_bufferFull returns true if the head would run into the tail, one byte always stays free
+ */
+__attribute__((always_inline)) static inline bool TWI_bufferFull(uint8_t nextHead, uint8_t tail, uint8_t length) {
+  (void)length;
+  return (nextHead == tail);
+}
+
+
+/**
+ *@brief      TWI_resetBuffer dismisses all data in a buffer
+ */
+__attribute__((always_inline)) static inline void TWI_resetBuffer(uint8_t *head, uint8_t *tail) {
+  (*tail) = (*head);
+}
+#endif
+
+#if defined(TWI_10BIT_ADDRESS)
+/**
+ *@brief      TWI_isTenBit returns true if the (left-shifted) address byte is the first byte of a 10-bit address
+ *
+ *            The I2C specification reserves 11110xx for it, the xx are the two MSB of the address.
+ */
+__attribute__((always_inline)) static inline bool TWI_isTenBit(uint8_t address) {
+  return ((address & 0xF8) == 0xF0);
+}
+#endif
+
+/**
+ *@brief      TWI_riseTime returns the rise time in ns setClock() calculates with
+ */
+__attribute__((always_inline)) static inline uint16_t TWI_riseTime(uint32_t frequency, uint16_t riseTime) {
+  if (riseTime != TWI_RISE_TIME_AUTO) {
+    return riseTime;
+  } else if (frequency <= 100000) {
+    return TWI_RISE_TIME_SM;
+  } else if (frequency <= 400000) {
+    return TWI_RISE_TIME_FM;
+  }
+  return TWI_RISE_TIME_FMP;
+}
+
+/* The rise time in 1/64 CPU cycles, without overflow up to 48MHz and 65535ns */
+__attribute__((always_inline)) static inline uint32_t TWI_riseCycles64(uint32_t fcpu, uint16_t riseTime) {
+  return ((fcpu / 10000UL) * riseTime * 8UL) / 12500UL;
+}
+
+/**
+ *@brief      TWI_baudFor calculates the MBAUD value for a SCL frequency
+ *
+ *            f_SCL = F_CPU / (10 + 2 * BAUD + F_CPU * t_rise) of the data sheet, solved for BAUD and
+ *            rounded up: the result is the fastest clock that is not faster than requested.
+ *            With constant arguments, the compiler folds all of it, see TwoWire::setClock().
+ *
+ *@param      uint32_t fcpu - the CPU clock in Hz, up to 64MHz
+ *            uint32_t frequency - the desired SCL frequency in Hz
+ *            uint16_t riseTime - the rise time of SCL in ns
+ *
+ *@return     uint8_t
+ *@retval     the MBAUD value, limited to 1 - 255
+ */
+__attribute__((always_inline)) static inline uint8_t TWI_baudFor(uint32_t fcpu, uint32_t frequency, uint16_t riseTime) {
+  if (frequency == 0) {
+    return 255;
+  }
+  int32_t cycles = (int32_t)((fcpu * 64UL + frequency - 1) / frequency)   // what 2 * BAUD has to cover, in 1/64 cycles
+                 - 640 - (int32_t)TWI_riseCycles64(fcpu, riseTime);
+  if (cycles <= 128) {
+    return 1;
+  } else if (cycles > 255L * 128) {
+    return 255;
+  }
+  return (uint8_t)((cycles + 127) / 128);
+}
+
+/**
+ *@brief      TWI_clockFor calculates the SCL frequency in Hz a MBAUD value results in, rounded
+ */
+__attribute__((always_inline)) static inline uint32_t TWI_clockFor(uint32_t fcpu, uint8_t baud, uint16_t riseTime) {
+  uint32_t period = 640UL + 128UL * baud + TWI_riseCycles64(fcpu, riseTime);   // in 1/64 cycles
+  return (fcpu * 64UL + period / 2) / period;
+}
 
 void     TWI_MasterInit(struct        twiData *_data);
 void     TWI_SlaveInit(struct      twiData *_data, uint8_t address, uint8_t receive_broadcast, uint8_t second_address);
@@ -194,12 +698,52 @@ void     TWI_Flush(struct           twiData *_data);
 void     TWI_Disable(struct         twiData *_data);
 void     TWI_DisableMaster(struct     twiData *_data);
 void     TWI_DisableSlave(struct   twiData *_data);
-void     TWI_MasterSetBaud(struct     twiData *_data, uint32_t frequency);
+#if defined(TWI_SLAVE_REGISTERS)
+  void   TWI_SlaveSetRegisters(struct twiData *_data, uint8_t *regs, uint8_t size, const uint8_t *protect);
+#endif
+#if defined(TWI_SLAVE_RESPONSE)
+  void   TWI_SlaveSetResponse(struct  twiData *_data, const uint8_t *buffer, size_t length);
+#endif
+#if defined(TWI_SLAVE_ARMED)
+  uint8_t  TWI_SlaveArmResponse(struct  twiData *_data, const uint8_t *buffer, uint8_t length);
+#endif
+#if defined(TWI_SLAVE_DEFERRED)
+  uint8_t  TWI_SlaveMessageAvailable(struct twiData *_data);
+  uint8_t  TWI_SlaveReadMessage(struct      twiData *_data, uint8_t *buffer, uint8_t size, uint8_t *address);
+#endif
+void     TWI_MasterSetBaud(struct     twiData *_data, uint32_t frequency, uint16_t riseTime);
+void     TWI_MasterWriteBaud(struct   twiData *_data, uint8_t baud, bool fastModePlus, uint16_t riseTime);
+#if defined(TWI_GET_CLOCK)
+  uint32_t TWI_MasterGetClock(struct  twiData *_data);
+#endif
+#if defined(TWI_TIMEOUT_SETTINGS)
+  void   TWI_MasterSetTimeout(struct  twiData *_data, uint32_t timeout, bool reset_with_timeout);
+#endif
+bool     TWI_MasterRecoverBus(struct  twiData *_data);
+#if defined(TWI_RETRY_ENABLE)
+  void   TWI_MasterSetRetry(struct    twiData *_data, uint8_t attempts, uint16_t backoff, uint8_t errors);
+#endif
+#if defined(TWI_SMBUS_PEC)
+  void     TWI_SetPEC(struct          twiData *_data, uint8_t modes);
+#endif
 uint8_t  TWI_Available(struct       twiData *_data);
 uint8_t  TWI_MasterWrite(struct       twiData *_data, bool send_stop);
 uint8_t  TWI_MasterRead(struct        twiData *_data, uint8_t bytesToRead, bool send_stop);
+#if defined(TWI_SMBUS_BLOCK)
+  uint8_t  TWI_MasterReadBlock(struct twiData *_data, uint8_t maxBytes);
+#endif
+uint8_t  TWI_MasterWriteRead(struct   twiData *_data, uint8_t bytesToRead, bool send_stop);
 void     TWI_HandleSlaveIRQ(struct twiData *_data);
-
-// uint8_t  TWI_MasterCalcBaud(uint32_t frequency);  // moved to twi_pins.h due to license incompatibilities
+uint8_t  TWI_MasterTransfer(struct    twiData *_data, struct twiTransaction *xfer);
+uint8_t  TWI_MasterScan(struct        twiData *_data, uint8_t *map, uint8_t first, uint8_t last);
+
+#if defined(TWI_MASTER_ASYNC)
+  uint8_t  TWI_MasterWriteAsync(struct  twiData *_data, bool send_stop);
+  uint8_t  TWI_MasterReadAsync(struct   twiData *_data, uint8_t bytesToRead, bool send_stop);
+  bool     TWI_MasterAsyncBusy(struct   twiData *_data);
+  uint8_t  TWI_MasterAsyncWait(struct   twiData *_data);
+  uint8_t  TWI_MasterEnqueue(struct     twiData *_data, struct twiTransaction *xfer);
+  void     TWI_HandleMasterIRQ(struct   twiData *_data);
+#endif
 
 #endif
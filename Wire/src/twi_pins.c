@@ -32,63 +32,9 @@
 #include "twi_pins.h"
 
 bool TWI_checkPins(const uint8_t sda_pin, const uint8_t scl_pin);
+bool TWI_RecoverPins(PORT_t *port, uint8_t sda_bm, uint8_t scl_bm);
 
 
-/**
- *@brief              TWI_MasterCalcBaud calculates the baud for the desired frequency
- *
- *                    Moved temporarily to twi_pins.h due to licensing reasons
- *                    Can be moved back into twi.c on merge to the DxCore and license adjustment
- *
- *@param              uint32_t frequency is the desired frequency
- *
- *@return             uint8_t
- *@retval             the desired baud value
- */
-#define TWI_BAUD(freq, t_rise) ((F_CPU / freq) / 2) - (5 + (((F_CPU / 1000000) * t_rise) / 2000))
-uint8_t TWI_MasterCalcBaud(uint32_t frequency) {
-  uint16_t t_rise;
-  int16_t baud;
-
-  // The nonlinearity of the frequency coupled with the processor frequency a general offset has been calculated and tested for different frequency bands
-  #if F_CPU > 16000000
-    if (frequency <= 100000) {
-      t_rise = 1000;
-      baud = TWI_BAUD(frequency, t_rise) + 6;  // Offset +6
-    } else if (frequency <= 400000) {
-      t_rise = 300;
-      baud = TWI_BAUD(frequency, t_rise) + 1;  // Offset +1
-    } else if (frequency <= 800000) {
-      t_rise = 120;
-      baud = TWI_BAUD(frequency, t_rise);
-    } else {
-      t_rise = 120;
-      baud = TWI_BAUD(frequency, t_rise) - 1;  // Offset -1
-    }
-  #else
-    if (frequency <= 100000) {
-      t_rise = 1000;
-      baud = TWI_BAUD(frequency, t_rise) + 8;  // Offset +8
-    } else if (frequency <= 400000) {
-      t_rise = 300;
-      baud = TWI_BAUD(frequency, t_rise) + 1;  // Offset +1
-    } else if (frequency <= 800000) {
-      t_rise = 120;
-      baud = TWI_BAUD(frequency, t_rise);
-    } else {
-      t_rise = 120;
-      baud = TWI_BAUD(frequency, t_rise) - 1;  // Offset -1
-    }
-  #endif
-
-  if (baud < 1) {
-    baud = 1;
-  } else if (baud > 255) {
-    baud = 255;
-  }
-  return (uint8_t)baud;
-}
-
 bool TWI_checkPins(const uint8_t sda_pin, const uint8_t scl_pin) {
   if (__builtin_constant_p(sda_pin) && __builtin_constant_p(scl_pin)) {
     if (!(
@@ -125,6 +71,53 @@ bool TWI_checkPins(const uint8_t sda_pin, const uint8_t scl_pin) {
   return true;
 }
 
+/**
+ *@brief              TWI_RecoverPins frees a bus that is held by a client, using the host pins as GPIO
+ *
+ *                    A client that lost some clocks (brownout, reset of the host in the middle of a
+ *                    read) keeps SDA low until it has shifted out the rest of its byte. SCL is clocked
+ *                    until SDA is released, at most 9 times (8 bits and the ACK), then a STOP is
+ *                    generated so the client is back in the idle state.
+ *                    The pins only ever drive low, like the TWI: the OUT bits are 0 and DIR switches
+ *                    between low and released. The TWI has to be disabled while this runs.
+ *
+ *@param              PORT_t *port is the port of SDA and SCL
+ *                    uint8_t sda_bm is the bit mask of SDA
+ *                    uint8_t scl_bm is the bit mask of SCL
+ *
+ *@return             bool
+ *@retval             true if SDA and SCL are high afterwards
+ */
+bool TWI_RecoverPins(PORT_t *port, uint8_t sda_bm, uint8_t scl_bm) {
+  port->OUTCLR = sda_bm | scl_bm;
+  port->DIRCLR = sda_bm | scl_bm;           // released, the pull-ups take the lines high
+
+  for (uint8_t clocks = 0; clocks < 9; clocks++) {
+    if (port->IN & sda_bm) {                // SDA was released, the client is waiting for a START or STOP
+      break;
+    }
+    port->DIRSET = scl_bm;                  // SCL low
+    delayMicroseconds(5);                   // 100kHz, slow enough for every client
+    port->DIRCLR = scl_bm;                  // SCL high, unless the client stretches it
+    for (uint8_t wait = 0; !(port->IN & scl_bm) && (wait < 200); wait++) {
+      delayMicroseconds(5);
+    }
+    delayMicroseconds(5);
+  }
+
+  port->DIRSET = scl_bm;                    // STOP: SDA goes low while SCL is low...
+  delayMicroseconds(5);
+  port->DIRSET = sda_bm;
+  delayMicroseconds(5);
+  port->DIRCLR = scl_bm;                    // ...and high while SCL is high
+  delayMicroseconds(5);
+  port->DIRCLR = sda_bm;
+  delayMicroseconds(5);
+
+  return ((port->IN & (sda_bm | scl_bm)) == (sda_bm | scl_bm));
+}
+
+
 void TWI0_ClearPins() {
   #ifdef PORTMUX_TWIROUTEA
     if ((PORTMUX.TWIROUTEA & PORTMUX_TWI0_gm) == PORTMUX_TWI0_ALT2_gc) {
@@ -161,6 +154,40 @@ void TWI0_ClearPins() {
 }
 
 
+/**
+ *@brief              TWI0_RecoverBus runs TWI_RecoverPins on the host pins that are selected for TWI0
+ *
+ *@return             bool
+ *@retval             true if SDA and SCL are high afterwards
+ */
+bool TWI0_RecoverBus() {
+  #ifdef PORTMUX_TWIROUTEA
+    #if defined(PORTMUX_TWI0_ALT3_gc)
+      if ((PORTMUX.TWIROUTEA & PORTMUX_TWI0_gm) == PORTMUX_TWI0_ALT3_gc) {
+        return TWI_RecoverPins(&PORTA, 0x01, 0x02);  // SDA PA0, SCL PA1
+      }
+    #endif
+    if ((PORTMUX.TWIROUTEA & PORTMUX_TWI0_gm) == PORTMUX_TWI0_ALT2_gc) {
+      return TWI_RecoverPins(&PORTC, 0x04, 0x08);    // SDA PC2, SCL PC3
+    } else {
+      return TWI_RecoverPins(&PORTA, 0x04, 0x08);    // SDA PA2, SCL PA3, the client pins of dual mode are not touched
+    }
+  #else  // megaTinyCore
+    #if defined(PORTMUX_TWI0_bm)
+      if ((PORTMUX.CTRLB & PORTMUX_TWI0_bm)) {
+        return TWI_RecoverPins(&PORTA, 0x02, 0x04);  // SDA PA1, SCL PA2
+      } else {
+        return TWI_RecoverPins(&PORTB, 0x02, 0x01);  // SDA PB1, SCL PB0
+      }
+    #elif defined(__AVR_ATtinyxy2__)
+      return TWI_RecoverPins(&PORTA, 0x02, 0x04);    // 8-pin parts always have it on PA1/2
+    #else
+      return TWI_RecoverPins(&PORTB, 0x02, 0x01);    // zero series, no remapping, SDA PB1, SCL PB0
+    #endif
+  #endif
+}
+
+
 bool TWI0_Pins(uint8_t sda_pin, uint8_t scl_pin) {
   #if defined(PIN_WIRE_SDA)
     #if (defined(PIN_WIRE_SDA_PINSWAP_1) || defined(PIN_WIRE_SDA_PINSWAP_2) || defined(PIN_WIRE_SDA_PINSWAP_3))
@@ -410,6 +437,25 @@ void TWI1_ClearPins() {
 }
 
 
+/**
+ *@brief              TWI1_RecoverBus runs TWI_RecoverPins on the host pins that are selected for TWI1
+ *
+ *@return             bool
+ *@retval             true if SDA and SCL are high afterwards
+ */
+bool TWI1_RecoverBus() {
+  #if defined(PORTMUX_TWIROUTEA)
+    if ((PORTMUX.TWIROUTEA & PORTMUX_TWI1_gm) == PORTMUX_TWI1_ALT2_gc) {
+      return TWI_RecoverPins(&PORTB, 0x04, 0x08);    // SDA PB2, SCL PB3
+    } else {
+      return TWI_RecoverPins(&PORTF, 0x04, 0x08);    // SDA PF2, SCL PF3
+    }
+  #else
+    return false;
+  #endif
+}
+
+
 bool TWI1_Pins(uint8_t sda_pin, uint8_t scl_pin) {
   #if defined(PIN_WIRE1_SDA)
     #if (defined(PIN_WIRE1_SDA_PINSWAP_1) || defined(PIN_WIRE1_SDA_PINSWAP_2))
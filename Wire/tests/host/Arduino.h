@@ -0,0 +1,97 @@
+/* Host stand-in for the parts of the DxCore Arduino.h that the Wire library uses,
+ * part of the TWI simulation in Wire/tests/host
+*/
+
+#ifndef TWI_SIM_ARDUINO_H
+#define TWI_SIM_ARDUINO_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <string.h>
+
+/* On the AVR, int is 16 bit and int16_t is int. Wire.h declares the requestFrom() overloads
+ * with int, Wire.cpp defines them with int16_t, that only matches if both are the same type.
+ * Any C++ standard header has to be included before this file.
+ */
+#define int16_t int
+
+#include "avr/io.h"
+
+#define DXCORE    1
+
+#define PA        0
+#define PB        1
+#define PC        2
+#define PF        5
+
+/* Arduino pin numbers as on an AVR128DA64 */
+#define PIN_WIRE_SDA            2
+#define PIN_WIRE_SCL            3
+#define PIN_WIRE_SDA_PINSWAP_2  18
+#define PIN_WIRE_SCL_PINSWAP_2  19
+#define PIN_WIRE1_SDA           10
+#define PIN_WIRE1_SCL           11
+
+#define INPUT         0
+#define OUTPUT        1
+#define INPUT_PULLUP  2
+#define LOW           0
+#define HIGH          1
+
+#define cli()         (SREG = (uint8_t)(SREG & ~CPU_I_bm))
+#define sei()         (SREG = (uint8_t)(SREG |  CPU_I_bm))
+
+#define ISR(vector)   extern "C" void vector(void); void vector(void)
+
+/* On the target these are compile-time errors for arguments that are known to be wrong */
+#define badArg(msg)   ((void)0)
+#define badCall(msg)  ((void)0)
+
+static inline PORT_t *portToPortStruct(uint8_t port) {
+  switch (port) {
+    case PB: return &PORTB;
+    case PC: return &PORTC;
+    case PF: return &PORTF;
+    default: return &PORTA;
+  }
+}
+
+unsigned long micros(void);
+unsigned long millis(void);
+void          delay(unsigned long ms);
+void          delayMicroseconds(unsigned int us);
+void          pinMode(uint8_t pin, uint8_t mode);
+void          digitalWrite(uint8_t pin, uint8_t value);
+uint8_t       digitalRead(uint8_t pin);
+
+#ifdef __cplusplus
+class Print {
+ public:
+    virtual ~Print() {}
+    virtual size_t write(uint8_t) = 0;
+    virtual size_t write(const uint8_t *buffer, size_t size) {
+      size_t n = 0;
+      while (size--) {
+        n += write(*buffer++);
+      }
+      return n;
+    }
+    size_t write(const char *str) {
+      return write((const uint8_t *)str, strlen(str));
+    }
+    size_t write(const char *buffer, size_t size) {
+      return write((const uint8_t *)buffer, size);
+    }
+};
+
+class Stream : public Print {
+ public:
+    virtual int available() = 0;
+    virtual int read() = 0;
+    virtual int peek() = 0;
+    virtual void flush() {}
+};
+#endif
+
+#endif  // TWI_SIM_ARDUINO_H
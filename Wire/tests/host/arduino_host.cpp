@@ -0,0 +1,47 @@
+/* Host implementation of the Arduino functions declared in the host Arduino.h,
+ * the time is the simulated time of the TWI model.
+ */
+#include "Arduino.h"
+#include "twi_sim.h"
+
+static uint8_t pinModes[64];
+static uint8_t pinLevels[64];
+
+unsigned long micros(void) {
+  TwiSim::advance(50 * (1000000000ULL / F_CPU));   // the call itself, so a loop that only polls the time moves on
+  return (unsigned long)(TwiSim::nanos() / 1000);
+}
+
+unsigned long millis(void) {
+  return (unsigned long)(TwiSim::nanos() / 1000000);
+}
+
+void delay(unsigned long ms) {
+  TwiSim::advance((uint64_t)ms * 1000000);
+}
+
+void delayMicroseconds(unsigned int us) {
+  TwiSim::advance((uint64_t)us * 1000);
+}
+
+void pinMode(uint8_t pin, uint8_t mode) {
+  if (pin < sizeof(pinModes)) {
+    pinModes[pin] = mode;
+    if (mode == INPUT_PULLUP) {
+      pinLevels[pin] = HIGH;
+    }
+  }
+}
+
+void digitalWrite(uint8_t pin, uint8_t value) {
+  if (pin < sizeof(pinLevels)) {
+    pinLevels[pin] = value;
+  }
+}
+
+uint8_t digitalRead(uint8_t pin) {
+  if (pin < sizeof(pinLevels)) {
+    return pinLevels[pin];
+  }
+  return LOW;
+}
@@ -0,0 +1,197 @@
+/* Host stand-in for <avr/io.h>, part of the TWI simulation in Wire/tests/host
+
+  The TWI registers are TwiSimReg objects instead of plain volatile bytes, every read and write
+  is passed to the bus model in twi_sim.cpp. That is why twi.c and twi_pins.c are compiled as C++
+  in the host build (see twi_host.cpp). The layout and the bit masks follow an AVR DA with two TWIs.
+  The port registers go through the model as well, for the SDA and SCL lines of the host pins.
+*/
+
+#ifndef TWI_SIM_AVR_IO_H
+#define TWI_SIM_AVR_IO_H
+
+#include <stdint.h>
+
+#ifndef F_CPU
+  #define F_CPU 24000000UL
+#endif
+
+
+/* A register that reports every access to the model. The compound operators are read-modify-write,
+ * like the sbr/cbr sequences on the AVR. A read that is discarded, like "module->SDATA;", does not
+ * reach the model, C++ has no conversion for an unused lvalue.
+ */
+struct TwiSimReg {
+  uint8_t value;
+
+  TwiSimReg &operator=(uint8_t data);
+  TwiSimReg &operator=(const TwiSimReg &reg) {
+    return (*this = (uint8_t)reg);
+  }
+  operator uint8_t() const;
+  TwiSimReg &operator|=(int data) {
+    return (*this = (uint8_t)(*this | data));
+  }
+  TwiSimReg &operator&=(int data) {
+    return (*this = (uint8_t)(*this & data));
+  }
+  TwiSimReg &operator^=(int data) {
+    return (*this = (uint8_t)(*this ^ data));
+  }
+};
+
+/* The status register, cli() and sei() go through it, so restoring a saved SREG can start a pending interrupt */
+struct TwiSimSREG {
+  uint8_t value;
+
+  TwiSimSREG &operator=(uint8_t data);
+  operator uint8_t() const {
+    return value;
+  }
+};
+
+typedef volatile uint8_t register8_t;
+
+typedef struct TWI_struct {
+  TwiSimReg CTRLA;
+  TwiSimReg DUALCTRL;
+  TwiSimReg DBGCTRL;
+  TwiSimReg MCTRLA;
+  TwiSimReg MCTRLB;
+  TwiSimReg MSTATUS;
+  TwiSimReg MBAUD;
+  TwiSimReg MADDR;
+  TwiSimReg MDATA;
+  TwiSimReg SCTRLA;
+  TwiSimReg SCTRLB;
+  TwiSimReg SSTATUS;
+  TwiSimReg SADDR;
+  TwiSimReg SDATA;
+  TwiSimReg SADDRMASK;
+  TwiSimReg reserved_0x0F;
+} TWI_t;
+
+typedef struct PORT_struct {
+  TwiSimReg DIR;
+  TwiSimReg DIRSET;
+  TwiSimReg DIRCLR;
+  TwiSimReg DIRTGL;
+  TwiSimReg OUT;
+  TwiSimReg OUTSET;
+  TwiSimReg OUTCLR;
+  TwiSimReg OUTTGL;
+  TwiSimReg IN;
+  TwiSimReg INTFLAGS;
+  TwiSimReg PORTCTRL;
+  TwiSimReg reserved_0x0B[5];
+  TwiSimReg PIN0CTRL;
+  TwiSimReg PIN1CTRL;
+  TwiSimReg PIN2CTRL;
+  TwiSimReg PIN3CTRL;
+  TwiSimReg PIN4CTRL;
+  TwiSimReg PIN5CTRL;
+  TwiSimReg PIN6CTRL;
+  TwiSimReg PIN7CTRL;
+} PORT_t;
+
+typedef struct PORTMUX_struct {
+  register8_t TWIROUTEA;
+} PORTMUX_t;
+
+extern TWI_t      TwiSim_TWI0;
+extern TWI_t      TwiSim_TWI1;
+extern PORT_t     TwiSim_PORTA;
+extern PORT_t     TwiSim_PORTB;
+extern PORT_t     TwiSim_PORTC;
+extern PORT_t     TwiSim_PORTF;
+extern PORTMUX_t  TwiSim_PORTMUX;
+extern TwiSimSREG TwiSim_SREG;
+
+#define TWI0      TwiSim_TWI0
+#define TWI1      TwiSim_TWI1
+#define PORTA     TwiSim_PORTA
+#define PORTB     TwiSim_PORTB
+#define PORTC     TwiSim_PORTC
+#define PORTF     TwiSim_PORTF
+#define PORTMUX   TwiSim_PORTMUX
+#define SREG      TwiSim_SREG
+
+#define CPU_I_bm  0x80
+
+#define TWI0_DUALCTRL       1
+#define TWI1_DUALCTRL       1
+#define PORTMUX_TWIROUTEA   1
+
+/* PORT */
+#define PORT_PULLUPEN_bm              0x08
+
+/* PORTMUX */
+#define PORTMUX_TWI0_gm               0x03
+#define PORTMUX_TWI0_DEFAULT_gc       0x00
+#define PORTMUX_TWI0_ALT1_gc          0x01
+#define PORTMUX_TWI0_ALT2_gc          0x02
+#define PORTMUX_TWI1_gm               0x0C
+#define PORTMUX_TWI1_DEFAULT_gc       0x00
+#define PORTMUX_TWI1_ALT1_gc          0x04
+#define PORTMUX_TWI1_ALT2_gc          0x08
+
+/* TWI.CTRLA / TWI.DUALCTRL */
+#define TWI_FMPEN_bm                  0x02
+#define TWI_FMPEN_bp                  1
+#define TWI_ENABLE_bm                 0x01
+
+/* TWI.MCTRLA */
+#define TWI_RIEN_bm                   0x80
+#define TWI_WIEN_bm                   0x40
+#define TWI_QCEN_bm                   0x10
+#define TWI_TIMEOUT_gm                0x0C
+#define TWI_TIMEOUT_DISABLED_gc       0x00
+#define TWI_TIMEOUT_50US_gc           0x04
+#define TWI_TIMEOUT_100US_gc          0x08
+#define TWI_TIMEOUT_200US_gc          0x0C
+#define TWI_SMEN_bm                   0x02
+
+/* TWI.MCTRLB */
+#define TWI_FLUSH_bm                  0x08
+#define TWI_ACKACT_bm                 0x04
+#define TWI_MCMD_gm                   0x03
+#define TWI_MCMD_NOACT_gc             0x00
+#define TWI_MCMD_REPSTART_gc          0x01
+#define TWI_MCMD_RECVTRANS_gc         0x02
+#define TWI_MCMD_STOP_gc              0x03
+
+/* TWI.MSTATUS */
+#define TWI_RIF_bm                    0x80
+#define TWI_WIF_bm                    0x40
+#define TWI_CLKHOLD_bm                0x20
+#define TWI_RXACK_bm                  0x10
+#define TWI_ARBLOST_bm                0x08
+#define TWI_BUSERR_bm                 0x04
+#define TWI_BUSSTATE_gm               0x03
+#define TWI_BUSSTATE_UNKNOWN_gc       0x00
+#define TWI_BUSSTATE_IDLE_gc          0x01
+#define TWI_BUSSTATE_OWNER_gc         0x02
+#define TWI_BUSSTATE_BUSY_gc          0x03
+
+/* TWI.SCTRLA */
+#define TWI_DIEN_bm                   0x80
+#define TWI_APIEN_bm                  0x40
+#define TWI_PIEN_bm                   0x20
+#define TWI_PMEN_bm                   0x04
+
+/* TWI.SCTRLB */
+#define TWI_SCMD_gm                   0x03
+#define TWI_SCMD_NOACT_gc             0x00
+#define TWI_SCMD_COMPTRANS_gc         0x02
+#define TWI_SCMD_RESPONSE_gc          0x03
+
+/* TWI.SSTATUS */
+#define TWI_DIF_bm                    0x80
+#define TWI_APIF_bm                   0x40
+#define TWI_COLL_bm                   0x08
+#define TWI_DIR_bm                    0x02
+#define TWI_AP_bm                     0x01
+
+/* TWI.SADDRMASK */
+#define TWI_ADDREN_bm                 0x01
+
+#endif  // TWI_SIM_AVR_IO_H
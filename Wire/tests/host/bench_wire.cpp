@@ -0,0 +1,178 @@
+/* bench_wire.cpp - TWI register accesses of the Wire library, counted on the simulated bus
+
+  Built once per configuration by "make bench", every build prints one row. The unit is the
+  TWI register access, so the table is a count of the bus protocol as the library drives it:
+  which registers are touched per byte and per transaction, and how many interrupts it takes.
+  That catches a change in the protocol handling, e.g. an extra MSTATUS poll or a missing
+  smart mode ACK, but not the CPU time between the accesses. The buffer indexing, the MANDS
+  pointer selection and the ring buffer wrap cost no register access, so they don't show up,
+  and the mode x buffers x instance x length rows only differ in the buffer RAM. Cycle counts
+  need an AVR build, this table is no replacement for them.
+  The per byte numbers are the difference between a short and a long transfer, the fixed part
+  is what remains of the short one.
+
+  The buffer RAM is the size of the buffers and indexes in struct twiData, which is the same
+  on the AVR, not the complete footprint. Flash and RAM of a sketch: ../size_matrix.sh.
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include "twi_sim.h"
+#include "Wire.h"
+
+#ifndef BENCH_NAME
+  #define BENCH_NAME "default"
+#endif
+
+#if defined(USING_WIRE1)
+  #define BENCH_WIRE    Wire1
+  #define BENCH_MODULE  TWI1
+#else
+  #define BENCH_WIRE    Wire
+  #define BENCH_MODULE  TWI0
+#endif
+
+#define SHORT_LEN   2
+#define LONG_LEN    10
+
+struct Cost {
+  uint32_t accesses;
+  uint32_t interrupts;
+};
+
+static const uint8_t pattern[LONG_LEN] = {1, 2, 3, 4, 5, 6, 7, 8, 9, 10};
+static uint8_t       requestLength;
+
+
+static void restart(void) {
+  Wire.end();
+  #if defined(USING_WIRE1)
+    Wire1.end();
+  #endif
+  TwiSim::reset();
+}
+
+static Cost snapshot(void) {
+  Cost c = {TwiSim::registerAccesses(), TwiSim::interrupts()};
+  return c;
+}
+
+static Cost masterWrite(uint8_t len) {
+  SimRecorder dev(0x20);
+  restart();
+  TwiSim::attach(BENCH_MODULE, &dev);
+  BENCH_WIRE.begin();
+  BENCH_WIRE.beginTransmission(0x20);
+  BENCH_WIRE.write(pattern, len);
+  TwiSim::clearStats();
+  BENCH_WIRE.endTransmission();
+  return snapshot();
+}
+
+static Cost masterRead(uint8_t len) {
+  SimRecorder dev(0x20);
+  restart();
+  dev.respond(pattern, len);
+  TwiSim::attach(BENCH_MODULE, &dev);
+  BENCH_WIRE.begin();
+  TwiSim::clearStats();
+  BENCH_WIRE.requestFrom((uint8_t)0x20, len);
+  return snapshot();
+}
+
+static void onReceiveHandler(int count) {
+  while (BENCH_WIRE.available()) {
+    BENCH_WIRE.read();
+  }
+  (void)count;
+}
+
+static void onRequestHandler(void) {
+  BENCH_WIRE.write(pattern, requestLength);
+}
+
+static Cost slaveReceive(uint8_t len) {
+  restart();
+  BENCH_WIRE.begin(0x30);
+  BENCH_WIRE.onReceive(onReceiveHandler);
+  TwiSim::clearStats();
+  TwiSim::hostWrite(BENCH_MODULE, 0x30, pattern, len);
+  return snapshot();
+}
+
+static Cost slaveSend(uint8_t len) {
+  uint8_t buffer[LONG_LEN];
+  restart();
+  requestLength = len;
+  BENCH_WIRE.begin(0x30);
+  BENCH_WIRE.onRequest(onRequestHandler);
+  TwiSim::clearStats();
+  TwiSim::hostRead(BENCH_MODULE, 0x30, buffer, len);
+  return snapshot();
+}
+
+static void printCost(Cost (*run)(uint8_t), bool withInterrupts) {
+  Cost shortRun = run(SHORT_LEN);
+  Cost longRun  = run(LONG_LEN);
+  double perByte   = (double)(longRun.accesses - shortRun.accesses) / (LONG_LEN - SHORT_LEN);
+  double fixed     = shortRun.accesses - perByte * SHORT_LEN;
+  printf(" %7.1f %6.1f", perByte, fixed);
+  if (withInterrupts) {
+    printf(" %5.1f", (double)(longRun.interrupts - shortRun.interrupts) / (LONG_LEN - SHORT_LEN));
+  }
+}
+
+static unsigned bufferRam(void) {
+  twiData d;
+  unsigned ram = 0;
+  #if defined(TWI_MERGE_BUFFERS)
+    ram += sizeof(d._trBuffer) + sizeof(d._trHead) + sizeof(d._trTail);
+    #if defined(TWI_MANDS)
+      ram += sizeof(d._trBufferS) + sizeof(d._trHeadS) + sizeof(d._trTailS);
+    #endif
+  #else
+    ram += sizeof(d._txBuffer) + sizeof(d._txHead) + sizeof(d._txTail);
+    ram += sizeof(d._rxBuffer) + sizeof(d._rxHead) + sizeof(d._rxTail);
+    #if defined(TWI_MANDS)
+      ram += sizeof(d._txBufferS) + sizeof(d._txHeadS) + sizeof(d._txTailS);
+      ram += sizeof(d._rxBufferS) + sizeof(d._rxHeadS) + sizeof(d._rxTailS);
+    #endif
+  #endif
+  #if defined(USING_WIRE1)
+    ram *= 2;                                   // Wire and Wire1
+  #endif
+  return ram;
+}
+
+
+int main(int argc, char **argv) {
+  if (argc > 1 && strcmp(argv[1], "--header") == 0) {
+    printf("%-22s %6s | %-14s | %-14s | %-20s | %-20s | %s\n", "", "buffer",
+           "host write", "host read", "client receive", "client send", "client");
+    printf("%-22s %6s | %7s %6s | %7s %6s | %7s %6s %5s | %7s %6s %5s | %s\n", "configuration", "RAM",
+           "/byte", "fixed", "/byte", "fixed", "/byte", "fixed", "irq", "/byte", "fixed", "irq", "ISR->SCTRLB");
+    return 0;
+  }
+
+  printf("%-22s %6u |", BENCH_NAME, bufferRam());
+  printCost(masterWrite, false);
+  printf(" |");
+  printCost(masterRead, false);
+  printf(" |");
+
+  uint32_t responses = 0;
+  uint32_t responseAccesses = 0;
+  Cost r = slaveReceive(LONG_LEN);
+  responses        += TwiSim::slaveResponses();
+  responseAccesses += TwiSim::slaveResponseAccesses();
+  printCost(slaveReceive, true);
+  printf(" |");
+  r = slaveSend(LONG_LEN);
+  responses        += TwiSim::slaveResponses();
+  responseAccesses += TwiSim::slaveResponseAccesses();
+  (void)r;
+  printCost(slaveSend, true);
+  printf(" | %6.1f\n", responses ? (double)responseAccesses / responses : 0.0);
+  restart();
+  return 0;
+}
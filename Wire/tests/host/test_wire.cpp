@@ -0,0 +1,1425 @@
+/* test_wire.cpp - runs the Wire library against the simulated bus
+
+  Built once per configuration by the Makefile in this folder, every test only uses what the
+  configuration provides. Returns the number of failed checks.
+*/
+
+#include <stdio.h>
+#include "twi_sim.h"
+#include "Wire.h"
+
+
+static int checks;
+static int failures;
+
+#define CHECK(cond) do {                                            \
+    checks++;                                                       \
+    if (!(cond)) {                                                  \
+      failures++;                                                   \
+      printf("  FAILED %s:%d: %s\n", __FILE__, __LINE__, #cond);    \
+    }                                                               \
+  } while (0)
+
+#define RUN(test) do {                                              \
+    int before = failures;                                          \
+    restart();                                                      \
+    test();                                                         \
+    printf("%-32s %s\n", #test, (failures == before) ? "ok" : "FAILED"); \
+  } while (0)
+
+
+#if defined(TWI_SLAVE_SMART)
+  #define REFUSED_LATE  1   // a byte the client refuses after reading it was ACKed, the next one is NACKed
+#else
+  #define REFUSED_LATE  0
+#endif
+
+static const uint8_t pattern[] = {0x11, 0x22, 0x33, 0x44, 0x55, 0x66, 0x77, 0x88};
+
+static void restart(void) {
+  Wire.end();
+  #if defined(TWI_TIMEOUT_SETTINGS)
+    Wire.setWireTimeout(TWI_TIMEOUT_DEFAULT, false);
+  #endif
+  Wire.clearWireTimeoutFlag();
+  #if defined(TWI_TIMEOUT_SETTINGS)
+    Wire.setBusRecovery(0);
+  #endif
+  #if defined(TWI_RETRY_ENABLE)
+    Wire.setRetry(0, 0, 0);
+  #endif
+  #if defined(TWI_SLAVE_REGISTERS)
+    Wire.setSlaveRegisters(NULL, 0);
+  #endif
+  #if defined(TWI_SLAVE_RESPONSE)
+    Wire.setSlaveResponse(NULL, 0);
+  #endif
+  #if defined(TWI_SMBUS_PEC)
+    Wire.setPEC(0);
+  #endif
+  #if defined(USING_WIRE1)
+    Wire1.end();
+  #endif
+  TwiSim::reset();
+}
+
+static uint8_t busState(TWI_t &module) {
+  return module.MSTATUS.value & TWI_BUSSTATE_gm;
+}
+
+
+/* Host */
+static void test_master_write(void) {
+  SimRecorder dev(0x20);
+  TwiSim::attach(TWI0, &dev);
+  Wire.begin();
+  Wire.beginTransmission(0x20);
+  CHECK(Wire.write(pattern, 3) == 3);
+  CHECK(Wire.endTransmission() == 3);
+  CHECK(dev.receivedCount == 3);
+  CHECK(dev.received[0] == 0x11 && dev.received[2] == 0x33);
+  CHECK(dev.stops == 1);
+  CHECK(busState(TWI0) == TWI_BUSSTATE_IDLE_gc);
+}
+
+static void test_master_write_no_client(void) {
+  Wire.begin();
+  Wire.beginTransmission(0x21);
+  Wire.write(0xAA);
+  CHECK(Wire.endTransmission() == 0);
+  #if defined(TWI_ERROR_ENABLED)
+    CHECK(Wire.returnError() == TWI_ERR_RXACK);
+  #endif
+  CHECK(busState(TWI0) == TWI_BUSSTATE_IDLE_gc);
+}
+
+static void test_master_write_data_nack(void) {
+  SimRecorder dev(0x20);
+  dev.nackAfter = 2;
+  TwiSim::attach(TWI0, &dev);
+  Wire.begin();
+  Wire.beginTransmission(0x20);
+  Wire.write(pattern, 5);
+  CHECK(Wire.endTransmission() == 2);
+  CHECK(dev.receivedCount == 2);
+  CHECK(busState(TWI0) == TWI_BUSSTATE_IDLE_gc);
+}
+
+static void test_master_read(void) {
+  SimRecorder dev(0x20);
+  dev.respond(pattern, 4);
+  TwiSim::attach(TWI0, &dev);
+  Wire.begin();
+  CHECK(Wire.requestFrom((uint8_t)0x20, (uint8_t)4) == 4);
+  CHECK(Wire.available() == 4);
+  CHECK(Wire.read() == 0x11);
+  CHECK(Wire.read() == 0x22);
+  CHECK(Wire.read() == 0x33);
+  CHECK(Wire.read() == 0x44);
+  CHECK(Wire.read() == -1);
+  CHECK(dev.stops == 1);
+}
+
+#if defined(TWI_MASTER_SMART)
+static void test_master_read_smart(void) {
+  SimRecorder dev(0x20);
+  dev.respond(pattern, 8);
+  TwiSim::attach(TWI0, &dev);
+  Wire.begin();
+  CHECK(TWI0.MCTRLA & TWI_SMEN_bm);
+  CHECK(Wire.requestFrom((uint8_t)0x20, (uint8_t)3, (uint8_t)0) == 3);  // NACK without STOP
+  CHECK(dev.responseIndex == 3 && dev.stops == 0);  // the NACK ended the read after the third byte
+  while (Wire.available()) {
+    Wire.read();
+  }
+  CHECK(Wire.requestFrom((uint8_t)0x20, (uint8_t)8) == 8);   // REP START, ACKs again after the NACK
+  CHECK(dev.responseIndex == 8 && dev.stops == 1);
+  for (uint8_t i = 0; i < 8; i++) {
+    CHECK(Wire.read() == pattern[i]);
+  }
+  TwiSim::clearStats();
+  CHECK(Wire.requestFrom((uint8_t)0x20, (uint8_t)8) == 8);
+  uint32_t longRead = TwiSim::registerAccesses();
+  TwiSim::clearStats();
+  CHECK(Wire.requestFrom((uint8_t)0x20, (uint8_t)2) == 2);
+  CHECK(longRead - TwiSim::registerAccesses() == 6 * 2);    // MSTATUS and MDATA, no MCTRLB write per byte
+}
+#endif
+
+static void test_write_read(void) {
+  SimRegisterDevice dev(0x50);
+  dev.regs[0x10] = 0xA0;
+  dev.regs[0x11] = 0xA1;
+  dev.regs[0x12] = 0xA2;
+  TwiSim::attach(TWI0, &dev);
+  Wire.begin();
+  Wire.beginTransmission(0x50);
+  Wire.write(0x10);
+  CHECK(Wire.writeRead(3, 1) == 3);
+  CHECK(Wire.read() == 0xA0);
+  CHECK(Wire.read() == 0xA1);
+  CHECK(Wire.read() == 0xA2);
+  CHECK(dev.starts == 2);                   // START and REP START
+  CHECK(dev.stops == 1);
+}
+
+static void test_rep_start_without_stop(void) {
+  SimRegisterDevice dev(0x50);
+  dev.regs[0x20] = 0x5A;
+  TwiSim::attach(TWI0, &dev);
+  Wire.begin();
+  Wire.beginTransmission(0x50);
+  Wire.write(0x20);
+  CHECK(Wire.endTransmission(false) == 1);
+  CHECK(busState(TWI0) == TWI_BUSSTATE_OWNER_gc);
+  CHECK(Wire.requestFrom((uint8_t)0x50, (uint8_t)1, (uint8_t)1) == 1);
+  CHECK(Wire.read() == 0x5A);
+  CHECK(dev.stops == 1);
+}
+
+static void test_zero_copy(void) {
+  SimRegisterDevice dev(0x50);
+  TwiSim::attach(TWI0, &dev);
+  Wire.begin();
+  uint8_t out[9] = {0x40};
+  memcpy(&out[1], pattern, 8);
+  CHECK(Wire.writeTo(0x50, out, sizeof(out)) == sizeof(out));
+  CHECK(dev.regs[0x47] == 0x88);
+  uint8_t in[8];
+  Wire.writeTo(0x50, out, 1, false);
+  CHECK(Wire.readFrom(0x50, in, sizeof(in)) == sizeof(in));
+  CHECK(memcmp(in, pattern, sizeof(in)) == 0);
+}
+
+static void test_arbitration_lost(void) {
+  SimRecorder dev(0x20);
+  TwiSim::attach(TWI0, &dev);
+  TwiSim::faults(TWI0).arbitrationLost = 1;
+  Wire.begin();
+  Wire.beginTransmission(0x20);
+  Wire.write(pattern, 2);
+  CHECK(Wire.endTransmission() == 0);
+  #if defined(TWI_ERROR_ENABLED)
+    CHECK(Wire.returnError() == TWI_ERR_BUS_ARB);
+  #endif
+  Wire.beginTransmission(0x20);
+  Wire.write(pattern, 2);
+  CHECK(Wire.endTransmission() == 2);
+}
+
+static void test_clock_hold(void) {
+  SimRecorder dev(0x20);
+  dev.holdClock = true;
+  TwiSim::attach(TWI0, &dev);
+  Wire.begin();
+  Wire.beginTransmission(0x20);
+  Wire.write(0x01);
+  CHECK(Wire.endTransmission() == 0);
+  #if defined(TWI_ERROR_ENABLED)
+    CHECK(Wire.returnError() == TWI_ERR_TIMEOUT);
+  #endif
+  CHECK(busState(TWI0) == TWI_BUSSTATE_IDLE_gc);
+  dev.holdClock = false;
+  Wire.beginTransmission(0x20);
+  Wire.write(0x01);
+  CHECK(Wire.endTransmission() == 1);
+}
+
+#if defined(TWI_TIMEOUT_SETTINGS)
+static void test_timeout(void) {
+  static TwoWire fresh(&TWI0);                              // as a sketch gets it, restart() set the timeout of Wire
+  fresh.begin();
+  CHECK((TWI0.MCTRLA.value & TWI_TIMEOUT_gm) == TWI_TIMEOUT_DISABLED_gc);
+  fresh.end();
+
+  SimRecorder dev(0x20);
+  uint8_t buffer[2];
+  dev.holdClock = true;
+  TwiSim::attach(TWI0, &dev);
+  Wire.begin();
+  Wire.setWireTimeout(500, true);
+  CHECK((TWI0.MCTRLA.value & TWI_TIMEOUT_gm) == TWI_TIMEOUT_200US_gc);
+  CHECK(!Wire.getWireTimeoutFlag());
+
+  uint64_t start = TwiSim::nanos();
+  Wire.beginTransmission(0x20);
+  Wire.write(0x01);
+  Wire.endTransmission();
+  uint64_t spent = TwiSim::nanos() - start;
+  CHECK(spent >= 500000 && spent < 600000);                 // the address byte and the timeout, independent of the clock speed
+  CHECK(Wire.getWireTimeoutFlag());
+  CHECK(busState(TWI0) == TWI_BUSSTATE_IDLE_gc);
+  Wire.clearWireTimeoutFlag();
+  CHECK(!Wire.getWireTimeoutFlag());
+
+  start = TwiSim::nanos();
+  CHECK(Wire.readFrom(0x20, buffer, 2) == 0);
+  spent = TwiSim::nanos() - start;
+  CHECK(spent >= 500000 && spent < 600000);
+  CHECK(Wire.getWireTimeoutFlag());
+  Wire.clearWireTimeoutFlag();
+
+  dev.holdClock = false;
+  Wire.beginTransmission(0x20);
+  Wire.write(0x01);
+  CHECK(Wire.endTransmission() == 1);
+  CHECK(Wire.requestFrom(0x20, 1) == 1);
+  Wire.read();
+  CHECK(!Wire.getWireTimeoutFlag());
+}
+#endif
+
+static uint8_t writeOneByte(void) {
+  Wire.beginTransmission(0x20);
+  Wire.write(0x01);
+  return Wire.endTransmission();
+}
+
+static void test_bus_recovery(void) {
+  SimRecorder dev(0x20);
+  TwiSim::attach(TWI0, &dev);
+  Wire.begin();
+  Wire.setClock(400000);
+  #if defined(TWI_TIMEOUT_SETTINGS)
+    Wire.setWireTimeout(500, false);
+  #endif
+  uint8_t baud = TWI0.MBAUD.value;
+  dev.holdData = 5;                                         // the client lost the clock in the middle of a byte
+  CHECK(writeOneByte() == 0);
+  CHECK(Wire.getWireTimeoutFlag());
+  CHECK(writeOneByte() == 0);                               // and stays stuck
+  CHECK(dev.stops == 0);
+
+  CHECK(Wire.recoverBus());
+  CHECK(dev.holdData == 0);
+  CHECK(dev.stops == 1);
+  CHECK((PORTA.DIR.value & 0x0C) == 0);                     // pins released
+  CHECK(TWI0.MBAUD.value == baud);
+  #if defined(TWI_TIMEOUT_SETTINGS)
+    CHECK((TWI0.MCTRLA.value & TWI_TIMEOUT_gm) == TWI_TIMEOUT_200US_gc);
+  #endif
+  CHECK(busState(TWI0) == TWI_BUSSTATE_IDLE_gc);
+  CHECK(writeOneByte() == 1);
+
+  dev.holdData = 20;                                        // more than 9 clocks can fix
+  CHECK(!Wire.recoverBus());
+  dev.holdData = 0;
+}
+
+#if defined(TWI_TIMEOUT_SETTINGS)
+static void test_bus_recovery_auto(void) {
+  SimRecorder dev(0x20);
+  TwiSim::attach(TWI0, &dev);
+  Wire.begin();
+  Wire.setWireTimeout(500, false);
+  Wire.setBusRecovery(2);
+  CHECK(writeOneByte() == 1);
+  dev.holdData = 3;
+  CHECK(writeOneByte() == 0);
+  CHECK(dev.holdData == 3);
+  CHECK(writeOneByte() == 0);                               // second timeout in a row
+  CHECK(dev.holdData == 0);
+  CHECK(writeOneByte() == 1);
+}
+#endif
+
+static void test_scan(void) {
+  SimRecorder a(0x20);
+  SimRecorder b(0x21);
+  SimRecorder c(0x77);
+  TwiSim::attach(TWI0, &a);
+  TwiSim::attach(TWI0, &b);
+  TwiSim::attach(TWI0, &c);
+  Wire.begin();
+  uint8_t map[16];
+  memset(map, 0xAA, sizeof(map));
+  uint64_t start = TwiSim::nanos();
+  CHECK(Wire.scan(map) == 0);
+  uint64_t spent = TwiSim::nanos() - start;
+  CHECK(spent < 112 * 100000ULL);                           // 9 bits at 100kHz and the REP START per address
+  uint8_t found = 0;
+  for (uint8_t i = 0; i < sizeof(map); i++) {
+    for (uint8_t bits = map[i]; bits != 0; bits &= (bits - 1)) {
+      found++;
+    }
+  }
+  CHECK(found == 3);
+  CHECK(map[0x20 >> 3] == 0x03 && map[0x77 >> 3] == 0x80);
+  CHECK(a.starts == 1 && b.starts == 1 && c.starts == 1);
+  CHECK(a.stops == 0 && c.stops == 1);                     // REP START between the probes, STOP after the last one
+  CHECK(a.receivedCount == 0);
+  CHECK(busState(TWI0) == TWI_BUSSTATE_IDLE_gc);
+  CHECK(Wire.scan(map, 0x21, 0x7F) == 0);                  // the whole range, up to the last address
+  CHECK(map[0x20 >> 3] == 0x02 && map[0x77 >> 3] == 0x80 && c.starts == 2);
+
+  TwiSim::faults(TWI0).arbitrationLost = 1;                // another host
+  CHECK(Wire.scan(map) == TWI_ERR_BUS_ARB);
+  CHECK(map[0x20 >> 3] == 0 && a.starts == 1);
+
+  c.holdClock = true;                                     // the scan ends at the client holding SCL
+  start = TwiSim::nanos();
+  CHECK(Wire.scan(map) == TWI_ERR_TIMEOUT);
+  CHECK(TwiSim::nanos() - start < spent + 500000);         // 40 bit times at 100kHz for the last probe, not the 25ms timeout
+  CHECK(map[0x20 >> 3] == 0x03);
+  CHECK(Wire.getWireTimeoutFlag());
+  c.holdClock = false;
+
+  a.holdData = 3;                                           // SDA stuck low, no START possible
+  start = TwiSim::nanos();
+  CHECK(Wire.scan(map) == TWI_ERR_UNDEFINED);
+  CHECK(TwiSim::nanos() - start < 500000);                 // aborted after the first address
+  CHECK(map[0x20 >> 3] == 0);
+}
+
+#if defined(TWI_GET_CLOCK)
+static uint32_t measuredClock(void) {                       // what a scope would show on SCL
+  SimRecorder dev(0x20);
+  TwiSim::attach(TWI0, &dev);
+  Wire.beginTransmission(0x20);
+  Wire.write(pattern, 8);
+  TwiSim::clearStats();
+  Wire.endTransmission();
+  TwiSim::detach(TWI0, &dev);
+  return (uint32_t)((TwiSim::busBytes() * 9 * 1000000000ULL) / TwiSim::masterBusNanos());
+}
+
+static void test_clock(void) {
+  CHECK(Wire.getClock() == 0);                              // host not enabled
+  Wire.begin();
+  CHECK(Wire.getClock() == DEFAULT_FREQUENCY);              // 24MHz and 500ns divide evenly
+
+  Wire.setClock(400000);                                    // folded by the compiler
+  uint8_t folded = TWI0.MBAUD.value;
+  CHECK(Wire.getClock() == 400000);
+  volatile uint32_t clock = 400000;
+  Wire.setClock(100000);
+  Wire.setClock(clock);                                     // calculated at runtime
+  CHECK(TWI0.MBAUD.value == folded);
+  CHECK((TWI0.CTRLA.value & TWI_FMPEN_bm) == 0);
+
+  TwiSim::setRiseTime(TWI0, 300);
+  Wire.setClock(400000, 300);
+  uint32_t reported = Wire.getClock();
+  CHECK(reported <= 400000 && reported > 390000);           // one baud step slower at most
+  uint32_t measured = measuredClock();
+  CHECK(measured + 100 > reported && measured < reported + 100);
+
+  TwiSim::setRiseTime(TWI0, 80);
+  clock = 1000000;
+  Wire.setClock(clock, 80);
+  CHECK((TWI0.CTRLA.value & TWI_FMPEN_bm) != 0);
+  reported = Wire.getClock();
+  CHECK(reported <= 1000000 && reported > 900000);
+  measured = measuredClock();
+  CHECK(measured + 1000 > reported && measured < reported + 1000);
+
+  Wire.recoverBus();                                        // keeps the clock of setClock()
+  CHECK(Wire.getClock() == reported);
+
+  Wire.setClock(1000);                                      // slower than MBAUD can do, getClock() tells
+  CHECK(TWI0.MBAUD.value == 255);
+  CHECK(Wire.getClock() > 1000);
+}
+#endif
+
+static void test_baud_sweep(void) {
+  static const uint32_t cpus[]  = {1000000, 2000000, 3000000, 4000000, 5000000, 8000000, 10000000, 12000000,
+                                   16000000, 20000000, 24000000, 28000000, 32000000, 40000000, 48000000};
+  static const uint32_t clocks[] = {10000, 50000, 100000, 250000, 400000, 600000, 800000, 1000000};
+  static const uint16_t rises[]  = {0, 120, 300, 1000, TWI_RISE_TIME_AUTO};
+  uint16_t wrong = 0;
+  for (uint8_t c = 0; c < sizeof(cpus) / sizeof(cpus[0]); c++) {
+    for (uint8_t f = 0; f < sizeof(clocks) / sizeof(clocks[0]); f++) {
+      for (uint8_t r = 0; r < sizeof(rises) / sizeof(rises[0]); r++) {
+        double   cpu  = cpus[c];
+        uint16_t rise = TWI_riseTime(clocks[f], rises[r]);
+        uint8_t  baud = TWI_baudFor(cpus[c], clocks[f], rise);
+        double   real = cpu / (10 + 2.0 * baud + cpu * rise * 1e-9);          // data sheet
+        double   next = cpu / (10 + 2.0 * (baud - 1) + cpu * rise * 1e-9);    // one step faster
+        double   reported = TWI_clockFor(cpus[c], baud, rise);
+        if (reported > real * 1.001 || reported < real * 0.999) {
+          wrong++;                                                            // getClock() is off
+        }
+        if (baud == 255) {
+          wrong += (real <= clocks[f]);                                       // only if it is too slow to reach
+        } else if (real > clocks[f] * 1.001) {
+          wrong++;                                                            // faster than requested
+        } else if (baud > 1 && next <= clocks[f]) {
+          wrong++;                                                            // slower than necessary
+        }
+      }
+    }
+  }
+  CHECK(wrong == 0);
+}
+
+
+#if defined(TWI_SMBUS_PEC)
+static uint8_t smbusPec(const uint8_t *data, size_t length) {  // bitwise, to check the table of twi.c against
+  uint8_t crc = 0;
+  for (size_t i = 0; i < length; i++) {
+    crc ^= data[i];
+    for (uint8_t bit = 0; bit < 8; bit++) {
+      crc = (crc & 0x80) ? ((crc << 1) ^ 0x07) : (crc << 1);
+    }
+  }
+  return crc;
+}
+
+static void test_smbus_pec_host(void) {
+  const uint8_t check[] = {'1', '2', '3', '4', '5', '6', '7', '8', '9'};
+  CHECK(smbusPec(check, sizeof(check)) == 0xF4);           // check value of CRC-8/SMBUS
+  SimRecorder dev(0x20);
+  TwiSim::attach(TWI0, &dev);
+  Wire.begin();
+  Wire.setPEC(TWI_PEC_HOST);
+
+  Wire.beginTransmission(0x20);                            // block of 3 bytes, the PEC is appended
+  Wire.write(pattern, 3);
+  CHECK(Wire.endTransmission() == 3);
+  const uint8_t written[] = {0x40, 0x11, 0x22, 0x33};
+  CHECK(dev.receivedCount == 4);
+  CHECK(dev.received[3] == smbusPec(written, sizeof(written)));
+
+  const uint8_t word[] = {0x40, 0x05, 0x41, 0xAB, 0xCD};   // read word: command, REP START, 2 bytes and the PEC
+  uint8_t response[3] = {0xAB, 0xCD, smbusPec(word, sizeof(word))};
+  dev.respond(response, 3);
+  dev.receivedCount = 0;
+  Wire.beginTransmission(0x20);
+  Wire.write(0x05);
+  CHECK(Wire.endTransmission(false) == 1);                  // no STOP, no PEC
+  CHECK(Wire.requestFrom(0x20, 2) == 2);
+  CHECK(dev.receivedCount == 1 && dev.received[0] == 0x05);
+  CHECK(Wire.available() == 2);
+  CHECK(Wire.read() == 0xAB && Wire.read() == 0xCD);
+  CHECK(Wire.available() == 0);                             // the PEC is not stored
+
+  dev.respond(response, 3);
+  dev.receivedCount = 0;
+  Wire.beginTransmission(0x20);
+  Wire.write(0x05);
+  CHECK(Wire.writeRead(2, 1) == 2);                         // the same read word in one call
+  CHECK(dev.receivedCount == 1 && dev.received[0] == 0x05);
+  CHECK(Wire.read() == 0xAB && Wire.read() == 0xCD);
+  CHECK(Wire.available() == 0);
+
+  response[2] ^= 0x01;                                      // one bit flipped on the bus
+  dev.respond(response, 3);
+  Wire.beginTransmission(0x20);
+  Wire.write(0x05);
+  CHECK(Wire.endTransmission(false) == 1);
+  CHECK(Wire.requestFrom(0x20, 2) == 0);
+  CHECK(Wire.available() == 0);
+  #if defined(TWI_ERROR_ENABLED)
+    CHECK(Wire.returnError() == TWI_ERR_PEC);
+  #endif
+  CHECK(busState(TWI0) == TWI_BUSSTATE_IDLE_gc);
+  dev.respond(response, 3);
+  Wire.beginTransmission(0x20);
+  Wire.write(0x05);
+  CHECK(Wire.writeRead(2, 1) == 0);
+  CHECK(Wire.available() == 0);
+  CHECK(busState(TWI0) == TWI_BUSSTATE_IDLE_gc);
+
+  dev.nackAfter = 3;                                        // the client NACKs the PEC, it did not match
+  Wire.beginTransmission(0x20);
+  Wire.write(pattern, 3);
+  CHECK(Wire.endTransmission() == 0);
+  #if defined(TWI_ERROR_ENABLED)
+    CHECK(Wire.returnError() == TWI_ERR_PEC);
+  #endif
+  CHECK(busState(TWI0) == TWI_BUSSTATE_IDLE_gc);
+
+  #if defined(TWI_SMBUS_BLOCK)
+    dev.nackAfter = -1;                                     // block process call, one CRC over both blocks
+    const uint8_t call[] = {0x40, 0x07, 0x02, 0x11, 0x22, 0x41, 0x01, 0xEE};
+    const uint8_t answer[] = {0x01, 0xEE, smbusPec(call, sizeof(call))};
+    dev.respond(answer, 3);
+    dev.receivedCount = 0;
+    CHECK(Wire.blockProcessCall(0x20, 0x07, pattern, 2) == 1);
+    CHECK(dev.receivedCount == 4);                          // no PEC before the REP START
+    CHECK(Wire.read() == 0xEE && Wire.available() == 0);
+    const uint8_t empty[] = {0x40, 0x08, 0x41, 0x00};
+    const uint8_t none[] = {0x00, smbusPec(empty, sizeof(empty))};
+    dev.respond(none, 2);
+    CHECK(Wire.blockRead(0x20, 0x08) == 0);                 // an empty block still has a PEC
+    CHECK(dev.responseIndex == 2);
+    #if defined(TWI_ERROR_ENABLED)
+      CHECK(Wire.returnError() == TWI_NO_ERR);
+    #endif
+    CHECK(busState(TWI0) == TWI_BUSSTATE_IDLE_gc);
+  #endif
+}
+#endif
+
+#if defined(TWI_SMBUS_BLOCK)
+static void test_smbus_block(void) {
+  SimRecorder dev(0x20);
+  TwiSim::attach(TWI0, &dev);
+  Wire.begin();
+
+  CHECK(Wire.blockWrite(0x20, 0x30, pattern, 3) == 3);
+  CHECK(dev.receivedCount == 5);
+  CHECK(dev.received[0] == 0x30 && dev.received[1] == 3 && dev.received[4] == 0x33);
+  uint8_t tooLong[TWI_TX_BUFFER_LENGTH] = {0};
+  CHECK(Wire.blockWrite(0x20, 0x30, tooLong, TWI_TX_BUFFER_LENGTH - 1) == 0);  // no room for command and length
+  CHECK(dev.receivedCount == 5 && dev.starts == 1);
+
+  const uint8_t block[] = {3, 0xA1, 0xA2, 0xA3, 0x99};     // the 0x99 is never read
+  dev.respond(block, sizeof(block));
+  dev.receivedCount = 0;
+  CHECK(Wire.blockRead(0x20, 0x31) == 3);
+  CHECK(dev.receivedCount == 1 && dev.received[0] == 0x31);
+  CHECK(dev.responseIndex == 4);                            // count and data, the last byte was NACKed
+  CHECK(Wire.available() == 3);
+  CHECK(Wire.read() == 0xA1 && Wire.read() == 0xA2 && Wire.read() == 0xA3);
+  CHECK(dev.stops == 2);
+  CHECK(busState(TWI0) == TWI_BUSSTATE_IDLE_gc);
+
+  const uint8_t empty[] = {0, 0x99};
+  dev.respond(empty, sizeof(empty));
+  CHECK(Wire.blockRead(0x20, 0x31) == 0);
+  #if defined(TWI_MASTER_SMART)
+    CHECK(dev.responseIndex == 2);                          // reading the count ACKed it, the next byte is NACKed
+  #else
+    CHECK(dev.responseIndex == 1);
+  #endif
+  CHECK(Wire.available() == 0);
+  CHECK(busState(TWI0) == TWI_BUSSTATE_IDLE_gc);
+
+  uint8_t huge[256];
+  for (uint16_t i = 0; i < sizeof(huge); i++) {
+    huge[i] = i;
+  }
+  huge[0] = 200;                                            // more than the receive buffer holds
+  dev.respond(huge, sizeof(huge));
+  CHECK(Wire.blockRead(0x20, 0x31) == TWI_RX_BUFFER_LENGTH - 1);
+  CHECK(dev.responseIndex == TWI_RX_BUFFER_LENGTH);
+  #if defined(TWI_ERROR_ENABLED)
+    CHECK(Wire.returnError() == TWI_ERR_BUF_OVERFLOW);
+  #endif
+  CHECK(Wire.read() == 1);
+  CHECK(busState(TWI0) == TWI_BUSSTATE_IDLE_gc);
+
+  const uint8_t answer[] = {2, 0xB1, 0xB2};
+  dev.respond(answer, sizeof(answer));
+  dev.receivedCount = 0;
+  while (Wire.available()) {
+    Wire.read();
+  }
+  CHECK(Wire.blockProcessCall(0x20, 0x32, pattern, 2) == 2);
+  CHECK(dev.receivedCount == 4 && dev.received[1] == 2 && dev.received[3] == 0x22);
+  CHECK(Wire.read() == 0xB1 && Wire.read() == 0xB2);
+
+  dev.nackAddress = true;
+  CHECK(Wire.blockRead(0x20, 0x31) == 0);
+  CHECK(Wire.blockProcessCall(0x20, 0x32, pattern, 2) == 0);
+  CHECK(busState(TWI0) == TWI_BUSSTATE_IDLE_gc);
+}
+#endif
+
+#if defined(TWI_10BIT_ADDRESS)
+static void test_ten_bit_host(void) {
+  SimTenBitDevice dev(0x2A5);                               // first byte 11110 10 x
+  TwiSim::attach(TWI0, &dev);
+  Wire.begin();
+
+  Wire.beginTransmission10(0x2A5);
+  Wire.write(pattern, 3);
+  CHECK(Wire.endTransmission() == 3);                       // the second address byte is not counted
+  CHECK(dev.receivedCount == 3);
+  CHECK(dev.received[0] == 0x11 && dev.received[2] == 0x33);
+  CHECK(dev.stops == 1);
+
+  const uint8_t answer[] = {0xC1, 0xC2, 0xC3};
+  dev.respond(answer, sizeof(answer));
+  CHECK(Wire.requestFrom10(0x2A5, 2) == 2);                 // write both bytes, REP START, read
+  CHECK(dev.starts == 3 && dev.stops == 2);
+  CHECK(Wire.read() == 0xC1 && Wire.read() == 0xC2);
+  CHECK(busState(TWI0) == TWI_BUSSTATE_IDLE_gc);
+
+  dev.receivedCount = 0;
+  Wire.beginTransmission10(0x2A5);
+  Wire.write(0x05);
+  CHECK(Wire.endTransmission(false) == 1);
+  CHECK(Wire.requestFrom10(0x2A5, 3) == 3);                 // the write selected it, only the REP START
+  CHECK(dev.starts == 5 && dev.stops == 3);
+  CHECK(dev.receivedCount == 1 && dev.received[0] == 0x05);
+  CHECK(Wire.read() == 0xC1 && Wire.read() == 0xC2 && Wire.read() == 0xC3);
+
+  Wire.beginTransmission10(0x2A4);                          // same first byte, another client
+  Wire.write(pattern, 2);
+  CHECK(Wire.endTransmission() == 0);
+  #if defined(TWI_ERROR_ENABLED)
+    CHECK(Wire.returnError() == TWI_ERR_RXACK);
+  #endif
+  CHECK(Wire.requestFrom10(0x2A4, 2) == 0);
+  CHECK(dev.receivedCount == 1);
+  CHECK(busState(TWI0) == TWI_BUSSTATE_IDLE_gc);
+
+  SimRecorder plain(0x20);                                  // 7-bit addresses are not affected
+  TwiSim::attach(TWI0, &plain);
+  Wire.beginTransmission(0x20);
+  Wire.write(pattern, 2);
+  CHECK(Wire.endTransmission() == 2);
+  CHECK(plain.receivedCount == 2 && plain.received[0] == 0x11);
+}
+
+static void test_ten_bit_engine(void) {
+  SimTenBitDevice dev(0x2A5);
+  TwiSim::attach(TWI0, &dev);
+  Wire.begin();
+  const uint8_t answer[] = {0xC1, 0xC2};
+  dev.respond(answer, sizeof(answer));
+  Wire.beginTransmission10(0x2A5);
+  Wire.write(0x05);
+  CHECK(Wire.writeRead(2, 1) == 2);                         // both address bytes, then the REP START
+  CHECK(dev.receivedCount == 1 && dev.received[0] == 0x05);
+  CHECK(Wire.read() == 0xC1 && Wire.read() == 0xC2);
+  CHECK(dev.starts == 2 && dev.stops == 1);
+  CHECK(busState(TWI0) == TWI_BUSSTATE_IDLE_gc);
+
+  uint8_t buffer[2];                                        // 11110 10 would only be the first address byte
+  CHECK(Wire.writeTo(0x7A, pattern, 2, true) == 0);
+  CHECK(Wire.readFrom(0x7A, buffer, 2) == 0);
+  #if defined(TWI_MASTER_ASYNC)
+    Wire.beginTransmission10(0x2A5);
+    Wire.write(0x05);
+    CHECK(Wire.endTransmissionAsync() == TWI_ERR_TENBIT);
+    CHECK(Wire.requestFromAsync(0x7A, 2) == TWI_ERR_TENBIT);
+    WireTransaction xfer(0x7A, pattern, 2, NULL, 0);
+    CHECK(Wire.enqueue(&xfer) == TWI_ERR_TENBIT);
+    CHECK(!xfer.busy() && xfer.status == TWI_ERR_TENBIT);
+    CHECK(!Wire.masterBusy());
+    CHECK(Wire.available() == 0);                           // the staged byte was dropped
+  #endif
+  CHECK(dev.starts == 2);                                   // nothing was sent
+}
+#endif
+
+#if defined(TWI_RETRY_ENABLE)
+static void test_retry_arbitration(void) {
+  SimRecorder dev(0x20);
+  TwiSim::attach(TWI0, &dev);
+  Wire.begin();
+  Wire.setRetry(3, 100);
+  TwiSim::faults(TWI0).arbitrationLost = 2;
+  uint64_t start = TwiSim::nanos();
+  Wire.beginTransmission(0x20);
+  Wire.write(pattern, 3);
+  CHECK(Wire.endTransmission() == 3);                       // the staged bytes were sent on the third attempt
+  CHECK(TwiSim::nanos() - start >= 300000);                 // 100us + 200us backoff
+  CHECK(dev.receivedCount == 3);
+  CHECK(dev.received[0] == 0x11 && dev.received[2] == 0x33);
+  #if defined(TWI_ERROR_ENABLED)
+    CHECK(Wire.returnError() == TWI_NO_ERR);
+  #endif
+
+  TwiSim::faults(TWI0).arbitrationLost = 3;                 // more than the attempts
+  Wire.beginTransmission(0x20);
+  Wire.write(pattern, 3);
+  CHECK(Wire.endTransmission() == 0);
+  #if defined(TWI_ERROR_ENABLED)
+    CHECK(Wire.returnError() == TWI_ERR_BUS_ARB);
+  #endif
+  CHECK(dev.receivedCount == 3);
+  CHECK(busState(TWI0) == TWI_BUSSTATE_IDLE_gc);
+}
+
+static void test_retry_nack(void) {
+  SimRecorder dev(0x20);
+  TwiSim::attach(TWI0, &dev);
+  Wire.begin();
+  dev.nackAddress = true;
+  Wire.setRetry(4, 50);                                     // only arbitration
+  CHECK(writeOneByte() == 0);
+  CHECK(dev.starts == 1);
+  Wire.setRetry(4, 50, TWI_RETRY_ARBLOST | TWI_RETRY_NACK);
+  dev.starts = 0;
+  CHECK(writeOneByte() == 0);
+  CHECK(dev.starts == 4);
+  dev.starts = 0;
+  CHECK(Wire.requestFrom(0x20, 2) == 0);
+  CHECK(dev.starts == 4);
+  CHECK(busState(TWI0) == TWI_BUSSTATE_IDLE_gc);
+}
+
+static void test_retry_read(void) {
+  SimRecorder dev(0x20);
+  TwiSim::attach(TWI0, &dev);
+  dev.respond(pattern, 3);
+  Wire.begin();
+  Wire.setRetry(2, 10);
+  TwiSim::faults(TWI0).arbitrationLost = 1;
+  CHECK(Wire.requestFrom(0x20, 3) == 3);
+  CHECK(Wire.read() == 0x11);
+  CHECK(Wire.read() == 0x22);
+  CHECK(Wire.read() == 0x33);
+  CHECK(Wire.available() == 0);
+}
+#endif
+
+
+/* Client */
+static uint8_t  received[32];
+static int      receivedCount;
+static int      requests;
+
+static void onReceiveHandler(int count) {
+  receivedCount = 0;
+  while (Wire.available() && receivedCount < (int)sizeof(received)) {
+    received[receivedCount++] = Wire.read();
+  }
+  (void)count;
+}
+
+static void onRequestHandler(void) {
+  requests++;
+  Wire.write(pattern, 3);
+}
+
+#if !defined(TWI_SLAVE_DEFERRED)
+static void test_slave_receive(void) {
+  Wire.begin(0x30);
+  Wire.onReceive(onReceiveHandler);
+  receivedCount = 0;
+  CHECK(TwiSim::hostWrite(TWI0, 0x30, pattern, 4) == 4);
+  CHECK(receivedCount == 4);
+  CHECK(received[0] == 0x11 && received[3] == 0x44);
+  CHECK(TwiSim::hostWrite(TWI0, 0x30, pattern + 4, 2) == 2);
+  CHECK(receivedCount == 2);
+  CHECK(received[0] == 0x55);
+  CHECK(TwiSim::hostWrite(TWI0, 0x31, pattern, 1) == -1);
+
+  uint16_t complete = 0;                                    // many more bytes than the buffer holds, one message at a time
+  for (uint8_t i = 0; i < 100; i++) {
+    receivedCount = 0;
+    if ((TwiSim::hostWrite(TWI0, 0x30, pattern, 8) == 8) && (receivedCount == 8) && (received[7] == 0x88)) {
+      complete++;
+    }
+  }
+  CHECK(complete == 100);
+  CHECK(Wire.available() == 0);
+}
+
+static void test_buffer_full(void) {
+  #if defined(TWI_LINEAR_BUFFERS)
+    const int txRoom = TWI_TX_BUFFER_LENGTH;                // the whole buffer, every transaction starts at 0
+    const int rxRoom = TWI_RX_BUFFER_LENGTH_S;
+  #else
+    const int txRoom = TWI_TX_BUFFER_LENGTH - 1;            // one byte stays free in a ring buffer
+    const int rxRoom = TWI_RX_BUFFER_LENGTH_S - 1;
+  #endif
+  static uint8_t data[300];
+  Wire.begin();
+  Wire.beginTransmission(0x20);
+  int accepted = 0;
+  for (uint16_t i = 0; i < sizeof(data); i++) {
+    accepted += Wire.write((uint8_t)i);
+  }
+  CHECK(accepted == txRoom);
+  Wire.beginTransmission(0x20);                             // nothing is left for the next test
+  Wire.end();
+
+  Wire.begin(0x30);
+  Wire.onReceive(onReceiveHandler);
+  CHECK(TwiSim::hostWrite(TWI0, 0x30, data, sizeof(data)) == rxRoom);   // the next byte is NACKed
+}
+#endif
+
+static void test_slave_request(void) {
+  Wire.begin(0x30);
+  Wire.onRequest(onRequestHandler);
+  requests = 0;
+  uint8_t buf[5];
+  CHECK(TwiSim::hostRead(TWI0, 0x30, buf, 3) == 3);
+  CHECK(requests == 1);
+  CHECK(memcmp(buf, pattern, 3) == 0);
+  CHECK(TwiSim::hostRead(TWI0, 0x30, buf, 5) == 5);    // more than the client has
+  CHECK(requests == 2);
+  CHECK(buf[2] == 0x33 && buf[3] == 0xFF && buf[4] == 0xFF);
+}
+
+#if defined(TWI_SMBUS_PEC)
+static void test_smbus_pec_client(void) {
+  Wire.begin(0x30);
+  Wire.onReceive(onReceiveHandler);
+  Wire.onRequest(onRequestHandler);
+  Wire.setPEC(TWI_PEC_CLIENT);
+  receivedCount = 0;
+  requests = 0;
+  const uint8_t frame[] = {0x60, 0x11, 0x22, 0x33};
+  uint8_t write[] = {0x11, 0x22, 0x33, smbusPec(frame, sizeof(frame))};
+  CHECK(TwiSim::hostWrite(TWI0, 0x30, write, 4) == 4);
+  CHECK(receivedCount == 3);                                // without the PEC
+  CHECK(received[0] == 0x11 && received[2] == 0x33);
+  write[1] ^= 0x80;
+  receivedCount = 0;
+  CHECK(TwiSim::hostWrite(TWI0, 0x30, write, 4) == 4);
+  CHECK(receivedCount == 0);                                // dismissed at the STOP
+  CHECK(Wire.available() == 0);
+
+  uint8_t buf[5];
+  const uint8_t sent[] = {0x61, 0x11, 0x22, 0x33};
+  CHECK(TwiSim::hostRead(TWI0, 0x30, buf, 5) == 5);
+  CHECK(requests == 1);
+  CHECK(memcmp(buf, pattern, 3) == 0);
+  CHECK(buf[3] == smbusPec(sent, sizeof(sent)));           // after what onRequest wrote
+  CHECK(buf[4] == 0xFF);                                    // and only once
+
+  const uint8_t command = 0x05;                             // read with REP START, one CRC over both
+  const uint8_t both[] = {0x60, 0x05, 0x61, 0x11, 0x22, 0x33};
+  CHECK(TwiSim::hostWrite(TWI0, 0x30, &command, 1, false) == 1);
+  CHECK(TwiSim::hostRead(TWI0, 0x30, buf, 4) == 4);
+  CHECK(receivedCount == 1 && received[0] == 0x05);         // unchecked, the PEC comes with the read
+  CHECK(buf[3] == smbusPec(both, sizeof(both)));
+  receivedCount = 0;
+  CHECK(TwiSim::hostWrite(TWI0, 0x30, write, 4) == 4);     // the next one starts over, still wrong
+  CHECK(receivedCount == 0);
+}
+#endif
+
+#if defined(TWI_10BIT_ADDRESS) && !defined(TWI_SLAVE_DEFERRED)
+static void test_ten_bit_client(void) {
+  Wire.begin10(0x2A5);
+  Wire.onReceive(onReceiveHandler);
+  Wire.onRequest(onRequestHandler);
+  receivedCount = 0;
+  requests = 0;
+  const uint8_t write[] = {0xA5, 0x11, 0x22};               // second address byte, then data
+  CHECK(TwiSim::hostWrite(TWI0, 0x7A, write, 3) == 3);
+  CHECK(receivedCount == 2);
+  CHECK(received[0] == 0x11 && received[1] == 0x22);
+
+  uint8_t buf[3];
+  CHECK(TwiSim::hostRead(TWI0, 0x7A, buf, 3) == -1);        // not selected by a write before
+  CHECK(requests == 0);
+  CHECK(TwiSim::hostWrite(TWI0, 0x7A, write, 1, false) == 1);
+  CHECK(TwiSim::hostRead(TWI0, 0x7A, buf, 3) == 3);         // REP START after the full address
+  CHECK(requests == 1);
+  CHECK(memcmp(buf, pattern, 3) == 0);
+
+  const uint8_t other[] = {0xA4, 0x11};                     // same first byte, another client
+  receivedCount = 0;
+  CHECK(TwiSim::hostWrite(TWI0, 0x7A, other, 2) == 0);
+  CHECK(receivedCount == 0);
+  CHECK(TwiSim::hostWrite(TWI0, 0x7A, other, 1, false) == 0);
+  CHECK(TwiSim::hostRead(TWI0, 0x7A, buf, 3) == -1);
+  CHECK(requests == 1);
+  TwiSim::hostWrite(TWI0, 0x7A, NULL, 0);                  // only the STOP
+
+  Wire.end();
+  Wire.begin(0x30);                                         // a 7-bit address again
+  receivedCount = 0;
+  CHECK(TwiSim::hostWrite(TWI0, 0x30, write, 3) == 3);
+  CHECK(receivedCount == 3 && received[0] == 0xA5);
+}
+#endif
+
+#if !defined(TWI_SLAVE_DEFERRED)
+static void test_slave_second_address(void) {
+  Wire.begin(0x30, false, (0x40 << 1) | TWI_ADDREN_bm);
+  Wire.onReceive(onReceiveHandler);
+  receivedCount = 0;
+  CHECK(TwiSim::hostWrite(TWI0, 0x40, pattern, 2) == 2);
+  CHECK(receivedCount == 2);
+  CHECK(Wire.getIncomingAddress() == (0x40 << 1));
+}
+#endif
+
+
+#if defined(TWI_SLAVE_REGISTERS)
+static void test_slave_registers(void) {
+  uint8_t regs[4] = {0xA0, 0xA1, 0xA2, 0xA3};
+  static const uint8_t protect[4] = {0xFF, 0x00, 0xF0, 0x00};
+  Wire.begin(0x30);
+  Wire.onReceive(onReceiveHandler);
+  Wire.onRequest(onRequestHandler);
+  Wire.setSlaveRegisters(regs, 4, protect);
+  receivedCount = 0;
+  requests = 0;
+  const uint8_t write[] = {1, 0x11, 0x2C, 0x33};    // pointer, then registers 1 to 3
+  CHECK(TwiSim::hostWrite(TWI0, 0x30, write, 4) == 4);
+  CHECK(regs[0] == 0xA0 && regs[1] == 0x11 && regs[2] == 0xAC && regs[3] == 0x33);
+  const uint8_t wrap[] = {3, 0x44, 0x55};           // register 0 is write protected
+  CHECK(TwiSim::hostWrite(TWI0, 0x30, wrap, 3) == 3);
+  CHECK(regs[3] == 0x44 && regs[0] == 0xA0);
+  uint8_t buf[3];
+  CHECK(TwiSim::hostWrite(TWI0, 0x30, wrap, 1, false) == 1);   // pointer, then REP START
+  CHECK(TwiSim::hostRead(TWI0, 0x30, buf, 3) == 3);
+  CHECK(buf[0] == 0x44 && buf[1] == 0xA0 && buf[2] == 0x11);
+  CHECK(TwiSim::hostRead(TWI0, 0x30, buf, 1) == 1);          // continues where the last read ended
+  CHECK(buf[0] == 0xAC);
+  const uint8_t invalid[] = {4, 0x55};
+  CHECK(TwiSim::hostWrite(TWI0, 0x30, invalid, 2) == 0 + REFUSED_LATE);  // there is no register 4
+  CHECK(receivedCount == 0 && requests == 0);
+  Wire.setSlaveRegisters(NULL, 0);
+  CHECK(TwiSim::hostWrite(TWI0, 0x30, pattern, 2) == 2);
+  CHECK(receivedCount == 2);
+}
+#endif
+
+
+#if defined(TWI_SLAVE_RESPONSE)
+static uint8_t page[512];
+
+static void onRequestPage(void) {
+  requests++;
+  Wire.setSlaveResponse(page + 256, 256);
+}
+
+static void test_slave_response(void) {
+  for (uint16_t i = 0; i < sizeof(page); i++) {
+    page[i] = (uint8_t)(i ^ (i >> 8));
+  }
+  static uint8_t buf[sizeof(page) + 1];
+  Wire.begin(0x30);
+  Wire.onRequest(onRequestHandler);
+  Wire.setSlaveResponse(page, sizeof(page));          // longer than any transmit buffer
+  requests = 0;
+  CHECK(TwiSim::hostRead(TWI0, 0x30, buf, sizeof(page) + 1) == sizeof(page) + 1);
+  CHECK(memcmp(buf, page, sizeof(page)) == 0);
+  CHECK(buf[sizeof(page)] == 0xFF);                 // more than the response
+  CHECK(requests == 1);                             // onRequest is still called, its write() is not used
+  CHECK(TwiSim::hostRead(TWI0, 0x30, buf, 2) == 2);  // every read starts over
+  CHECK(buf[0] == page[0] && buf[1] == page[1]);
+
+  Wire.onRequest(onRequestPage);                    // set from the callback
+  CHECK(TwiSim::hostRead(TWI0, 0x30, buf, 3) == 3);
+  CHECK(memcmp(buf, page + 256, 3) == 0);
+
+  Wire.onRequest(onRequestHandler);
+  Wire.setSlaveResponse(NULL, 0);                   // back to write()
+  CHECK(TwiSim::hostRead(TWI0, 0x30, buf, 3) == 3);
+  CHECK(memcmp(buf, pattern, 3) == 0);
+}
+#endif
+
+
+#if defined(TWI_SLAVE_ARMED)
+static void test_slave_armed(void) {
+  uint8_t buf[4];
+  uint8_t response[3] = {0xA1, 0xA2, 0xA3};
+  Wire.begin(0x30);
+  Wire.onRequest(onRequestHandler);
+  requests = 0;
+  CHECK(Wire.armSlaveResponse(response, 3) == 3);
+  response[0] = 0x00;                           // it was copied
+  CHECK(TwiSim::hostRead(TWI0, 0x30, buf, 4) == 4);
+  CHECK(buf[0] == 0xA1 && buf[2] == 0xA3 && buf[3] == 0xFF);
+  CHECK(TwiSim::hostRead(TWI0, 0x30, buf, 2) == 2);  // sent again until the next one is armed
+  CHECK(buf[0] == 0xA1 && buf[1] == 0xA2);
+
+  CHECK(Wire.armSlaveResponse(pattern, 2) == 2);
+  CHECK(Wire.armSlaveResponse(pattern + 4, 3) == 3);  // replaces the one that wasn't sent yet
+  CHECK(TwiSim::hostRead(TWI0, 0x30, buf, 3) == 3);
+  CHECK(memcmp(buf, pattern + 4, 3) == 0);
+  CHECK(Wire.armSlaveResponse(pattern, 1) == 1);      // goes to the buffer that was sent before
+  CHECK(TwiSim::hostRead(TWI0, 0x30, buf, 2) == 2);
+  CHECK(buf[0] == 0x11 && buf[1] == 0xFF);
+  CHECK(requests == 0);                         // the host was never kept waiting for onRequest
+
+  static uint8_t tooLong[TWI_SLAVE_ARMED_LENGTH + 1];
+  CHECK(Wire.armSlaveResponse(tooLong, sizeof(tooLong)) == TWI_SLAVE_ARMED_LENGTH);
+
+  Wire.setSlaveResponse(NULL, 0);               // back to onRequest
+  CHECK(TwiSim::hostRead(TWI0, 0x30, buf, 3) == 3);
+  CHECK(requests == 1 && memcmp(buf, pattern, 3) == 0);
+}
+#endif
+
+
+#if defined(TWI_SLAVE_DEFERRED) && !defined(TWI_SLAVE_QUEUE)
+static void test_slave_deferred(void) {
+  uint8_t buf[TWI_SLAVE_MESSAGE_LENGTH + 1];
+  Wire.begin(0x30);
+  Wire.onReceive(onReceiveHandler);
+  receivedCount = 0;
+  CHECK(Wire.slaveMessageAvailable() == 0);
+  for (uint8_t i = 0; i < TWI_SLAVE_MESSAGES; i++) {   // a burst before loop() gets to it
+    CHECK(TwiSim::hostWrite(TWI0, 0x30, pattern + i, i + 1) == i + 1);
+  }
+  CHECK(TwiSim::hostWrite(TWI0, 0x30, pattern, 1) == -1);  // no free buffer, the address is NACKed
+  CHECK(receivedCount == 0);
+  #if defined(TWI_MANDS)                        // the host is independent of it
+    SimRecorder dev(0x20);
+    TwiSim::attach(TWI0, &dev);
+    Wire.begin();
+    Wire.beginTransmission(0x20);
+    Wire.write(pattern, 2);
+    CHECK(Wire.endTransmission() == 2);
+  #endif
+  for (uint8_t i = 0; i < TWI_SLAVE_MESSAGES; i++) {
+    CHECK(Wire.slaveMessageAvailable() == i + 1);
+    CHECK(Wire.readSlaveMessage(buf, sizeof(buf)) == i + 1);
+    CHECK(memcmp(buf, pattern + i, i + 1) == 0);
+    if (i == 0) {                               // a buffer is free again
+      CHECK(TwiSim::hostWrite(TWI0, 0x30, pattern + 4, 3) == 3);
+    }
+  }
+  CHECK(Wire.readSlaveMessage(buf, 2) == 2);     // shorter buffer, the rest is dismissed
+  CHECK(buf[0] == 0x55 && buf[1] == 0x66);
+  CHECK(Wire.slaveMessageAvailable() == 0);
+  CHECK(Wire.readSlaveMessage(buf, sizeof(buf)) == 0);
+
+  CHECK(TwiSim::hostWrite(TWI0, 0x30, pattern, 2, false) == 2);  // write, REPSTART, read
+  CHECK(TwiSim::hostRead(TWI0, 0x30, buf, 1) == 1);
+  uint8_t address = 0;
+  CHECK(Wire.readSlaveMessage(buf, sizeof(buf), &address) == 2);
+  CHECK(buf[0] == 0x11 && buf[1] == 0x22 && address == (0x30 << 1));
+
+  static uint8_t longMessage[TWI_SLAVE_MESSAGE_LENGTH + 1];
+  CHECK(TwiSim::hostWrite(TWI0, 0x30, longMessage, sizeof(longMessage)) == TWI_SLAVE_MESSAGE_LENGTH + REFUSED_LATE);
+  CHECK(Wire.slaveMessageAvailable() == 0);      // NACKed and dismissed
+  CHECK(receivedCount == 0);
+}
+#endif
+
+
+#if defined(TWI_SLAVE_QUEUE)
+static void test_slave_queue(void) {
+  uint8_t buf[8];
+  uint8_t address;
+  uint8_t accepted = 0;
+  Wire.begin(0x30, false, (0x40 << 1) | TWI_ADDREN_bm);
+  Wire.onReceive(onReceiveHandler);
+  receivedCount = 0;
+  while (TwiSim::hostWrite(TWI0, (accepted & 1) ? 0x40 : 0x30, pattern + (accepted & 3), 3) == 3) {
+    accepted++;                                 // a burst of commands, 5 bytes each in the queue
+  }
+  CHECK(accepted == (TWI_SLAVE_QUEUE_LENGTH - 1) / 5);
+  for (uint8_t i = 0; i < 2; i++) {
+    CHECK(Wire.slaveMessageAvailable() == 3);
+    CHECK(Wire.readSlaveMessage(buf, sizeof(buf), &address) == 3);
+    CHECK(memcmp(buf, pattern + i, 3) == 0);
+    CHECK(address == (i ? (0x40 << 1) : (0x30 << 1)));
+  }
+  CHECK(TwiSim::hostWrite(TWI0, 0x30, pattern, 8) == 8);   // wraps around the end of the queue
+  for (uint8_t i = 2; i < accepted; i++) {
+    CHECK(Wire.readSlaveMessage(buf, sizeof(buf)) == 3);
+    CHECK(memcmp(buf, pattern + (i & 3), 3) == 0);
+  }
+  CHECK(Wire.readSlaveMessage(buf, sizeof(buf), &address) == 8);
+  CHECK(memcmp(buf, pattern, 8) == 0 && address == (0x30 << 1));
+  CHECK(Wire.slaveMessageAvailable() == 0);
+
+  static uint8_t longMessage[TWI_SLAVE_QUEUE_LENGTH];
+  CHECK(TwiSim::hostWrite(TWI0, 0x30, pattern, 2, false) == 2);  // two messages, split by a REPSTART
+  CHECK(TwiSim::hostWrite(TWI0, 0x30, longMessage, sizeof(longMessage)) < (int)sizeof(longMessage));
+  CHECK(Wire.readSlaveMessage(buf, sizeof(buf)) == 2);
+  CHECK(Wire.slaveMessageAvailable() == 0);      // the long one was NACKed and dismissed
+  CHECK(TwiSim::hostWrite(TWI0, 0x30, pattern, 1) == 1);
+  CHECK(Wire.readSlaveMessage(buf, sizeof(buf)) == 1 && buf[0] == 0x11);
+  CHECK(receivedCount == 0);
+}
+#endif
+
+
+#if defined(TWI_MANDS) && !defined(TWI_SLAVE_DEFERRED)
+static void test_mands(void) {
+  SimRecorder dev(0x20);
+  TwiSim::attach(TWI0, &dev);
+  Wire.begin();
+  Wire.begin(0x30);
+  Wire.onReceive(onReceiveHandler);
+  Wire.onRequest(onRequestHandler);
+  receivedCount = 0;
+  Wire.beginTransmission(0x20);
+  Wire.write(pattern, 4);
+  CHECK(TwiSim::hostWrite(TWI0, 0x30, pattern + 4, 3) == 3);   // arrives between write() and endTransmission()
+  CHECK(receivedCount == 3 && received[0] == 0x55);
+  CHECK(Wire.endTransmission() == 4);
+  CHECK(dev.receivedCount == 4 && dev.received[3] == 0x44);
+  uint8_t buf[3];
+  CHECK(TwiSim::hostRead(TWI0, 0x30, buf, 3) == 3);
+  CHECK(memcmp(buf, pattern, 3) == 0);
+}
+#endif
+
+
+#if defined(TWI_MASTER_ASYNC)
+static volatile uint8_t completeStatus;
+static volatile uint8_t completeCount;
+
+static void onComplete(uint8_t status) {
+  completeStatus = status;
+  completeCount++;
+}
+
+static void onTransactionComplete(struct twiTransaction *xfer) {
+  (void)xfer;
+  completeCount++;
+}
+
+static void test_async_write(void) {
+  SimRecorder dev(0x20);
+  TwiSim::attach(TWI0, &dev);
+  TwiSim::setInterruptsDeferred(true);
+  Wire.begin();
+  Wire.onMasterComplete(onComplete);
+  completeCount = 0;
+  Wire.beginTransmission(0x20);
+  Wire.write(pattern, 4);
+  CHECK(Wire.endTransmissionAsync() == TWI_NO_ERR);
+  CHECK(Wire.masterBusy());
+  CHECK(TwiSim::interruptPending());
+  TwiSim::service();
+  CHECK(!Wire.masterBusy());
+  CHECK(completeCount == 1);
+  CHECK(completeStatus == TWI_NO_ERR);
+  CHECK(dev.receivedCount == 4);
+  CHECK(TwiSim::interrupts() >= 5);         // address and four data bytes
+}
+
+static void test_async_read(void) {
+  SimRecorder dev(0x20);
+  dev.respond(pattern, 6);
+  TwiSim::attach(TWI0, &dev);
+  Wire.begin();
+  CHECK(Wire.requestFromAsync(0x20, 6) == TWI_NO_ERR);
+  CHECK(!Wire.masterBusy());                // interrupts are taken right away
+  CHECK(Wire.masterStatus() == TWI_NO_ERR);
+  CHECK(Wire.available() == 6);
+  CHECK(Wire.read() == 0x11);
+}
+
+static void test_async_queue(void) {
+  SimRegisterDevice dev(0x50);
+  dev.regs[0x08] = 0xC8;
+  TwiSim::attach(TWI0, &dev);
+  TwiSim::setInterruptsDeferred(true);
+  Wire.begin();
+  completeCount = 0;
+  static const uint8_t setReg[] = {0x00, 0x01, 0x02};
+  static const uint8_t ptr[]    = {0x08};
+  uint8_t in[1] = {0};
+  WireTransaction first(0x50, setReg, sizeof(setReg), NULL, 0, true, onTransactionComplete);
+  WireTransaction second(0x50, ptr, sizeof(ptr), in, sizeof(in), true, onTransactionComplete);
+  CHECK(Wire.enqueue(&first) == TWI_NO_ERR);
+  CHECK(Wire.enqueue(&second) == TWI_NO_ERR);
+  CHECK(first.busy() && second.busy());
+  TwiSim::service();
+  CHECK(!first.busy() && !second.busy());
+  CHECK(completeCount == 2);
+  CHECK(dev.regs[0x00] == 0x01 && dev.regs[0x01] == 0x02);
+  CHECK(second.status == TWI_NO_ERR && second.rxCount == 1);
+  CHECK(in[0] == 0xC8);
+}
+
+static void test_async_nack(void) {
+  TwiSim::setInterruptsDeferred(true);
+  Wire.begin();
+  Wire.beginTransmission(0x22);
+  Wire.write(0x01);
+  Wire.endTransmissionAsync();
+  TwiSim::service();
+  CHECK(!Wire.masterBusy());
+  CHECK(Wire.masterStatus() == TWI_ERR_RXACK);
+  CHECK(busState(TWI0) == TWI_BUSSTATE_IDLE_gc);
+}
+
+static void test_async_end(void) {
+  SimRecorder dev(0x20);
+  TwiSim::attach(TWI0, &dev);
+  TwiSim::setInterruptsDeferred(true);
+  Wire.begin();
+  Wire.onMasterComplete(onComplete);
+  completeCount = 0;
+  WireTransaction queued(0x20, pattern, 2, NULL, 0, true, onTransactionComplete);
+  Wire.beginTransmission(0x20);
+  Wire.write(pattern, 4);
+  CHECK(Wire.endTransmissionAsync() == TWI_NO_ERR);
+  CHECK(Wire.enqueue(&queued) == TWI_NO_ERR);
+  Wire.end();                               // before the engine got to run
+  CHECK(!Wire.masterBusy() && !queued.busy());
+  CHECK(Wire.masterStatus() == TWI_ERR_ABORTED);
+  CHECK(queued.status == TWI_ERR_ABORTED);
+  CHECK(completeCount == 0);
+
+  Wire.begin();
+  Wire.beginTransmission(0x20);
+  Wire.write(pattern, 4);
+  CHECK(Wire.endTransmissionAsync() == TWI_NO_ERR);   // not TWI_ERR_BUSY
+  CHECK(Wire.enqueue(&queued) == TWI_NO_ERR);
+  TwiSim::service();
+  CHECK(!Wire.masterBusy());
+  CHECK(Wire.masterStatus() == TWI_NO_ERR && queued.status == TWI_NO_ERR);
+  CHECK(completeCount == 2);
+  CHECK(dev.receivedCount == 6);
+}
+
+static void test_async_timeout(void) {
+  SimRecorder dev(0x20);
+  dev.holdClock = true;
+  TwiSim::attach(TWI0, &dev);
+  Wire.begin();
+  Wire.beginTransmission(0x20);
+  Wire.write(pattern, 2);
+  CHECK(Wire.endTransmissionAsync() == TWI_NO_ERR);
+  CHECK(Wire.masterBusy());                 // the client holds SCL, the engine makes no progress
+
+  uint64_t start = TwiSim::nanos();
+  CHECK(Wire.requestFrom(0x20, 1) == 0);    // does not wait for the engine forever
+  CHECK(TwiSim::nanos() - start < 2000ULL * TWI_TIMEOUT_DEFAULT);
+  CHECK(!Wire.masterBusy());
+  CHECK(Wire.masterStatus() == TWI_ERR_TIMEOUT);
+  CHECK(Wire.getWireTimeoutFlag());
+
+  dev.holdClock = false;
+  Wire.beginTransmission(0x20);
+  Wire.write(pattern, 2);
+  CHECK(Wire.endTransmissionAsync() == TWI_NO_ERR);   // the transaction was handed back
+  CHECK(!Wire.masterBusy());
+  CHECK(Wire.masterStatus() == TWI_NO_ERR);
+  CHECK(busState(TWI0) == TWI_BUSSTATE_IDLE_gc);
+}
+#endif
+
+
+#if defined(USING_WIRE1)
+static void test_wire1(void) {
+  SimRecorder dev0(0x20);
+  SimRecorder dev1(0x20);
+  TwiSim::attach(TWI0, &dev0);
+  TwiSim::attach(TWI1, &dev1);
+  Wire.begin();
+  Wire1.begin();
+  Wire1.beginTransmission(0x20);
+  Wire1.write(pattern, 2);
+  CHECK(Wire1.endTransmission() == 2);
+  CHECK(dev1.receivedCount == 2);
+  CHECK(dev0.receivedCount == 0);
+}
+#endif
+
+#if defined(TWI_INSTANCE_BUFFERS) && !defined(TWI_SLAVE_DEFERRED)
+static int wire1Received;
+
+static void onReceiveWire1(int count) {
+  wire1Received = count;
+}
+
+static void test_wire1_lengths(void) {
+  #if defined(TWI_LINEAR_BUFFERS)
+    const int free = 0;                                     // every transaction starts at 0
+  #else
+    const int free = 1;                                     // one byte stays free in a ring buffer
+  #endif
+  #if defined(TWI_MANDS)
+    const int rxRoom1 = TWI1_RX_BUFFER_LENGTH_S - free;
+  #else
+    const int rxRoom1 = TWI1_RX_BUFFER_LENGTH - free;
+  #endif
+  static uint8_t data[300];
+  Wire.begin();
+  Wire1.begin();
+  Wire.beginTransmission(0x20);
+  Wire1.beginTransmission(0x20);
+  int accepted = 0, accepted1 = 0;
+  for (uint16_t i = 0; i < sizeof(data); i++) {
+    accepted  += Wire.write((uint8_t)i);
+    accepted1 += Wire1.write((uint8_t)i);
+  }
+  CHECK(accepted  == TWI_TX_BUFFER_LENGTH - free);
+  CHECK(accepted1 == TWI1_TX_BUFFER_LENGTH - free);
+  Wire.beginTransmission(0x20);                             // nothing is left for the next test
+  Wire1.beginTransmission(0x20);
+  Wire1.end();
+
+  Wire1.begin(0x30);
+  Wire1.onReceive(onReceiveWire1);
+  wire1Received = 0;
+  CHECK(TwiSim::hostWrite(TWI1, 0x30, data, rxRoom1) == rxRoom1);
+  CHECK(wire1Received == rxRoom1);
+  CHECK(TwiSim::hostWrite(TWI1, 0x30, data, sizeof(data)) == rxRoom1);   // the next byte is NACKed
+}
+#endif
+
+
+int main(void) {
+  RUN(test_master_write);
+  RUN(test_master_write_no_client);
+  RUN(test_master_write_data_nack);
+  RUN(test_master_read);
+  #if defined(TWI_MASTER_SMART)
+    RUN(test_master_read_smart);
+  #endif
+  RUN(test_write_read);
+  RUN(test_rep_start_without_stop);
+  RUN(test_zero_copy);
+  RUN(test_arbitration_lost);
+  RUN(test_clock_hold);
+  #if defined(TWI_TIMEOUT_SETTINGS)
+    RUN(test_timeout);
+  #endif
+  RUN(test_bus_recovery);
+  #if defined(TWI_TIMEOUT_SETTINGS)
+    RUN(test_bus_recovery_auto);
+  #endif
+  RUN(test_scan);
+  #if defined(TWI_GET_CLOCK)
+    RUN(test_clock);
+  #endif
+  RUN(test_baud_sweep);
+  #if defined(TWI_SMBUS_PEC)
+    RUN(test_smbus_pec_host);
+  #endif
+  #if defined(TWI_SMBUS_BLOCK)
+    RUN(test_smbus_block);
+  #endif
+  #if defined(TWI_10BIT_ADDRESS)
+    RUN(test_ten_bit_host);
+    RUN(test_ten_bit_engine);
+  #endif
+  #if defined(TWI_RETRY_ENABLE)
+    RUN(test_retry_arbitration);
+    RUN(test_retry_nack);
+    RUN(test_retry_read);
+  #endif
+  #if !defined(TWI_SLAVE_DEFERRED)             // onReceive is not used then
+    RUN(test_slave_receive);
+    RUN(test_buffer_full);
+  #endif
+  RUN(test_slave_request);
+  #if defined(TWI_SMBUS_PEC)
+    RUN(test_smbus_pec_client);
+  #endif
+  #if defined(TWI_10BIT_ADDRESS) && !defined(TWI_SLAVE_DEFERRED)
+    RUN(test_ten_bit_client);
+  #endif
+  #if !defined(TWI_SLAVE_DEFERRED)
+    RUN(test_slave_second_address);
+  #elif defined(TWI_SLAVE_QUEUE)
+    RUN(test_slave_queue);
+  #else
+    RUN(test_slave_deferred);
+  #endif
+  #if defined(TWI_SLAVE_REGISTERS)
+    RUN(test_slave_registers);
+  #endif
+  #if defined(TWI_SLAVE_RESPONSE)
+    RUN(test_slave_response);
+  #endif
+  #if defined(TWI_SLAVE_ARMED)
+    RUN(test_slave_armed);
+  #endif
+  #if defined(TWI_MANDS) && !defined(TWI_SLAVE_DEFERRED)
+    RUN(test_mands);
+  #endif
+  #if defined(TWI_MASTER_ASYNC)
+    RUN(test_async_write);
+    RUN(test_async_read);
+    RUN(test_async_queue);
+    RUN(test_async_nack);
+    RUN(test_async_end);
+    RUN(test_async_timeout);
+  #endif
+  #if defined(USING_WIRE1)
+    RUN(test_wire1);
+  #endif
+  #if defined(TWI_INSTANCE_BUFFERS) && !defined(TWI_SLAVE_DEFERRED)
+    RUN(test_wire1_lengths);
+  #endif
+  printf("%d checks, %d failed\n", checks, failures);
+  return failures;
+}
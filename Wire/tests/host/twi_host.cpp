@@ -0,0 +1,8 @@
+/* The C sources are compiled as C++, so the TWI registers can be the TwiSimReg stand-ins.
+ * Wire.h includes twi.h with C linkage, so they are wrapped the same way here.
+ */
+#include "Arduino.h"
+
+extern "C" {
+  #include "twi.c"
+}
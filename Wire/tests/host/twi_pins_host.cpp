@@ -0,0 +1,6 @@
+/* See twi_host.cpp */
+#include "Arduino.h"
+
+extern "C" {
+  #include "twi_pins.c"
+}
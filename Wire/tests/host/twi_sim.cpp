@@ -0,0 +1,890 @@
+/* twi_sim.cpp - register level model of the AVR TWI peripheral and a simulated bus
+
+  See twi_sim.h for an overview. Flag and command handling follows the TWI chapter of the
+  AVR DA data sheet, with the bus reduced to what the library can observe through the registers.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "avr/io.h"
+#include "twi_sim.h"
+
+
+TWI_t      TwiSim_TWI0;
+TWI_t      TwiSim_TWI1;
+PORT_t     TwiSim_PORTA;
+PORT_t     TwiSim_PORTB;
+PORT_t     TwiSim_PORTC;
+PORT_t     TwiSim_PORTF;
+PORTMUX_t  TwiSim_PORTMUX;
+TwiSimSREG TwiSim_SREG = {CPU_I_bm};
+
+// Only the vectors of the active configuration are defined by Wire.cpp
+extern "C" void TWI0_TWIS_vect(void) __attribute__((weak));
+extern "C" void TWI0_TWIM_vect(void) __attribute__((weak));
+extern "C" void TWI1_TWIS_vect(void) __attribute__((weak));
+extern "C" void TWI1_TWIM_vect(void) __attribute__((weak));
+
+
+#define SIM_NO_SCMD      0xFF
+#define SIM_CYCLE_NS     (1000000000ULL / F_CPU)
+#define SIM_ACCESS_NS    (2 * SIM_CYCLE_NS)           // a lds/sts to the I/O space
+#define SIM_HOST_BIT_NS  10000ULL                     // external host runs at 100kHz
+
+#define MSTATUS_FLAGS    (TWI_RIF_bm | TWI_WIF_bm | TWI_CLKHOLD_bm | TWI_ARBLOST_bm | TWI_BUSERR_bm)
+#define SSTATUS_FLAGS    (TWI_DIF_bm | TWI_APIF_bm | TWI_COLL_bm | TWI_BUSERR_bm)
+
+enum {
+  REG_CTRLA = 0, REG_DUALCTRL, REG_DBGCTRL, REG_MCTRLA, REG_MCTRLB, REG_MSTATUS, REG_MBAUD, REG_MADDR,
+  REG_MDATA, REG_SCTRLA, REG_SCTRLB, REG_SSTATUS, REG_SADDR, REG_SDATA, REG_SADDRMASK, REG_COUNT
+};
+
+struct SimModule {
+  TWI_t        *regs;
+  void        (*masterVector)(void);
+  void        (*slaveVector)(void);
+  SimDevice    *devices;            // linked list of attached clients
+  SimBusFaults  faults;
+  SimDevice    *client;             // client addressed by the host, NULL if the address was NACKed
+  bool          reading;
+  bool          held;               // the client stretches SCL
+  uint8_t       scmd;               // last SCMD written by the client code, SIM_NO_SCMD if none
+  bool          sack;               // ACKACT of that command was ACK
+  uint8_t       sdataOut;           // SDATA when the command was written
+  bool          slaveAddressed;
+  uint16_t      riseNs;             // rise time of SCL
+};
+
+static SimModule modules[2];
+static bool      deferred;
+static uint64_t  nowNs;
+static uint32_t  statAccesses;
+static uint32_t  statBytes;
+static uint64_t  statMasterNs;
+static uint32_t  statInterrupts;
+static uint32_t  statResponses;
+static uint32_t  statResponseAccesses;
+static uint32_t  isrEntryAccesses;
+static bool      inSlaveIsr;
+
+
+static void initModules(void) {
+  modules[0].regs         = &TwiSim_TWI0;
+  modules[0].masterVector = TWI0_TWIM_vect;
+  modules[0].slaveVector  = TWI0_TWIS_vect;
+  modules[1].regs         = &TwiSim_TWI1;
+  modules[1].masterVector = TWI1_TWIM_vect;
+  modules[1].slaveVector  = TWI1_TWIS_vect;
+}
+
+static SimModule &moduleOf(const TWI_t &module) {
+  if (modules[0].regs == NULL) {
+    initModules();
+  }
+  return (&module == &TwiSim_TWI1) ? modules[1] : modules[0];
+}
+
+static PORT_t *findPort(const void *reg, uint8_t *offset) {
+  static PORT_t *const ports[] = {&TwiSim_PORTA, &TwiSim_PORTB, &TwiSim_PORTC, &TwiSim_PORTF};
+  for (uint8_t i = 0; i < sizeof(ports) / sizeof(ports[0]); i++) {
+    const uint8_t *base = (const uint8_t *)ports[i];
+    const uint8_t *addr = (const uint8_t *)reg;
+    if (addr >= base && addr < base + sizeof(PORT_t)) {
+      *offset = (uint8_t)(addr - base);
+      return ports[i];
+    }
+  }
+  return NULL;
+}
+
+static SimModule *findRegister(const void *reg, uint8_t *offset) {
+  if (modules[0].regs == NULL) {
+    initModules();
+  }
+  for (uint8_t i = 0; i < 2; i++) {
+    const uint8_t *base = (const uint8_t *)modules[i].regs;
+    const uint8_t *addr = (const uint8_t *)reg;
+    if (addr >= base && addr < base + sizeof(TWI_t)) {
+      *offset = (uint8_t)(addr - base);
+      return &modules[i];
+    }
+  }
+  return NULL;
+}
+
+
+/* Time on the bus */
+static uint64_t masterBitNs(SimModule &m) {
+  // f_SCL = F_CPU / (10 + 2 * BAUD + F_CPU * t_rise)
+  return ((10ULL + 2ULL * m.regs->MBAUD.value) * 1000000000ULL) / F_CPU + m.riseNs;
+}
+
+static void masterByteTime(SimModule &m) {
+  uint64_t ns = 9 * masterBitNs(m);
+  nowNs        += ns;
+  statMasterNs += ns;
+  statBytes++;
+}
+
+static void hostByteTime(void) {
+  nowNs += 9 * SIM_HOST_BIT_NS;
+  statBytes++;
+}
+
+
+/* Interrupts */
+static bool masterPending(SimModule &m) {
+  uint8_t ctrl   = m.regs->MCTRLA.value;
+  uint8_t status = m.regs->MSTATUS.value;
+  if (!(ctrl & TWI_ENABLE_bm)) {
+    return false;
+  }
+  return ((ctrl & TWI_RIEN_bm) && (status & TWI_RIF_bm)) || ((ctrl & TWI_WIEN_bm) && (status & TWI_WIF_bm));
+}
+
+static bool slavePending(SimModule &m) {
+  uint8_t ctrl   = m.regs->SCTRLA.value;
+  uint8_t status = m.regs->SSTATUS.value;
+  if (!(ctrl & TWI_ENABLE_bm)) {
+    return false;
+  }
+  return ((ctrl & TWI_DIEN_bm) && (status & TWI_DIF_bm)) || ((ctrl & TWI_APIEN_bm) && (status & TWI_APIF_bm));
+}
+
+static void takeInterrupts(void) {
+  uint32_t guard = 0;
+  if (modules[0].regs == NULL) {                      // SREG written before anything else
+    initModules();
+  }
+  while (TwiSim_SREG.value & CPU_I_bm) {
+    void (*vector)(void) = NULL;
+    bool pending = false;
+    bool slave   = false;
+    for (uint8_t i = 0; i < 2 && !pending; i++) {   // the client vector has the lower address, so it wins
+      if (slavePending(modules[i])) {
+        vector  = modules[i].slaveVector;
+        pending = true;
+        slave   = true;
+      } else if (masterPending(modules[i])) {
+        vector  = modules[i].masterVector;
+        pending = true;
+      }
+    }
+    if (!pending) {
+      break;
+    }
+    if (vector == NULL) {
+      fprintf(stderr, "twi_sim: interrupt enabled, but no ISR defined - the AVR would reset here\n");
+      abort();
+    }
+    if (++guard > 100000) {
+      fprintf(stderr, "twi_sim: the interrupt flag is never cleared by the ISR\n");
+      abort();
+    }
+    statInterrupts++;
+    nowNs += 10 * SIM_CYCLE_NS;                       // entry, reti and the push/pop around it
+    TwiSim_SREG.value &= ~CPU_I_bm;
+    isrEntryAccesses = statAccesses;
+    inSlaveIsr       = slave;
+    vector();
+    inSlaveIsr       = false;
+    TwiSim_SREG.value |= CPU_I_bm;
+  }
+}
+
+static void dispatch(void) {
+  if (!deferred) {
+    takeInterrupts();
+  }
+}
+
+
+/* The host pins as GPIO, SDA is bit 2 and SCL bit 3 on every port that can carry them */
+#define PIN_SDA_bm  0x04
+#define PIN_SCL_bm  0x08
+
+enum {
+  PORT_DIR = 0, PORT_DIRSET, PORT_DIRCLR, PORT_DIRTGL, PORT_OUT, PORT_OUTSET, PORT_OUTCLR, PORT_OUTTGL, PORT_IN
+};
+
+static PORT_t *hostPins(uint8_t index) {
+  if (index == 0) {
+    return ((TwiSim_PORTMUX.TWIROUTEA & PORTMUX_TWI0_gm) == PORTMUX_TWI0_ALT2_gc) ? &TwiSim_PORTC : &TwiSim_PORTA;
+  }
+  return ((TwiSim_PORTMUX.TWIROUTEA & PORTMUX_TWI1_gm) == PORTMUX_TWI1_ALT2_gc) ? &TwiSim_PORTB : &TwiSim_PORTF;
+}
+
+static bool sdaHeld(SimModule &m) {
+  for (SimDevice *dev = m.devices; dev != NULL; dev = dev->nextDevice) {
+    if (dev->holdData != 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+static uint8_t portLevels(PORT_t *port) {
+  uint8_t levels = (uint8_t)(~port->DIR.value | port->OUT.value);   // released pins are pulled high
+  for (uint8_t i = 0; i < 2; i++) {
+    if (hostPins(i) == port && sdaHeld(modules[i])) {
+      levels &= ~PIN_SDA_bm;
+    }
+  }
+  return levels;
+}
+
+static void portWrite(PORT_t *port, uint8_t offset, uint8_t data) {
+  uint8_t before = portLevels(port);
+  switch (offset) {
+    case PORT_DIR:    port->DIR.value  = data;  break;
+    case PORT_DIRSET: port->DIR.value |= data;  break;
+    case PORT_DIRCLR: port->DIR.value &= ~data; break;
+    case PORT_DIRTGL: port->DIR.value ^= data;  break;
+    case PORT_OUT:    port->OUT.value  = data;  break;
+    case PORT_OUTSET: port->OUT.value |= data;  break;
+    case PORT_OUTCLR: port->OUT.value &= ~data; break;
+    case PORT_OUTTGL: port->OUT.value ^= data;  break;
+    case PORT_IN:     break;
+    default:
+      ((TwiSimReg *)port)[offset].value = data;
+      break;
+  }
+  uint8_t after = portLevels(port);
+
+  for (uint8_t i = 0; i < 2; i++) {
+    if (hostPins(i) != port) {
+      continue;
+    }
+    for (SimDevice *dev = modules[i].devices; dev != NULL; dev = dev->nextDevice) {
+      if ((before & PIN_SCL_bm) && !(after & PIN_SCL_bm) && dev->holdData != 0) {
+        dev->holdData--;                              // the client shifts out its next bit while SCL is low
+      }
+      if ((before & after & PIN_SCL_bm) && !(before & PIN_SDA_bm) && (after & PIN_SDA_bm)) {
+        dev->stops++;                                 // SDA rises while SCL is high: STOP
+        dev->stop();
+      }
+    }
+  }
+}
+
+
+/* Host side of the module */
+static void setBusState(SimModule &m, uint8_t state) {
+  m.regs->MSTATUS.value = (m.regs->MSTATUS.value & ~TWI_BUSSTATE_gm) | state;
+}
+
+static uint8_t busState(SimModule &m) {
+  return m.regs->MSTATUS.value & TWI_BUSSTATE_gm;
+}
+
+static SimDevice *findDevice(SimModule &m, uint8_t address) {
+  for (SimDevice *dev = m.devices; dev != NULL; dev = dev->nextDevice) {
+    if (dev->address == address) {
+      return dev;
+    }
+  }
+  return NULL;
+}
+
+static void masterStop(SimModule &m) {
+  if (m.client != NULL) {
+    m.client->stops++;
+    m.client->stop();
+  }
+  m.client = NULL;
+  m.held   = false;
+  m.regs->MSTATUS.value &= ~(TWI_RIF_bm | TWI_WIF_bm | TWI_CLKHOLD_bm | TWI_RXACK_bm);
+  setBusState(m, TWI_BUSSTATE_IDLE_gc);
+}
+
+static void masterStart(SimModule &m, uint8_t addressByte) {
+  TWI_t &t = *m.regs;
+  uint8_t state = busState(m);
+  if (!(t.MCTRLA.value & TWI_ENABLE_bm) || state == TWI_BUSSTATE_UNKNOWN_gc || state == TWI_BUSSTATE_BUSY_gc) {
+    return;                                           // the hardware would wait for the bus to become idle
+  }
+  if (sdaHeld(m)) {
+    setBusState(m, TWI_BUSSTATE_BUSY_gc);             // SDA is low, no START possible
+    return;
+  }
+  t.MSTATUS.value &= ~(TWI_RIF_bm | TWI_WIF_bm | TWI_CLKHOLD_bm | TWI_RXACK_bm | TWI_ARBLOST_bm | TWI_BUSERR_bm);
+
+  if (m.faults.arbitrationLost != 0) {
+    m.faults.arbitrationLost--;
+    m.client = NULL;
+    t.MSTATUS.value |= TWI_ARBLOST_bm | TWI_WIF_bm;
+    setBusState(m, TWI_BUSSTATE_BUSY_gc);             // the other host owns the bus now
+    return;
+  }
+  if (m.faults.busError != 0) {
+    m.faults.busError--;
+    m.client = NULL;
+    t.MSTATUS.value |= TWI_BUSERR_bm | TWI_WIF_bm;
+    setBusState(m, TWI_BUSSTATE_IDLE_gc);
+    return;
+  }
+
+  masterByteTime(m);
+  m.reading = (addressByte & 0x01);
+  m.held    = false;
+  m.client  = findDevice(m, addressByte >> 1);
+  setBusState(m, TWI_BUSSTATE_OWNER_gc);
+
+  if (m.client != NULL) {
+    m.client->starts++;
+    m.client->byteIndex = 0;
+    if (m.client->nackAddress || !m.client->start(m.reading)) {
+      m.client = NULL;
+    }
+  }
+  if (m.client == NULL) {
+    t.MSTATUS.value |= TWI_WIF_bm | TWI_RXACK_bm | TWI_CLKHOLD_bm;
+    return;
+  }
+  if (m.client->holdClock) {
+    m.held = true;                                    // no flag will ever be set
+    return;
+  }
+  if (m.reading) {
+    t.MDATA.value = m.client->read();
+    masterByteTime(m);
+    t.MSTATUS.value |= TWI_RIF_bm | TWI_CLKHOLD_bm;
+  } else {
+    t.MSTATUS.value |= TWI_WIF_bm | TWI_CLKHOLD_bm;
+  }
+}
+
+static void masterWriteData(SimModule &m, uint8_t data) {
+  TWI_t &t = *m.regs;
+  if (busState(m) != TWI_BUSSTATE_OWNER_gc || m.reading || m.held) {
+    return;
+  }
+  t.MSTATUS.value &= ~(TWI_RIF_bm | TWI_WIF_bm | TWI_CLKHOLD_bm | TWI_RXACK_bm);
+  masterByteTime(m);
+  bool ack = false;
+  if (m.client != NULL) {
+    int index = m.client->byteIndex++;
+    ack = (index != m.client->nackAfter) && m.client->write(data);
+  }
+  t.MSTATUS.value |= TWI_WIF_bm | TWI_CLKHOLD_bm | (ack ? 0 : TWI_RXACK_bm);
+}
+
+static void masterCommand(SimModule &m, uint8_t data) {
+  TWI_t &t = *m.regs;
+  t.MCTRLB.value = data & TWI_ACKACT_bm;              // MCMD and FLUSH always read as zero
+
+  if (data & TWI_FLUSH_bm) {
+    m.client = NULL;
+    m.held   = false;
+    t.MDATA.value = 0;
+    t.MSTATUS.value &= ~(MSTATUS_FLAGS | TWI_RXACK_bm);
+    if (t.MCTRLA.value & TWI_ENABLE_bm) {
+      setBusState(m, TWI_BUSSTATE_IDLE_gc);
+    }
+    return;
+  }
+  if (busState(m) != TWI_BUSSTATE_OWNER_gc) {
+    return;
+  }
+  switch (data & TWI_MCMD_gm) {
+    case TWI_MCMD_REPSTART_gc:
+      masterStart(m, t.MADDR.value);
+      break;
+    case TWI_MCMD_RECVTRANS_gc:
+      if (m.reading && !m.held) {
+        t.MSTATUS.value &= ~(TWI_RIF_bm | TWI_WIF_bm | TWI_CLKHOLD_bm);
+        if (!(data & TWI_ACKACT_bm) && m.client != NULL) {
+          t.MDATA.value = m.client->read();
+          masterByteTime(m);
+          t.MSTATUS.value |= TWI_RIF_bm | TWI_CLKHOLD_bm;
+        }
+      }
+      break;
+    case TWI_MCMD_STOP_gc:
+      masterStop(m);
+      break;
+    default:
+      break;
+  }
+}
+
+
+/* Client side of the module, driven by the simulated external host */
+static bool slaveMatches(TWI_t &t, uint8_t address) {
+  uint8_t saddr = t.SADDR.value;
+  uint8_t mask  = t.SADDRMASK.value;
+  if (t.SCTRLA.value & TWI_PMEN_bm) {
+    return true;
+  }
+  if (address == 0x00 && (saddr & 0x01)) {
+    return true;                                      // general call
+  }
+  if ((saddr >> 1) == address) {
+    return true;
+  }
+  if (mask & TWI_ADDREN_bm) {
+    return (mask >> 1) == address;                    // second address
+  }
+  return ((((saddr >> 1) ^ address) & ~(mask >> 1)) & 0x7F) == 0;  // address mask
+}
+
+static void slaveRaise(SimModule &m, uint8_t flags) {
+  TWI_t &t = *m.regs;
+  t.SSTATUS.value = (t.SSTATUS.value & ~(TWI_DIF_bm | TWI_APIF_bm | TWI_RXACK_bm | TWI_DIR_bm | TWI_AP_bm)) | flags;
+  m.scmd = SIM_NO_SCMD;
+  takeInterrupts();                                   // the host waits while the client holds SCL
+}
+
+static void slaveCommand(SimModule &m, uint8_t scmd, bool ack) {
+  TWI_t &t = *m.regs;
+  m.scmd     = scmd;
+  m.sack     = ack;
+  m.sdataOut = t.SDATA.value;
+  t.SSTATUS.value &= ~(TWI_DIF_bm | TWI_APIF_bm | TWI_CLKHOLD_bm);
+  if (inSlaveIsr) {
+    statResponses++;
+    statResponseAccesses += statAccesses - isrEntryAccesses;
+  }
+}
+
+/* In smart mode, reading SDATA after a received byte or writing it for the next one to send
+ * acts as a RESPONSE command with the ACKACT that is set in SCTRLB.
+ */
+static void slaveSmartAccess(SimModule &m, bool written) {
+  TWI_t &t = *m.regs;
+  uint8_t status = t.SSTATUS.value;
+  if (!(t.SCTRLA.value & TWI_SMEN_bm) || !(status & TWI_DIF_bm)) {
+    return;
+  }
+  if (written == ((status & TWI_DIR_bm) != 0)) {
+    slaveCommand(m, TWI_SCMD_RESPONSE_gc, !(t.SCTRLB.value & TWI_ACKACT_bm));
+  }
+}
+
+static bool slaveAddress(SimModule &m, uint8_t address, bool read) {
+  TWI_t &t = *m.regs;
+  hostByteTime();
+  if (!(t.SCTRLA.value & TWI_ENABLE_bm) || !slaveMatches(t, address)) {
+    return false;
+  }
+  m.slaveAddressed = true;
+  t.SDATA.value = (address << 1) | (read ? 0x01 : 0x00);
+  slaveRaise(m, TWI_APIF_bm | TWI_AP_bm | TWI_CLKHOLD_bm | (read ? TWI_DIR_bm : 0));
+  return (m.scmd != SIM_NO_SCMD) && m.sack;
+}
+
+static void slaveStop(SimModule &m) {
+  if (m.slaveAddressed && (m.regs->SCTRLA.value & TWI_PIEN_bm)) {
+    slaveRaise(m, TWI_APIF_bm);
+  }
+  m.slaveAddressed = false;
+}
+
+
+/* Register stand-ins */
+TwiSimReg &TwiSimReg::operator=(uint8_t data) {
+  TwiSim::write(this, data);
+  return *this;
+}
+
+TwiSimReg::operator uint8_t() const {
+  return TwiSim::read(this);
+}
+
+TwiSimSREG &TwiSimSREG::operator=(uint8_t data) {
+  value = data;
+  TwiSim::sregWritten();
+  return *this;
+}
+
+
+void TwiSim::write(const void *reg, uint8_t data) {
+  uint8_t offset;
+  SimModule *mp = findRegister(reg, &offset);
+  if (mp == NULL) {
+    PORT_t *port = findPort(reg, &offset);
+    if (port != NULL) {
+      nowNs += SIM_ACCESS_NS;
+      portWrite(port, offset, data);
+    }
+    return;
+  }
+  SimModule &m = *mp;
+  TWI_t &t = *m.regs;
+  statAccesses++;
+  nowNs += SIM_ACCESS_NS;
+
+  switch (offset) {
+    case REG_MCTRLA:
+      t.MCTRLA.value = data;
+      if (!(data & TWI_ENABLE_bm)) {
+        m.client = NULL;
+        t.MSTATUS.value = TWI_BUSSTATE_UNKNOWN_gc;
+      }
+      break;
+    case REG_MCTRLB:
+      masterCommand(m, data);
+      break;
+    case REG_MSTATUS:
+      t.MSTATUS.value &= ~(data & MSTATUS_FLAGS);     // write one to clear
+      if ((data & TWI_BUSSTATE_gm) == TWI_BUSSTATE_IDLE_gc) {
+        setBusState(m, TWI_BUSSTATE_IDLE_gc);         // forced into idle
+      } else if ((data & TWI_ARBLOST_bm) && busState(m) == TWI_BUSSTATE_BUSY_gc) {
+        setBusState(m, TWI_BUSSTATE_IDLE_gc);         // the other host is done by now
+      }
+      break;
+    case REG_MADDR:
+      t.MADDR.value = data;
+      masterStart(m, data);
+      break;
+    case REG_MDATA:
+      t.MDATA.value = data;
+      masterWriteData(m, data);
+      break;
+    case REG_SCTRLB:
+      t.SCTRLB.value = data & TWI_ACKACT_bm;
+      if ((data & TWI_SCMD_gm) != TWI_SCMD_NOACT_gc) {
+        slaveCommand(m, data & TWI_SCMD_gm, !(data & TWI_ACKACT_bm));
+      }
+      break;
+    case REG_SDATA:
+      t.SDATA.value = data;
+      slaveSmartAccess(m, true);
+      break;
+    case REG_SSTATUS:
+      t.SSTATUS.value &= ~(data & SSTATUS_FLAGS);
+      break;
+    default:
+      if (offset < REG_COUNT) {
+        ((TwiSimReg *)reg)->value = data;
+      }
+      break;
+  }
+  dispatch();
+}
+
+uint8_t TwiSim::read(const void *reg) {
+  uint8_t offset;
+  SimModule *mp = findRegister(reg, &offset);
+  const TwiSimReg *r = (const TwiSimReg *)reg;
+  if (mp == NULL) {
+    PORT_t *port = findPort(reg, &offset);
+    if (port != NULL) {
+      nowNs += SIM_ACCESS_NS;
+      if (offset == PORT_IN) {
+        return portLevels(port);
+      }
+    }
+    return r->value;
+  }
+  statAccesses++;
+  nowNs += SIM_ACCESS_NS;
+  uint8_t value = r->value;
+  if (offset == REG_MDATA) {
+    TWI_t &t = *mp->regs;
+    bool received = (t.MSTATUS.value & TWI_RIF_bm) != 0;
+    t.MSTATUS.value &= ~(TWI_RIF_bm | TWI_WIF_bm | TWI_CLKHOLD_bm);
+    if (received && (t.MCTRLA.value & TWI_SMEN_bm)) {   // smart mode: the acknowledge action set in MCTRLB
+      masterCommand(*mp, TWI_MCMD_RECVTRANS_gc | (t.MCTRLB.value & TWI_ACKACT_bm));
+      dispatch();
+    }
+  } else if (offset == REG_SDATA) {
+    slaveSmartAccess(*mp, false);
+    dispatch();
+  }
+  return value;
+}
+
+void TwiSim::sregWritten(void) {
+  dispatch();
+}
+
+
+/* Public interface */
+void TwiSim::reset(void) {
+  initModules();
+  for (uint8_t i = 0; i < 2; i++) {
+    SimModule &m = modules[i];
+    memset((void *)m.regs, 0, sizeof(TWI_t));
+    m.devices        = NULL;
+    m.faults.arbitrationLost = 0;
+    m.faults.busError        = 0;
+    m.client         = NULL;
+    m.reading        = false;
+    m.held           = false;
+    m.scmd           = SIM_NO_SCMD;
+    m.sack           = false;
+    m.slaveAddressed = false;
+    m.riseNs         = 0;
+  }
+  memset((void *)&TwiSim_PORTA,   0, sizeof(PORT_t));
+  memset((void *)&TwiSim_PORTB,   0, sizeof(PORT_t));
+  memset((void *)&TwiSim_PORTC,   0, sizeof(PORT_t));
+  memset((void *)&TwiSim_PORTF,   0, sizeof(PORT_t));
+  memset((void *)&TwiSim_PORTMUX, 0, sizeof(PORTMUX_t));
+  TwiSim_SREG.value = CPU_I_bm;
+  deferred = false;
+  clearStats();
+}
+
+void TwiSim::attach(TWI_t &module, SimDevice *device) {
+  SimModule &m = moduleOf(module);
+  detach(module, device);
+  device->nextDevice = m.devices;
+  m.devices = device;
+}
+
+void TwiSim::detach(TWI_t &module, SimDevice *device) {
+  SimModule &m = moduleOf(module);
+  for (SimDevice **dev = &m.devices; *dev != NULL; dev = &((*dev)->nextDevice)) {
+    if (*dev == device) {
+      *dev = device->nextDevice;
+      break;
+    }
+  }
+  if (m.client == device) {
+    m.client = NULL;
+  }
+}
+
+SimBusFaults &TwiSim::faults(TWI_t &module) {
+  return moduleOf(module).faults;
+}
+
+int TwiSim::hostWrite(TWI_t &module, uint8_t address, const uint8_t *data, size_t length, bool sendStop) {
+  SimModule &m = moduleOf(module);
+  int result = -1;
+  if (slaveAddress(m, address, false)) {
+    bool released = (m.scmd == TWI_SCMD_COMPTRANS_gc);  // client does not take any data
+    result = 0;
+    for (size_t i = 0; i < length && !released; i++) {
+      hostByteTime();
+      module.SDATA.value = data[i];
+      slaveRaise(m, TWI_DIF_bm | TWI_CLKHOLD_bm);
+      if (m.scmd == SIM_NO_SCMD || !m.sack) {
+        break;                                        // NACK
+      }
+      result++;
+      released = (m.scmd == TWI_SCMD_COMPTRANS_gc);
+    }
+  }
+  if (sendStop) {
+    hostByteTime();
+    slaveStop(m);
+  }
+  return result;
+}
+
+int TwiSim::hostRead(TWI_t &module, uint8_t address, uint8_t *buffer, size_t length, bool sendStop) {
+  SimModule &m = moduleOf(module);
+  int result = -1;
+  if (slaveAddress(m, address, true)) {
+    bool released = (m.scmd != TWI_SCMD_RESPONSE_gc);
+    result = 0;
+    for (size_t i = 0; i < length; i++) {
+      uint8_t data = 0xFF;                            // nobody drives SDA
+      if (!released) {
+        slaveRaise(m, TWI_DIF_bm | TWI_DIR_bm | TWI_CLKHOLD_bm);   // previous byte was ACKed
+        if (m.scmd == TWI_SCMD_RESPONSE_gc) {
+          data = m.sdataOut;
+        } else {
+          released = true;
+        }
+      }
+      hostByteTime();
+      buffer[i] = data;
+      result++;
+    }
+    if (!released) {
+      slaveRaise(m, TWI_DIF_bm | TWI_DIR_bm | TWI_RXACK_bm | TWI_CLKHOLD_bm);  // the last byte is NACKed
+    }
+  }
+  if (sendStop) {
+    hostByteTime();
+    slaveStop(m);
+  }
+  return result;
+}
+
+void TwiSim::setInterruptsDeferred(bool defer) {
+  deferred = defer;
+}
+
+void TwiSim::service(void) {
+  takeInterrupts();
+}
+
+bool TwiSim::interruptPending(void) {
+  return slavePending(modules[0]) || masterPending(modules[0]) || slavePending(modules[1]) || masterPending(modules[1]);
+}
+
+uint64_t TwiSim::nanos(void) {
+  return nowNs;
+}
+
+void TwiSim::setRiseTime(TWI_t &module, uint16_t ns) {
+  moduleOf(module).riseNs = ns;
+}
+
+void TwiSim::advance(uint64_t ns) {
+  nowNs += ns;
+}
+
+void TwiSim::clearStats(void) {
+  statAccesses   = 0;
+  statBytes      = 0;
+  statMasterNs   = 0;
+  statInterrupts = 0;
+  statResponses  = 0;
+  statResponseAccesses = 0;
+}
+
+uint32_t TwiSim::registerAccesses(void) {
+  return statAccesses;
+}
+
+uint32_t TwiSim::busBytes(void) {
+  return statBytes;
+}
+
+uint64_t TwiSim::masterBusNanos(void) {
+  return statMasterNs;
+}
+
+uint32_t TwiSim::interrupts(void) {
+  return statInterrupts;
+}
+
+uint32_t TwiSim::slaveResponses(void) {
+  return statResponses;
+}
+
+uint32_t TwiSim::slaveResponseAccesses(void) {
+  return statResponseAccesses;
+}
+
+
+/* Simulated clients */
+SimDevice::SimDevice(uint8_t addr) {
+  address     = addr;
+  nackAddress = false;
+  nackAfter   = -1;
+  holdClock   = false;
+  holdData    = 0;
+  starts      = 0;
+  stops       = 0;
+  byteIndex   = 0;
+  nextDevice  = NULL;
+}
+
+bool SimDevice::start(bool read) {
+  (void)read;
+  return true;
+}
+
+bool SimDevice::write(uint8_t data) {
+  (void)data;
+  return true;
+}
+
+uint8_t SimDevice::read(void) {
+  return 0xFF;
+}
+
+void SimDevice::stop(void) {
+}
+
+
+SimRecorder::SimRecorder(uint8_t addr) : SimDevice(addr) {
+  receivedCount  = 0;
+  responseLength = 0;
+  responseIndex  = 0;
+}
+
+bool SimRecorder::start(bool read) {
+  if (read) {
+    responseIndex = 0;
+  }
+  return true;
+}
+
+bool SimRecorder::write(uint8_t data) {
+  if (receivedCount < sizeof(received)) {
+    received[receivedCount++] = data;
+  }
+  return true;
+}
+
+uint8_t SimRecorder::read(void) {
+  if (responseIndex < responseLength) {
+    return response[responseIndex++];
+  }
+  return 0xFF;
+}
+
+void SimRecorder::respond(const uint8_t *data, size_t length) {
+  if (length > sizeof(response)) {
+    length = sizeof(response);
+  }
+  memcpy(response, data, length);
+  responseLength = length;
+  responseIndex  = 0;
+}
+
+
+SimTenBitDevice::SimTenBitDevice(uint16_t address10) : SimRecorder(0x78 | ((address10 >> 8) & 0x03)) {
+  addressLow = (uint8_t)address10;
+  selected   = false;
+  lowPending = false;
+}
+
+bool SimTenBitDevice::start(bool read) {
+  if (read) {
+    return selected && SimRecorder::start(true);
+  }
+  selected   = false;
+  lowPending = true;
+  return true;
+}
+
+bool SimTenBitDevice::write(uint8_t data) {
+  if (lowPending) {
+    lowPending = false;
+    selected   = (data == addressLow);
+    return selected;
+  }
+  return SimRecorder::write(data);
+}
+
+void SimTenBitDevice::stop(void) {
+  selected   = false;
+  lowPending = false;
+}
+
+
+SimRegisterDevice::SimRegisterDevice(uint8_t addr) : SimDevice(addr) {
+  memset(regs, 0, sizeof(regs));
+  pointer    = 0;
+  pointerSet = false;
+}
+
+bool SimRegisterDevice::start(bool read) {
+  (void)read;
+  pointerSet = false;
+  return true;
+}
+
+bool SimRegisterDevice::write(uint8_t data) {
+  if (!pointerSet) {
+    pointer    = data;
+    pointerSet = true;
+  } else {
+    regs[pointer++] = data;
+  }
+  return true;
+}
+
+uint8_t SimRegisterDevice::read(void) {
+  return regs[pointer++];
+}
@@ -0,0 +1,164 @@
+/* twi_sim.h - register level model of the AVR TWI peripheral and a simulated bus
+
+  The library sources in Wire/src are compiled unchanged against the host avr/io.h and Arduino.h
+  in this folder. Every TWI register access ends up in TwiSim, which moves the bus state machine
+  the way the hardware would: a write to MADDR sends a START and the address to the simulated
+  clients, a write to MDATA clocks out a byte, MCTRLB commands ACK/NACK, REP START and STOP.
+  The client side of the peripheral is driven by TwiSim::hostWrite()/hostRead(), which play the
+  role of an external host and raise SSTATUS flags one after another. The smart mode is modeled
+  on both sides: with MCTRLA.SMEN, reading MDATA after RIF acts as a RECVTRANS command, with
+  SCTRLA.SMEN, an SDATA access in a data interrupt acts as a RESPONSE command. Both use the
+  acknowledge action that is set in MCTRLB/SCTRLB.
+
+  Interrupts are delivered like on the AVR: level triggered, when the I-bit in SREG is set, and
+  not nested. By default they are taken right after the register access that raised them,
+  setInterruptsDeferred(true) keeps them pending until service() is called.
+
+  The SDA and SCL lines of the host pins are modeled for the port registers too: a pin drives
+  low when its DIR bit is set (the OUT bits stay 0), otherwise the pull-up takes it high, unless
+  a client holds SDA. That is enough to clock the bus with the pins as GPIO, like a bus recovery.
+
+  The bus is much faster than on real hardware - a transfer finishes within the register access
+  that started it - but the order of flags and commands is the one of the data sheet. Simulated
+  time advances with every register access and every bit on the bus, micros()/millis() read it.
+*/
+
+#ifndef TWI_SIM_H
+#define TWI_SIM_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+struct TWI_struct;
+
+/* A client on the simulated bus. The default implementation ACKs everything and returns 0xFF,
+ * derived classes override what they need. The fault fields are checked by the bus model.
+ */
+class SimDevice {
+ public:
+    explicit SimDevice(uint8_t address);
+    virtual ~SimDevice() {}
+
+    virtual bool    start(bool read);           // address phase, return true to ACK
+    virtual bool    write(uint8_t data);        // host wrote a byte, return true to ACK
+    virtual uint8_t read(void);                 // host reads a byte
+    virtual void    stop(void);                 // STOP condition
+
+    uint8_t address;                            // 7-bit address
+    bool    nackAddress;                        // fault: do not acknowledge the address
+    int     nackAfter;                          // fault: NACK the data byte with this index after START, -1 for never
+    bool    holdClock;                          // fault: stretch SCL forever after the next address
+    uint8_t holdData;                           // fault: SDA is held low until SCL was clocked this often on the pins
+
+    uint16_t starts;                            // statistics
+    uint16_t stops;
+    uint16_t byteIndex;                         // bytes written since the last START
+
+    SimDevice *nextDevice;                      // list of the devices on one bus, managed by TwiSim
+};
+
+
+/* Records everything the host writes and answers reads from a prepared response */
+class SimRecorder: public SimDevice {
+ public:
+    explicit SimRecorder(uint8_t address);
+
+    bool    start(bool read);
+    bool    write(uint8_t data);
+    uint8_t read(void);
+
+    void    respond(const uint8_t *data, size_t length);
+
+    uint8_t received[256];
+    size_t  receivedCount;
+    uint8_t response[256];
+    size_t  responseLength;
+    size_t  responseIndex;
+};
+
+
+/* A SimRecorder with a 10-bit address. It answers the first byte 11110xx, the second byte of a
+ * write selects it, a read is only ACKed while it is selected, that is until the next STOP.
+ * The second address byte is not recorded.
+ */
+class SimTenBitDevice: public SimRecorder {
+ public:
+    explicit SimTenBitDevice(uint16_t address10);
+
+    bool    start(bool read);
+    bool    write(uint8_t data);
+    void    stop(void);
+
+    uint8_t addressLow;
+    bool    selected;
+
+ private:
+    bool    lowPending;
+};
+
+
+/* A register file like on most sensors and EEPROMs: the first byte of a write sets the register
+ * pointer, the following bytes are stored with auto-increment, reads continue at the pointer.
+ */
+class SimRegisterDevice: public SimDevice {
+ public:
+    explicit SimRegisterDevice(uint8_t address);
+
+    bool    start(bool read);
+    bool    write(uint8_t data);
+    uint8_t read(void);
+
+    uint8_t regs[256];
+    uint8_t pointer;
+
+ private:
+    bool    pointerSet;
+};
+
+
+/* Faults on the bus itself, they apply to the next START(s) of the host */
+struct SimBusFaults {
+  uint8_t arbitrationLost;                      // lose arbitration on the next n STARTs
+  uint8_t busError;                             // report a bus error on the next n STARTs
+};
+
+
+class TwiSim {
+ public:
+    static void     reset(void);                // power-on reset of both modules, removes all devices and faults
+
+    static void     attach(struct TWI_struct &module, SimDevice *device);
+    static void     detach(struct TWI_struct &module, SimDevice *device);
+    static SimBusFaults &faults(struct TWI_struct &module);
+    static void     setRiseTime(struct TWI_struct &module, uint16_t ns);  // of SCL, 0 after reset()
+
+    /* The simulated external host for the client side of the module. Both return the number of data
+     * bytes that were transferred or -1 if the address was not acknowledged. sendStop = false ends
+     * with the bus still claimed, the next call then starts with a REP START.
+     */
+    static int      hostWrite(struct TWI_struct &module, uint8_t address, const uint8_t *data, size_t length, bool sendStop = true);
+    static int      hostRead(struct TWI_struct &module, uint8_t address, uint8_t *buffer, size_t length, bool sendStop = true);
+
+    static void     setInterruptsDeferred(bool deferred);
+    static void     service(void);              // take all pending interrupts
+    static bool     interruptPending(void);
+
+    static uint64_t nanos(void);
+    static void     advance(uint64_t ns);
+
+    /* Statistics, cleared by reset() and clearStats() */
+    static void     clearStats(void);
+    static uint32_t registerAccesses(void);
+    static uint32_t busBytes(void);
+    static uint64_t masterBusNanos(void);       // time the host clocked bytes on the bus
+    static uint32_t interrupts(void);
+    static uint32_t slaveResponses(void);       // SCTRLB commands written from the client interrupt
+    static uint32_t slaveResponseAccesses(void);  // register accesses from the vector entry up to those commands
+
+    /* Called by the register stand-ins */
+    static void     write(const void *reg, uint8_t data);
+    static uint8_t  read(const void *reg);
+    static void     sregWritten(void);
+};
+
+#endif  // TWI_SIM_H
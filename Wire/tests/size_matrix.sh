@@ -0,0 +1,40 @@
+#!/bin/sh
+# Flash and RAM of sizetest_matrix for every host/client mode x buffer layout x Wire/Wire1 x buffer size,
+# the same matrix as "make -C host bench". Needs arduino-cli with DxCore installed.
+#
+#   ./size_matrix.sh
+#   FQBN=DxCore:megaavr:avrdb:chip=avr64db32 ./size_matrix.sh
+
+FQBN=${FQBN:-DxCore:megaavr:avrda:chip=avr128da48}
+TESTS=$(cd "$(dirname "$0")" && pwd)
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+
+# arduino-cli only picks up a library with a library.properties, so this tree is wrapped in one.
+# It then replaces the Wire library that comes with the core.
+mkdir -p "$WORK/Wire"
+ln -s "$TESTS/../src" "$WORK/Wire/src"
+printf 'name=Wire\nversion=0.0.0\narchitectures=megaavr\n' > "$WORK/Wire/library.properties"
+
+printf '%-22s %8s %8s\n' configuration flash RAM
+for mode in mors mands; do
+  for buffers in split merge; do
+    for instance in wire wire1; do
+      for length in 32 130; do
+        flags="-DBUFFER_LENGTH=$length"
+        [ "$buffers" = merge ] && flags="$flags -DTWI_MERGE_BUFFERS"
+        menu="${mode}1"
+        [ "$instance" = wire1 ] && menu="${mode}2"
+
+        out=$(arduino-cli compile --fqbn "$FQBN,wire=$menu" --library "$WORK/Wire" \
+                --build-path "$WORK/build" \
+                --build-property "compiler.c.extra_flags=$flags" \
+                --build-property "compiler.cpp.extra_flags=$flags" \
+                "$TESTS/sizetest_matrix" 2>&1) || { echo "$out"; exit 1; }
+        flash=$(echo "$out" | sed -n 's/^Sketch uses \([0-9]*\) bytes.*/\1/p')
+        ram=$(echo "$out" | sed -n 's/^Global variables use \([0-9]*\) bytes.*/\1/p')
+        printf '%-22s %8s %8s\n' "$mode-$buffers-$instance-$length" "$flash" "$ram"
+      done
+    done
+  done
+done
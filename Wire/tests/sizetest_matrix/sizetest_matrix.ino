@@ -0,0 +1,71 @@
+#include "Arduino.h"
+#include "Wire.h"
+
+// This sketch is compiled by size_matrix.sh once per Wire configuration. It uses the
+// host and the client side of every Wire instance, so the numbers contain the complete
+// library, including the interrupt handlers.
+
+volatile uint8_t received;
+
+void rxFunction(int numBytes) {
+  while (numBytes--) {
+    received += Wire.read();
+  }
+}
+
+void txFunction(void) {
+  Wire.write(received);
+}
+
+#if defined(USING_WIRE1)
+void rxFunction1(int numBytes) {
+  while (numBytes--) {
+    received += Wire1.read();
+  }
+}
+
+void txFunction1(void) {
+  Wire1.write(received);
+}
+#endif
+
+
+void setup() {
+  #if defined(TWI_MANDS)
+    Wire.enableDualMode(false);
+  #endif
+  Wire.begin();
+  Wire.begin(0x40);
+  Wire.onReceive(rxFunction);
+  Wire.onRequest(txFunction);
+
+  #if defined(USING_WIRE1)
+    #if defined(TWI_MANDS)
+      Wire1.enableDualMode(false);
+    #endif
+    Wire1.begin();
+    Wire1.begin(0x20);
+    Wire1.onReceive(rxFunction1);
+    Wire1.onRequest(txFunction1);
+  #endif
+}
+
+void loop() {
+  Wire.beginTransmission(0x50);
+  Wire.write(received);
+  Wire.endTransmission();
+  Wire.requestFrom(0x50, 4);
+  while (Wire.available()) {
+    received += Wire.read();
+  }
+
+  #if defined(USING_WIRE1)
+    Wire1.beginTransmission(0x50);
+    Wire1.write(received);
+    Wire1.endTransmission();
+    Wire1.requestFrom(0x50, 4);
+    while (Wire1.available()) {
+      received += Wire1.read();
+    }
+  #endif
+}